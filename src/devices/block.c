@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#ifdef CACHE
+#include "filesys/cache.h"
+#endif
 
 /*! A block device. */
 struct block {
@@ -143,6 +146,9 @@ void block_print_stats(void) {
                    block->read_cnt, block->write_cnt);
         }
     }
+#ifdef CACHE
+    cache_print_stats();
+#endif
 }
 
 /*! Registers a new block device with the given NAME.  If EXTRA_INFO is
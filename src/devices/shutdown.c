@@ -13,6 +13,9 @@
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/swap.h"
+#endif
 
 /*! Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -118,5 +121,8 @@ static void print_stats(void) {
 #ifdef USERPROG
     exception_print_stats();
 #endif
+#ifdef VM
+    swap_print_stats();
+#endif
 }
 
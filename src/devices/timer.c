@@ -10,8 +10,12 @@
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#ifdef USERPROG
+#include "userprog/vdata.h"
+#endif
 
 #if TIMER_FREQ < 19
 #error 8254 timer requires TIMER_FREQ >= 19
@@ -26,6 +30,13 @@ static int64_t ticks;
 /*! Number of loops per timer tick.  Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/*! Time stamp counter cycles per timer tick, or 0 if the CPU has no time
+    stamp counter.  Initialized by timer_calibrate(). */
+static uint64_t tsc_per_tick;
+
+static bool cpu_has_tsc(void);
+static uint64_t read_tsc(void);
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
@@ -42,10 +53,22 @@ void timer_init(void) {
 /*! Calibrates loops_per_tick, used to implement brief delays. */
 void timer_calibrate(void) {
     unsigned high_bit, test_bit;
+    bool has_tsc = cpu_has_tsc();
+    int64_t start_ticks;
+    uint64_t start_tsc = 0;
 
     ASSERT(intr_get_level() == INTR_ON);
     printf("Calibrating timer...  ");
 
+    /* Count time stamp counter cycles from one tick until a later one,
+       while the loop calibration below runs. */
+    start_ticks = ticks;
+    while (ticks == start_ticks)
+        barrier();
+    start_ticks = ticks;
+    if (has_tsc)
+        start_tsc = read_tsc();
+
     /* Approximate loops_per_tick as the largest power-of-two
        still less than one timer tick. */
     loops_per_tick = 1u << 10;
@@ -61,6 +84,13 @@ void timer_calibrate(void) {
             loops_per_tick |= test_bit;
     }
 
+    if (has_tsc) {
+        int64_t end_ticks = ticks;
+        while (ticks == end_ticks)
+            barrier();
+        tsc_per_tick = (read_tsc() - start_tsc) / (ticks - start_ticks);
+    }
+
     printf("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
 }
 
@@ -72,6 +102,17 @@ int64_t timer_ticks(void) {
     return t;
 }
 
+/*! Returns the time stamp counter, or 0 if the CPU has none. */
+uint64_t timer_tsc(void) {
+    return tsc_per_tick != 0 ? read_tsc() : 0;
+}
+
+/*! Returns the number of time stamp counter cycles per timer tick, or 0
+    if the CPU has no time stamp counter. */
+uint64_t timer_tsc_per_tick(void) {
+    return tsc_per_tick;
+}
+
 /*! Returns the number of timer ticks elapsed since THEN, which
     should be a value once returned by timer_ticks(). */
 int64_t timer_elapsed(int64_t then) {
@@ -154,9 +195,26 @@ void timer_print_stats(void) {
 }
 
 /*! Timer interrupt handler. */
-static void timer_interrupt(struct intr_frame *args UNUSED) {
+static void timer_interrupt(struct intr_frame *args) {
     ticks++;
-    thread_tick();
+#ifdef USERPROG
+    vdata_tick(ticks);
+#endif
+    thread_tick(args->cs != SEL_KCSEG);
+}
+
+/*! Returns true if the CPU has a time stamp counter. */
+static bool cpu_has_tsc(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    return (edx & (1 << 4)) != 0;
+}
+
+/*! Reads the time stamp counter. */
+static uint64_t read_tsc(void) {
+    uint64_t tsc;
+    asm volatile ("rdtsc" : "=A" (tsc));
+    return tsc;
 }
 
 /*! Returns true if LOOPS iterations waits for more than one timer tick,
@@ -0,0 +1,126 @@
+/* ringbench.c
+
+   Writes and then reads back a file in small records, once with one
+   system call per record and once through a ring, and checks that both
+   ways see the same data.  Each way is timed with the clock on the
+   kernel data page. */
+
+#include <ring.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include <vdata.h>
+
+#define RECORDS 1024            /* Records per pass. */
+#define RECORD_SIZE 16          /* Bytes per record. */
+
+static struct ring ring;
+static char data[RECORDS][RECORD_SIZE];
+static char check[RECORDS][RECORD_SIZE];
+
+/* Opens NAME, exiting on failure. */
+static int
+open_or_die (const char *name) 
+{
+  int fd = open (name);
+  if (fd < 0) 
+    {
+      printf ("%s: open failed\n", name);
+      exit (EXIT_FAILURE);
+    }
+  return fd;
+}
+
+/* Moves every record between BUF and FD with one call per record,
+   writing if TO_FILE is true and reading otherwise.  Returns the number of
+   system calls made. */
+static int
+plain_pass (int fd, bool to_file, char buf[][RECORD_SIZE]) 
+{
+  int i;
+
+  seek (fd, 0);
+  for (i = 0; i < RECORDS; i++) 
+    {
+      int n = to_file ? write (fd, buf[i], RECORD_SIZE)
+                     : read (fd, buf[i], RECORD_SIZE);
+      if (n != RECORD_SIZE) 
+        {
+          printf ("record %d: %s failed\n", i, to_file ? "write" : "read");
+          exit (EXIT_FAILURE);
+        }
+    }
+  return RECORDS + 1;
+}
+
+/* Like plain_pass(), but queues the records on a ring a batch at a
+   time. */
+static int
+ring_pass (int fd, bool to_file, char buf[][RECORD_SIZE]) 
+{
+  struct ring_cqe cqe;
+  int queued = 0, calls = 0;
+
+  ring_queue (&ring, RING_SEEK, fd, NULL, 0, RECORDS);
+  while (queued < RECORDS || ring.sq_head != ring.sq_tail) 
+    {
+      while (queued < RECORDS
+             && ring_queue (&ring, to_file ? RING_WRITE : RING_READ, fd,
+                            buf[queued], RECORD_SIZE, queued))
+        queued++;
+      ring_submit (&ring);
+      calls++;
+      while (ring_reap (&ring, &cqe))
+        if (cqe.user_data < RECORDS && cqe.result != RECORD_SIZE) 
+          {
+            printf ("record %u: %s failed\n", cqe.user_data,
+                    to_file ? "write" : "read");
+            exit (EXIT_FAILURE);
+          }
+    }
+  return calls;
+}
+
+int
+main (void) 
+{
+  const char *name = "ringbench.dat";
+  int fd, i, plain_calls, ring_calls;
+  uint64_t start, plain_ns, ring_ns;
+
+  for (i = 0; i < RECORDS; i++)
+    snprintf (data[i], RECORD_SIZE, "record %d", i);
+
+  if (!create (name, RECORDS * RECORD_SIZE)) 
+    {
+      printf ("%s: create failed\n", name);
+      return EXIT_FAILURE;
+    }
+  fd = open_or_die (name);
+  ring_init (&ring);
+
+  start = clock_ns ();
+  plain_calls = plain_pass (fd, true, data);
+  plain_calls += plain_pass (fd, false, check);
+  plain_ns = clock_ns () - start;
+  if (memcmp (data, check, sizeof data))
+    printf ("plain: data mismatch\n");
+
+  memset (check, 0, sizeof check);
+  start = clock_ns ();
+  ring_calls = ring_pass (fd, true, data);
+  ring_calls += ring_pass (fd, false, check);
+  ring_ns = clock_ns () - start;
+  if (memcmp (data, check, sizeof data))
+    printf ("ring: data mismatch\n");
+
+  printf ("%d records of %d bytes written and read back\n",
+          RECORDS, RECORD_SIZE);
+  printf ("plain: %d system calls, %llu us\n", plain_calls,
+          plain_ns / 1000);
+  printf ("ring:  %d system calls, %llu us\n", ring_calls, ring_ns / 1000);
+
+  close (fd);
+  remove (name);
+  return EXIT_SUCCESS;
+}
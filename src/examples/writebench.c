@@ -0,0 +1,123 @@
+/* writebench.c
+
+   Measures how write throughput to one file scales with the number
+   of writers.  For 1, 2 and 4 writers in turn, runs that many child
+   processes that each write their own share of one file, in records,
+   at the same time, and times the whole batch with the clock on the
+   kernel data page.  Then reads the file back to check that no two
+   writers overwrote each other.
+
+   Run without arguments.  "writebench CHILD WRITERS" is how it runs
+   each child. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <vdata.h>
+
+#define FILE_SIZE 65536         /* Bytes written per pass. */
+#define RECORD_SIZE 512         /* Bytes per write() call. */
+#define MAX_WRITERS 4           /* Most writers in one pass. */
+
+static const char *file_name = "writebench.dat";
+static char record[RECORD_SIZE];
+
+/* Writes the share of the file that belongs to writer CHILD of
+   WRITERS, filling each record with the writer's number. */
+static int
+run_child (int child, int writers) 
+{
+  int share = FILE_SIZE / writers;
+  int fd, ofs;
+
+  fd = open (file_name);
+  if (fd < 0)
+    return EXIT_FAILURE;
+  memset (record, 'a' + child, sizeof record);
+  seek (fd, share * child);
+  for (ofs = 0; ofs < share; ofs += RECORD_SIZE)
+    if (write (fd, record, RECORD_SIZE) != RECORD_SIZE)
+      return EXIT_FAILURE;
+  close (fd);
+  return EXIT_SUCCESS;
+}
+
+/* Reads the file back and checks each writer's share.  Returns true
+   if all are intact. */
+static bool
+check_file (int writers) 
+{
+  int share = FILE_SIZE / writers;
+  bool ok = true;
+  int fd, ofs, i;
+
+  fd = open (file_name);
+  if (fd < 0)
+    return false;
+  for (ofs = 0; ofs < FILE_SIZE; ofs += RECORD_SIZE) 
+    {
+      if (read (fd, record, RECORD_SIZE) != RECORD_SIZE)
+        ok = false;
+      for (i = 0; i < RECORD_SIZE; i++)
+        if (record[i] != 'a' + ofs / share)
+          ok = false;
+    }
+  close (fd);
+  return ok;
+}
+
+/* Runs one pass with WRITERS writers and reports its throughput.
+   Returns true if the file came out right. */
+static bool
+run_pass (const char *prog, int writers) 
+{
+  pid_t children[MAX_WRITERS];
+  char cmd_line[64];
+  uint64_t start, ns;
+  bool ok = true;
+  int i;
+
+  remove (file_name);
+  if (!create (file_name, 0)) 
+    {
+      printf ("%s: create failed\n", file_name);
+      return false;
+    }
+
+  start = clock_ns ();
+  for (i = 0; i < writers; i++) 
+    {
+      snprintf (cmd_line, sizeof cmd_line, "%s %d %d", prog, i, writers);
+      children[i] = exec (cmd_line);
+      if (children[i] == PID_ERROR)
+        ok = false;
+    }
+  for (i = 0; i < writers; i++)
+    if (children[i] != PID_ERROR && wait (children[i]) != EXIT_SUCCESS)
+      ok = false;
+  ns = clock_ns () - start;
+
+  if (ok)
+    ok = check_file (writers);
+  printf ("%d writer%s: %d bytes in %llu us, %llu kB/s%s\n",
+          writers, writers > 1 ? "s" : " ", FILE_SIZE, ns / 1000,
+          ns > 0 ? (uint64_t) FILE_SIZE * 1000000 / ns : 0,
+          ok ? "" : ", FAILED");
+  return ok;
+}
+
+int
+main (int argc, char *argv[]) 
+{
+  bool ok = true;
+  int writers;
+
+  if (argc == 3)
+    return run_child (atoi (argv[1]), atoi (argv[2]));
+
+  for (writers = 1; writers <= MAX_WRITERS; writers *= 2)
+    ok = run_pass (argv[0], writers) && ok;
+  remove (file_name);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,44 +1,94 @@
+/*! \file cache.c
+ *
+ * Buffer cache.  Sectors are replaced by 2Q: a sector read or written for
+ * the first time joins the A1 queue, which is first in, first out, and
+ * only moves to the Am queue, kept in least recently used order, if it is
+ * missed again soon after leaving A1.  A sequential scan thus passes
+ * through A1 without pushing out the sectors in Am.  Sectors tagged
+ * CACHE_META by their callers go straight to Am, and eviction passes over
+ * each of them once before taking it.
+ *
+ * A metadata write also holds its sector back from being written to disk
+ * until the journal has logged it.  Held sectors are passed over by
+ * eviction and by write-behind alike.
+ */
+
 #include "filesys/cache.h"
+#include <round.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include "devices/block.h"
 #include "devices/timer.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "filesys/off_t.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 
+/* Most sectors a range read or write pins at once. */
+#define CACHE_RANGE_MAX 8
+
+/* Slots A1 may fill before it is evicted from ahead of Am. */
+#define CACHE_A1_MAX (MAX_BUFFER_SIZE / 4)
+
+/* Sectors evicted from A1 that are remembered, so that a miss on one of
+   them puts it in Am. */
+#define CACHE_GHOSTS (MAX_BUFFER_SIZE / 2)
+
+/* An empty entry in the ring of ghosts. */
+#define GHOST_NONE ((block_sector_t) -1)
+
 static struct cache_sector cache_buffer[MAX_BUFFER_SIZE];
 
-/* List for clock eviction. */
-static struct list cache_list;
+/* 2Q queues, newest at the front. */
+static struct list a1_queue;
+static struct list am_queue;
+
+/* Ring of sectors recently evicted from A1. */
+static block_sector_t ghosts[CACHE_GHOSTS];
+static size_t ghost_next;
+
+/* Lookups that hit and missed, by class. */
+static unsigned long long class_hits[CACHE_CLASS_CNT];
+static unsigned long long class_misses[CACHE_CLASS_CNT];
 
 /* List for read_ahead. */
 static struct list read_ahead_list;
 
-/* Points to list_elem that is to be checked for eviction. */
-static struct list_elem *clock_hand;
-
 /* Global lock for protecting cache table. */
 static struct lock cache_lock;
 
+/* Number of slots holding delayed blocks. */
+static int delayed_slots;
+
+/* Number of slots held back for the journal. */
+static size_t held_slots;
+
 /* Handle global cache lock. */
 static void acquire_cache_lock(void);
 static void release_cache_lock(void);
 
 /* cache_sector constructor/destructor. Removal/insertion into list. */
-static int cache_init(block_sector_t sector_idx);
+static int cache_init(block_sector_t sector_idx, const void *fill,
+                      enum cache_class cls);
+static void cache_link(int array_idx, enum cache_queue queue);
 static void cache_free(block_sector_t sector_idx);
+static void cache_drop(int array_idx);
 
-/* Might use clock algorithm for this. */
+/* Evicts by 2Q. */
 static void cache_evict(void);
 
 /* Insertion from buffer cache. */
-static int cache_insert(block_sector_t sector_idx);
+static int cache_insert(block_sector_t sector_idx, const void *fill,
+                        enum cache_class cls);
+static int cache_pin_sector(block_sector_t sector_idx, const void *fill,
+                            enum cache_class cls, bool *filled);
 
 /* Retrieve cache_buffer index that corresponds to block sector_idx. */
 static int cache_get(block_sector_t sector_idx, bool evicting);
+static int cache_get_delayed(const struct inode *owner, block_sector_t block);
 
 /* Helper methods for eviction. */
 static int cache_get_free(void);
@@ -46,7 +96,9 @@ static bool in_cache(block_sector_t sector_idx);
 static int choose_sector_to_evict(void);
 static void cache_write_to_disk(int array_idx);
 static void cache_write_sector_to_disk(int array_idx);
-static void increment_clock_hand(void);
+static int oldest_unpinned(struct list *queue, bool spare_meta);
+static void cache_hold(int array_idx, enum cache_class cls);
+static bool ghost_take(block_sector_t sector_idx);
 
 /* Write-ahead and read-behind methods. */
 static void write_behind(void *arg_ UNUSED);
@@ -66,19 +118,29 @@ static void release_cache_lock(void) {
 
 /*! Will initialize the global variables. */
 void cache_table_init(void) {
-    list_init(&cache_list);
+    list_init(&a1_queue);
+    list_init(&am_queue);
     list_init(&read_ahead_list);
     sema_init(&read_ahead_sema, 0);
     lock_init(&cache_lock);
     acquire_cache_lock();
-    clock_hand = NULL;
     filesys_done_wait = false;
+    delayed_slots = 0;
+    held_slots = 0;
     int i;
+    for (i = 0; i < CACHE_GHOSTS; i++) {
+        ghosts[i] = GHOST_NONE;
+    }
+    ghost_next = 0;
     for (i = 0; i < MAX_BUFFER_SIZE; i++) {
         cache_buffer[i].sector_idx = 0;
+        cache_buffer[i].owner = NULL;
         cache_buffer[i].valid = false;
-        cache_buffer[i].accessed = false;
+        cache_buffer[i].queue = CACHE_QUEUE_NONE;
+        cache_buffer[i].cls = CACHE_DATA;
+        cache_buffer[i].spared = false;
         cache_buffer[i].dirty = false;
+        cache_buffer[i].journal = CACHE_JOURNAL_NONE;
         cache_buffer[i].pin_count = 0;
         cache_buffer[i].evicting = false;
         rw_lock_init(&cache_buffer[i].read_write_lock);
@@ -111,7 +173,7 @@ static void unpin(int array_idx) {
 static bool in_cache(block_sector_t sector_idx) {
     int i;
     for (i = 0; i < MAX_BUFFER_SIZE; i++) {
-        if (cache_buffer[i].valid
+        if (cache_buffer[i].valid && cache_buffer[i].owner == NULL
                 && cache_buffer[i].sector_idx == sector_idx) {
             return true;
         }
@@ -130,34 +192,69 @@ static bool is_full_cache(void) {
     return true;
 }
 
-/*! Initialize a new sector_idx, and insert into cache buffer. */
-static int cache_init(block_sector_t sector_idx) {
+/*! Initialize a new sector_idx, and insert into cache buffer.  The
+    contents come from the BLOCK_SECTOR_SIZE bytes at FILL if it is not
+    null, which saves reading a sector that is about to be overwritten.
+    Metadata, and sectors missed again soon after leaving A1, join Am;
+    the rest join A1. */
+static int cache_init(block_sector_t sector_idx, const void *fill,
+                      enum cache_class cls) {
     /* First, check that it doesn't exist */
     ASSERT(!in_cache(sector_idx));
     int i = cache_get_free();
     ASSERT(i != -1);
     ASSERT(cache_buffer[i].pin_count == 1);
     cache_buffer[i].sector_idx = sector_idx;
+    cache_buffer[i].owner = NULL;
     cache_buffer[i].valid = true;
-    cache_buffer[i].accessed = true;
-    cache_buffer[i].dirty = false;
+    cache_buffer[i].cls = cls;
+    cache_buffer[i].spared = false;
+    cache_buffer[i].dirty = fill != NULL;
     cache_buffer[i].evicting = false;
 
     /* Read from memory into buffer */
     begin_write(&cache_buffer[i].read_write_lock);
-    block_read(fs_device, sector_idx, cache_buffer[i].sector);
+    if (fill != NULL) {
+        memcpy(cache_buffer[i].sector, fill, BLOCK_SECTOR_SIZE);
+    }
+    else {
+        block_read(fs_device, sector_idx, cache_buffer[i].sector);
+    }
     end_write(&cache_buffer[i].read_write_lock);
 
-    /* Insert into eviction list. */
-    if (clock_hand == NULL) {
-        list_push_back(&cache_list, &cache_buffer[i].cache_list_elem);
+    if (ghost_take(sector_idx) || cls == CACHE_META) {
+        cache_link(i, CACHE_QUEUE_AM);
     }
     else {
-        list_insert(clock_hand, &cache_buffer[i].cache_list_elem);
+        cache_link(i, CACHE_QUEUE_A1);
     }
     return i;
 }
 
+/*! Put a newly filled slot at the front of QUEUE. */
+static void cache_link(int array_idx, enum cache_queue queue) {
+    ASSERT(queue != CACHE_QUEUE_NONE);
+    cache_buffer[array_idx].queue = queue;
+    list_push_front(queue == CACHE_QUEUE_A1 ? &a1_queue : &am_queue,
+                    &cache_buffer[array_idx].cache_list_elem);
+}
+
+/*! Record a hit on a slot as class CLS.  Am is kept in least recently used
+    order, while A1 is not reordered, so that a burst of touches to a
+    sector that is then left alone does not make it hot.  Metadata found in
+    A1 moves to Am. */
+static void cache_touch(int array_idx, enum cache_class cls) {
+    struct cache_sector *cs = &cache_buffer[array_idx];
+
+    cs->cls = cls;
+    cs->spared = false;
+    if (cs->queue == CACHE_QUEUE_AM
+            || (cs->queue == CACHE_QUEUE_A1 && cls == CACHE_META)) {
+        list_remove(&cs->cache_list_elem);
+        cache_link(array_idx, CACHE_QUEUE_AM);
+    }
+}
+
 /*! Finds appropriate sector and removes it from table. */
 static void cache_free(block_sector_t sector_idx) {
     int i = cache_get(sector_idx, true);
@@ -165,50 +262,122 @@ static void cache_free(block_sector_t sector_idx) {
     ASSERT(cache_buffer[i].pin_count == 2);
     ASSERT(cache_buffer[i].valid);
     ASSERT(cache_buffer[i].evicting);
-    if (clock_hand == &cache_buffer[i].cache_list_elem) {
-        increment_clock_hand();
+    cache_drop(i);
+}
+
+/*! Empties a slot without writing it back and removes it from its
+    queue. */
+static void cache_drop(int array_idx) {
+    if (cache_buffer[array_idx].queue != CACHE_QUEUE_NONE) {
+        list_remove(&cache_buffer[array_idx].cache_list_elem);
     }
-    cache_buffer[i].valid = false;
-    cache_buffer[i].accessed = false;
-    cache_buffer[i].dirty = false;
-    cache_buffer[i].evicting = false;
-    cache_buffer[i].sector_idx = 0;
-    cache_buffer[i].pin_count = 0;
-    list_remove(&cache_buffer[i].cache_list_elem);
+    cache_buffer[array_idx].valid = false;
+    cache_buffer[array_idx].queue = CACHE_QUEUE_NONE;
+    cache_buffer[array_idx].dirty = false;
+    ASSERT(cache_buffer[array_idx].journal == CACHE_JOURNAL_NONE);
+    cache_buffer[array_idx].evicting = false;
+    cache_buffer[array_idx].sector_idx = 0;
+    cache_buffer[array_idx].owner = NULL;
+    cache_buffer[array_idx].pin_count = 0;
 }
 
-/*! Increment clock hand in clock algorithm. */
-static void increment_clock_hand(void) {
-    if (clock_hand == NULL || clock_hand == list_back(&cache_list)) {
-        clock_hand = list_begin(&cache_list);
+/*! Holds a slot that is about to be written as class CLS back from disk
+    until the journal logs it, if CLS is metadata.  The slot must be pinned
+    and the cache lock held, so that it cannot be written back between the
+    write and the hold. */
+static void cache_hold(int array_idx, enum cache_class cls) {
+    if (cls != CACHE_META) {
+        return;
     }
-    else {
-        clock_hand = list_next(clock_hand);
+    if (cache_buffer[array_idx].journal == CACHE_JOURNAL_NONE) {
+        held_slots++;
     }
+    cache_buffer[array_idx].journal = CACHE_JOURNAL_HELD;
+}
+
+/*! Returns CNT if the cache can pin CNT sectors of a range and still have
+    room for another range, or 1 otherwise, so that ranges pinned at once
+    cannot take every slot that delayed blocks and the journal leave.  The
+    cache lock must be held. */
+static size_t cache_range_cnt(size_t cnt) {
+    size_t avail = 0;
+    int i;
 
-    if (list_size(&cache_list) == 1) {
-        clock_hand = NULL;
+    for (i = 0; i < MAX_BUFFER_SIZE; i++) {
+        struct cache_sector *cs = &cache_buffer[i];
+        if (!cs->valid || (cs->queue != CACHE_QUEUE_NONE
+                           && cs->pin_count == 0
+                           && cs->journal == CACHE_JOURNAL_NONE)) {
+            avail++;
+        }
     }
+    return avail >= cnt + CACHE_RANGE_MAX ? cnt : 1;
 }
 
-/*! Choose a cache sector to be evicted based on clock algorithm. */
-static int choose_sector_to_evict(void) {
-    ASSERT(!list_empty(&cache_list));
-    if (clock_hand == NULL) {
-        increment_clock_hand();
+/*! Returns the oldest slot on QUEUE that is neither pinned nor held for
+    the journal, or -1 if there is none.  If SPARE_META, metadata that has not been spared since it was
+    last used is moved to the front instead, once. */
+static int oldest_unpinned(struct list *queue, bool spare_meta) {
+    struct list_elem *e = list_rbegin(queue);
+
+    while (e != list_rend(queue)) {
+        struct cache_sector *cs =
+            list_entry(e, struct cache_sector, cache_list_elem);
+        struct list_elem *prev = list_prev(e);
+
+        if (cs->pin_count == 0 && cs->journal == CACHE_JOURNAL_NONE) {
+            if (!spare_meta || cs->cls != CACHE_META || cs->spared) {
+                return cs - cache_buffer;
+            }
+            cs->spared = true;
+            list_remove(e);
+            list_push_front(queue, e);
+        }
+        e = prev;
     }
-    struct cache_sector *sector =
-        list_entry(clock_hand, struct cache_sector, cache_list_elem);
+    return -1;
+}
 
-    while (sector->accessed || sector->pin_count > 0) {
-        if (sector->pin_count == 0) {
-            sector->accessed = false;
+/*! Returns true, and forgets it, if SECTOR_IDX was recently evicted from
+    A1. */
+static bool ghost_take(block_sector_t sector_idx) {
+    int i;
+    for (i = 0; i < CACHE_GHOSTS; i++) {
+        if (ghosts[i] == sector_idx) {
+            ghosts[i] = GHOST_NONE;
+            return true;
         }
-        increment_clock_hand();
-        sector = list_entry(clock_hand, struct cache_sector, cache_list_elem);
+    }
+    return false;
+}
+
+/*! Choose a cache sector to be evicted by 2Q.  A1 gives up its oldest
+    sector once it holds more than CACHE_A1_MAX, and otherwise Am gives up
+    its least recently used one.  Delayed blocks are on neither queue,
+    since they have nowhere to be written yet, and sectors held for the
+    journal are passed over.  At most CACHE_DELAYED_MAX slots are delayed,
+    and the journal keeps operations from holding most of the rest, so
+    some sector can still be chosen. */
+static int choose_sector_to_evict(void) {
+    int victim = -1;
+
+    if (list_size(&a1_queue) > CACHE_A1_MAX) {
+        victim = oldest_unpinned(&a1_queue, false);
+    }
+    if (victim == -1) {
+        victim = oldest_unpinned(&am_queue, true);
+    }
+    if (victim == -1) {
+        victim = oldest_unpinned(&a1_queue, false);
+    }
+    ASSERT(victim != -1);
+
+    struct cache_sector *sector = &cache_buffer[victim];
+    if (sector->queue == CACHE_QUEUE_A1) {
+        ghosts[ghost_next] = sector->sector_idx;
+        ghost_next = (ghost_next + 1) % CACHE_GHOSTS;
     }
     sector->evicting = true;
-    increment_clock_hand();
     return sector->sector_idx;
 }
 
@@ -223,17 +392,22 @@ static void cache_evict(void) {
 
 static void write_behind(void *arg_ UNUSED) {
     while (!filesys_done_wait) {
+        /* Give delayed blocks their sectors so they can be written. */
+        inode_flush_all();
         write_all_dirty();
         timer_sleep(TIMER_FREQ);
     }
 }
 
-/*! Write out all dirty blocks to memory. */
+/*! Write out all dirty blocks to memory.  Delayed blocks stay behind until
+    inode_flush_all() gives them sectors, and held ones until the journal
+    logs them. */
 void write_all_dirty(void) {
     acquire_cache_lock();
     int i;
     for (i = 0; i < MAX_BUFFER_SIZE; i++) {
-        if (cache_buffer[i].valid) {
+        if (cache_buffer[i].valid && cache_buffer[i].owner == NULL
+                && cache_buffer[i].journal == CACHE_JOURNAL_NONE) {
             cache_write_to_disk(i);
         }
     }
@@ -273,26 +447,51 @@ static void cache_write_sector_to_disk(int sector_idx) {
     }
 }
 
-/*! Adds a block into buffer cache. Evicts if necessary. Will write from
-    memory to cache. */
-static int cache_insert(block_sector_t sector_idx) {
+/*! Adds a block of class CLS into buffer cache. Evicts if necessary. Will
+    write from memory to cache, or from FILL if it is not null. */
+static int cache_insert(block_sector_t sector_idx, const void *fill,
+                        enum cache_class cls) {
     /* Checks if the cache has already hit maximum capacity */
     if (is_full_cache()) {
         cache_evict();
     }
 
     ASSERT(!is_full_cache());
-    ASSERT(list_size(&cache_list) < MAX_BUFFER_SIZE);
-    int array_idx = cache_init(sector_idx);
+    int array_idx = cache_init(sector_idx, fill, cls);
     add_to_read_ahead(sector_idx + 1);
     return array_idx;
 }
 
+/*! Returns the pinned cache_buffer index holding SECTOR_IDX, bringing the
+    sector in if needed, and counts the lookup against class CLS.  If FILL
+    is not null and the sector was not cached, it is filled from FILL
+    instead of the disk and *FILLED is set.  The cache lock must be
+    held. */
+static int cache_pin_sector(block_sector_t sector_idx, const void *fill,
+                            enum cache_class cls, bool *filled) {
+    int idx = cache_get(sector_idx, false);
+
+    *filled = false;
+    if (idx == -1) {
+        /* Import sector into cache. */
+        idx = cache_insert(sector_idx, fill, cls);
+        *filled = fill != NULL;
+        thread_current()->usage.cache_misses++;
+        class_misses[cls]++;
+    }
+    else {
+        cache_touch(idx, cls);
+        thread_current()->usage.cache_hits++;
+        class_hits[cls]++;
+    }
+    return idx;
+}
+
 /* Retrieve cache_buffer index that corresponds to block sector_idx. */
 static int cache_get(block_sector_t sector_idx, bool evicting) {
     int i;
     for (i = 0; i < MAX_BUFFER_SIZE; i++) {
-        if (cache_buffer[i].valid
+        if (cache_buffer[i].valid && cache_buffer[i].owner == NULL
                 && (!cache_buffer[i].evicting || evicting)
                 && cache_buffer[i].sector_idx == sector_idx) {
             pin(i);
@@ -302,6 +501,19 @@ static int cache_get(block_sector_t sector_idx, bool evicting) {
     return -1;
 }
 
+/* Retrieve cache_buffer index of delayed block BLOCK of OWNER. */
+static int cache_get_delayed(const struct inode *owner, block_sector_t block) {
+    int i;
+    for (i = 0; i < MAX_BUFFER_SIZE; i++) {
+        if (cache_buffer[i].valid && cache_buffer[i].owner == owner
+                && cache_buffer[i].sector_idx == block) {
+            pin(i);
+            return i;
+        }
+    }
+    return -1;
+}
+
 /*! Will retrieve the specific cache from the cache map. */
 static int cache_get_free(void) {
     int i;
@@ -348,40 +560,41 @@ static void read_ahead(block_sector_t sector_idx) {
     }
     int idx = cache_get(sector_idx, true);
     if (idx == -1) {
-        idx = cache_insert(sector_idx);
+        idx = cache_insert(sector_idx, NULL, CACHE_DATA);
     }
     ASSERT(cache_buffer[idx].pin_count > 0);
     unpin(idx);
 }
 
-/*! Write data to a cache_sector buffer. */
-void write_to_cache(block_sector_t sector_idx, const void *data) {
-    write_cache_offset(sector_idx, data, 0, BLOCK_SECTOR_SIZE);
+/*! Write data of class CLS to a cache_sector buffer. */
+void write_to_cache(block_sector_t sector_idx, const void *data,
+    enum cache_class cls) {
+    write_cache_offset(sector_idx, data, 0, BLOCK_SECTOR_SIZE, cls);
 }
 
-/* Write data to cache_sector buffer at an offset. */
+/* Write data of class CLS to cache_sector buffer at an offset. */
 void write_cache_offset(block_sector_t sector_idx, const void *data, off_t ofs,
-    size_t bytes) {
+    size_t bytes, enum cache_class cls) {
     ASSERT(ofs >= 0 && ofs < BLOCK_SECTOR_SIZE);
     ASSERT(bytes > 0 && bytes <= BLOCK_SECTOR_SIZE);
 #ifdef CACHE
+    /* A sector that is overwritten whole need not be read first. */
+    bool filled;
     acquire_cache_lock();
-    int idx = cache_get(sector_idx, false);
-
-    if (idx == -1) {
-        /* Import sector into cache. */
-        idx = cache_insert(sector_idx);
-    }
-    cache_buffer[idx].accessed = true;
+    int idx = cache_pin_sector(sector_idx,
+                               bytes == BLOCK_SECTOR_SIZE ? data : NULL,
+                               cls, &filled);
+    cache_hold(idx, cls);
     release_cache_lock();
 
     /* We want to be sure that the sector we find is not null */
     ASSERT(cache_buffer[idx].valid);
-    begin_write(&cache_buffer[idx].read_write_lock);
-    memcpy(cache_buffer[idx].sector + ofs, data, bytes);
-    end_write(&cache_buffer[idx].read_write_lock);
+    if (!filled) {
+        begin_write(&cache_buffer[idx].read_write_lock);
+        memcpy(cache_buffer[idx].sector + ofs, data, bytes);
+        end_write(&cache_buffer[idx].read_write_lock);
+    }
 
-    cache_buffer[idx].accessed = true;
     cache_buffer[idx].dirty = true;
     ASSERT(cache_buffer[idx].pin_count > 0);
     unpin(idx);
@@ -407,25 +620,21 @@ void write_cache_offset(block_sector_t sector_idx, const void *data, off_t ofs,
 #endif
 }
 
-/*! Read from cache and write to memory. Involves freeing. */
-void read_from_cache(block_sector_t sector_idx, void *data) {
-    read_cache_offset(sector_idx, data, 0, BLOCK_SECTOR_SIZE);
+/*! Read data of class CLS from cache and write to memory. */
+void read_from_cache(block_sector_t sector_idx, void *data,
+    enum cache_class cls) {
+    read_cache_offset(sector_idx, data, 0, BLOCK_SECTOR_SIZE, cls);
 }
 
-/*! Read from cache at an offset and write to memory. Involves freeing. */
+/*! Read data of class CLS from cache at an offset and write to memory. */
 void read_cache_offset(block_sector_t sector_idx, void *data, off_t ofs,
-        size_t bytes) {
+        size_t bytes, enum cache_class cls) {
     ASSERT(ofs >= 0 && ofs < BLOCK_SECTOR_SIZE);
     ASSERT(bytes > 0 && bytes <= BLOCK_SECTOR_SIZE);
 #ifdef CACHE
+    bool filled;
     acquire_cache_lock();
-    int idx = cache_get(sector_idx, false);
-
-    if (idx == -1) {
-        /* Import sector into cache. */
-        idx = cache_insert(sector_idx);
-    }
-    cache_buffer[idx].accessed = true;
+    int idx = cache_pin_sector(sector_idx, NULL, cls, &filled);
     release_cache_lock();
 
     ASSERT(cache_buffer[idx].valid);
@@ -433,7 +642,6 @@ void read_cache_offset(block_sector_t sector_idx, void *data, off_t ofs,
     memcpy(data, cache_buffer[idx].sector + ofs, bytes);
     end_read(&cache_buffer[idx].read_write_lock);
 
-    cache_buffer[idx].accessed = true;
     ASSERT(cache_buffer[idx].pin_count > 0);
     unpin(idx);
 #else
@@ -448,3 +656,422 @@ void read_cache_offset(block_sector_t sector_idx, void *data, off_t ofs,
     free(bounce);
 #endif
 }
+
+/*! Read BYTES bytes of class CLS starting at offset OFS of sector SECTOR_IDX
+    into DATA.  The bytes may run on into the sectors that follow SECTOR_IDX
+    on disk.  Up to CACHE_RANGE_MAX sectors are brought in and pinned per
+    acquisition of the cache lock, or one while the cache is short of
+    slots. */
+void read_cache_range(block_sector_t sector_idx, off_t ofs, void *data,
+        size_t bytes, enum cache_class cls) {
+    uint8_t *dst = data;
+
+    ASSERT(ofs >= 0 && ofs < BLOCK_SECTOR_SIZE);
+#ifdef CACHE
+    while (bytes > 0) {
+        int idx[CACHE_RANGE_MAX];
+        size_t cnt = DIV_ROUND_UP(ofs + bytes, BLOCK_SECTOR_SIZE);
+        size_t i;
+        bool filled;
+
+        if (cnt > CACHE_RANGE_MAX) {
+            cnt = CACHE_RANGE_MAX;
+        }
+        acquire_cache_lock();
+        cnt = cache_range_cnt(cnt);
+        for (i = 0; i < cnt; i++) {
+            idx[i] = cache_pin_sector(sector_idx + i, NULL, cls, &filled);
+        }
+        release_cache_lock();
+
+        for (i = 0; i < cnt; i++) {
+            struct cache_sector *cs = &cache_buffer[idx[i]];
+            size_t chunk = BLOCK_SECTOR_SIZE - ofs;
+            if (chunk > bytes) {
+                chunk = bytes;
+            }
+
+            ASSERT(cs->valid);
+            begin_read(&cs->read_write_lock);
+            memcpy(dst, cs->sector + ofs, chunk);
+            end_read(&cs->read_write_lock);
+            unpin(idx[i]);
+
+            dst += chunk;
+            bytes -= chunk;
+            ofs = 0;
+        }
+        sector_idx += cnt;
+    }
+#else
+    while (bytes > 0) {
+        size_t chunk = BLOCK_SECTOR_SIZE - ofs;
+        if (chunk > bytes) {
+            chunk = bytes;
+        }
+        read_cache_offset(sector_idx++, dst, ofs, chunk, cls);
+        dst += chunk;
+        bytes -= chunk;
+        ofs = 0;
+    }
+#endif
+}
+
+/*! Write BYTES bytes of class CLS from DATA starting at offset OFS of sector
+    SECTOR_IDX, running on into the sectors that follow it on disk.  Up to
+    CACHE_RANGE_MAX sectors are pinned per acquisition of the cache lock,
+    or one while the cache is short of slots, and sectors that are
+    overwritten whole are not read first. */
+void write_cache_range(block_sector_t sector_idx, off_t ofs, const void *data,
+        size_t bytes, enum cache_class cls) {
+    const uint8_t *src = data;
+
+    ASSERT(ofs >= 0 && ofs < BLOCK_SECTOR_SIZE);
+#ifdef CACHE
+    while (bytes > 0) {
+        int idx[CACHE_RANGE_MAX];
+        bool filled[CACHE_RANGE_MAX];
+        size_t cnt = DIV_ROUND_UP(ofs + bytes, BLOCK_SECTOR_SIZE);
+        size_t i;
+
+        if (cnt > CACHE_RANGE_MAX) {
+            cnt = CACHE_RANGE_MAX;
+        }
+        acquire_cache_lock();
+        cnt = cache_range_cnt(cnt);
+        for (i = 0; i < cnt; i++) {
+            /* Only the first sector can start partway in and only the
+               last can end partway, so the rest are overwritten whole. */
+            size_t before = i == 0 ? 0 : BLOCK_SECTOR_SIZE * i - ofs;
+            bool whole = (i > 0 || ofs == 0) &&
+                         bytes - before >= BLOCK_SECTOR_SIZE;
+            idx[i] = cache_pin_sector(sector_idx + i,
+                                      whole ? src + before : NULL,
+                                      cls, &filled[i]);
+            cache_hold(idx[i], cls);
+        }
+        release_cache_lock();
+
+        for (i = 0; i < cnt; i++) {
+            struct cache_sector *cs = &cache_buffer[idx[i]];
+            size_t chunk = BLOCK_SECTOR_SIZE - ofs;
+            if (chunk > bytes) {
+                chunk = bytes;
+            }
+
+            ASSERT(cs->valid);
+            if (!filled[i]) {
+                begin_write(&cs->read_write_lock);
+                memcpy(cs->sector + ofs, src, chunk);
+                end_write(&cs->read_write_lock);
+            }
+            cs->dirty = true;
+            unpin(idx[i]);
+
+            src += chunk;
+            bytes -= chunk;
+            ofs = 0;
+        }
+        sector_idx += cnt;
+    }
+#else
+    while (bytes > 0) {
+        size_t chunk = BLOCK_SECTOR_SIZE - ofs;
+        if (chunk > bytes) {
+            chunk = bytes;
+        }
+        write_cache_offset(sector_idx++, src, ofs, chunk, cls);
+        src += chunk;
+        bytes -= chunk;
+        ofs = 0;
+    }
+#endif
+}
+
+/*! Copy BYTES bytes at offset SRC_OFS of sector SRC_IDX to offset DST_OFS
+    of sector DST_IDX without a bounce through the caller.  A destination
+    sector that is overwritten whole and not yet cached is filled straight
+    from the source instead of being read from disk. */
+void copy_cache_offset(block_sector_t dst_idx, off_t dst_ofs,
+    block_sector_t src_idx, off_t src_ofs, size_t bytes) {
+    ASSERT(dst_ofs >= 0 && dst_ofs + bytes <= BLOCK_SECTOR_SIZE);
+    ASSERT(src_ofs >= 0 && src_ofs + bytes <= BLOCK_SECTOR_SIZE);
+    ASSERT(bytes > 0);
+#ifdef CACHE
+    if (dst_idx != src_idx) {
+        struct cache_sector *src, *dst;
+        bool full = bytes == BLOCK_SECTOR_SIZE;
+        bool filled;
+
+        /* The cache lock is taken before any sector's lock, so the source
+           may be read-locked while the destination is brought in. */
+        acquire_cache_lock();
+        src = &cache_buffer[cache_pin_sector(src_idx, NULL, CACHE_DATA,
+                                             &filled)];
+        if (full) {
+            begin_read(&src->read_write_lock);
+        }
+        dst = &cache_buffer[cache_pin_sector(dst_idx,
+                full ? src->sector : NULL, CACHE_DATA, &filled)];
+        if (full) {
+            end_read(&src->read_write_lock);
+        }
+        release_cache_lock();
+
+        if (!filled) {
+            /* Take the two sector locks in a fixed order. */
+            if (src < dst) {
+                begin_read(&src->read_write_lock);
+                begin_write(&dst->read_write_lock);
+            }
+            else {
+                begin_write(&dst->read_write_lock);
+                begin_read(&src->read_write_lock);
+            }
+            memcpy(dst->sector + dst_ofs, src->sector + src_ofs, bytes);
+            dst->dirty = true;
+            end_read(&src->read_write_lock);
+            end_write(&dst->read_write_lock);
+        }
+
+        unpin(dst - cache_buffer);
+        unpin(src - cache_buffer);
+        return;
+    }
+#endif
+    uint8_t *bounce = malloc(bytes);
+    if (bounce == NULL) {
+        return;
+    }
+    read_cache_offset(src_idx, bounce, src_ofs, bytes, CACHE_DATA);
+    write_cache_offset(dst_idx, bounce, dst_ofs, bytes, CACHE_DATA);
+    free(bounce);
+}
+
+/*! Write BYTES bytes from DATA at offset OFS of delayed block BLOCK of
+    OWNER, a block of file data that has no sector yet.  If the block is not
+    cached and CREATE is true, a slot is made for it that starts out as
+    zeros.  Returns false if the block is not cached and either CREATE is
+    false or CACHE_DELAYED_MAX slots already hold delayed blocks. */
+bool write_cache_delayed(const struct inode *owner, block_sector_t block,
+    off_t ofs, const void *data, size_t bytes, bool create) {
+    ASSERT(ofs >= 0 && ofs + bytes <= BLOCK_SECTOR_SIZE);
+#ifdef CACHE
+    acquire_cache_lock();
+    int idx = cache_get_delayed(owner, block);
+    if (idx == -1) {
+        if (!create || delayed_slots == CACHE_DELAYED_MAX) {
+            release_cache_lock();
+            return false;
+        }
+        if (is_full_cache()) {
+            cache_evict();
+        }
+        idx = cache_get_free();
+        ASSERT(idx != -1);
+        cache_buffer[idx].sector_idx = block;
+        cache_buffer[idx].owner = owner;
+        cache_buffer[idx].valid = true;
+        cache_buffer[idx].evicting = false;
+        cache_buffer[idx].cls = CACHE_DATA;
+        cache_buffer[idx].spared = false;
+        memset(cache_buffer[idx].sector, 0, BLOCK_SECTOR_SIZE);
+        delayed_slots++;
+    }
+    release_cache_lock();
+
+    begin_write(&cache_buffer[idx].read_write_lock);
+    memcpy(cache_buffer[idx].sector + ofs, data, bytes);
+    end_write(&cache_buffer[idx].read_write_lock);
+
+    cache_buffer[idx].dirty = true;
+    unpin(idx);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*! Read BYTES bytes at offset OFS of delayed block BLOCK of OWNER into
+    DATA.  Returns false if the block is not cached. */
+bool read_cache_delayed(const struct inode *owner, block_sector_t block,
+    off_t ofs, void *data, size_t bytes) {
+    ASSERT(ofs >= 0 && ofs + bytes <= BLOCK_SECTOR_SIZE);
+#ifdef CACHE
+    acquire_cache_lock();
+    int idx = cache_get_delayed(owner, block);
+    release_cache_lock();
+    if (idx == -1) {
+        return false;
+    }
+
+    begin_read(&cache_buffer[idx].read_write_lock);
+    memcpy(data, cache_buffer[idx].sector + ofs, bytes);
+    end_read(&cache_buffer[idx].read_write_lock);
+
+    unpin(idx);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*! Store in BLOCKS the numbers of the delayed blocks of OWNER, in
+    ascending order, and return how many there are. */
+size_t cache_delayed_blocks(const struct inode *owner,
+    block_sector_t blocks[CACHE_DELAYED_MAX]) {
+    size_t cnt = 0;
+#ifdef CACHE
+    int i;
+
+    acquire_cache_lock();
+    for (i = 0; i < MAX_BUFFER_SIZE; i++) {
+        if (cache_buffer[i].valid && cache_buffer[i].owner == owner) {
+            /* Insertion sort; there are few of them. */
+            block_sector_t block = cache_buffer[i].sector_idx;
+            size_t j = cnt++;
+            ASSERT(cnt <= CACHE_DELAYED_MAX);
+            while (j > 0 && blocks[j - 1] > block) {
+                blocks[j] = blocks[j - 1];
+                j--;
+            }
+            blocks[j] = block;
+        }
+    }
+    release_cache_lock();
+#endif
+    return cnt;
+}
+
+/*! Turn delayed block BLOCK of OWNER into a dirty cached copy of sector
+    SECTOR_IDX, which was just allocated for it, so that it is written there
+    like any other sector. */
+void cache_delayed_assign(const struct inode *owner, block_sector_t block,
+    block_sector_t sector_idx) {
+#ifdef CACHE
+    acquire_cache_lock();
+    int idx = cache_get_delayed(owner, block);
+    ASSERT(idx != -1);
+    int old = cache_get(sector_idx, true);
+    if (old == -1) {
+        cache_buffer[idx].sector_idx = sector_idx;
+        cache_buffer[idx].owner = NULL;
+        cache_link(idx, CACHE_QUEUE_A1);
+        unpin(idx);
+    }
+    else {
+        /* The sector's contents from before it was last freed are still
+           cached.  Overwrite them and let the delayed block go. */
+        begin_write(&cache_buffer[old].read_write_lock);
+        memcpy(cache_buffer[old].sector, cache_buffer[idx].sector,
+               BLOCK_SECTOR_SIZE);
+        end_write(&cache_buffer[old].read_write_lock);
+        cache_buffer[old].dirty = true;
+        unpin(old);
+        cache_drop(idx);
+    }
+    delayed_slots--;
+    release_cache_lock();
+#else
+    (void) owner;
+    (void) block;
+    (void) sector_idx;
+    NOT_REACHED();
+#endif
+}
+
+/*! Throw away every delayed block of OWNER, whose file has been deleted,
+    and return how many there were. */
+size_t cache_delayed_discard(const struct inode *owner) {
+    size_t cnt = 0;
+#ifdef CACHE
+    int i;
+
+    acquire_cache_lock();
+    for (i = 0; i < MAX_BUFFER_SIZE; i++) {
+        if (cache_buffer[i].valid && cache_buffer[i].owner == owner) {
+            ASSERT(cache_buffer[i].pin_count == 0);
+            cache_drop(i);
+            cnt++;
+        }
+    }
+    delayed_slots -= cnt;
+    release_cache_lock();
+#endif
+    return cnt;
+}
+
+/*! Copies every sector held for the journal into SECTORS and DATA and
+    marks it as being logged, so that it stays held until
+    cache_journal_release() while a new write may hold it again.  Returns
+    the number of sectors copied. */
+size_t cache_journal_collect(block_sector_t sectors[MAX_BUFFER_SIZE],
+        uint8_t data[MAX_BUFFER_SIZE][BLOCK_SECTOR_SIZE]) {
+    size_t cnt = 0;
+#ifdef CACHE
+    int i;
+
+    acquire_cache_lock();
+    for (i = 0; i < MAX_BUFFER_SIZE; i++) {
+        struct cache_sector *cs = &cache_buffer[i];
+        if (cs->valid && cs->journal == CACHE_JOURNAL_HELD) {
+            begin_read(&cs->read_write_lock);
+            memcpy(data[cnt], cs->sector, BLOCK_SECTOR_SIZE);
+            end_read(&cs->read_write_lock);
+            sectors[cnt++] = cs->sector_idx;
+            cs->journal = CACHE_JOURNAL_LOGGING;
+        }
+    }
+    release_cache_lock();
+#endif
+    return cnt;
+}
+
+/*! Lets the sectors copied by cache_journal_collect(), now logged, be
+    written back, except those held again since. */
+void cache_journal_release(void) {
+#ifdef CACHE
+    int i;
+
+    acquire_cache_lock();
+    for (i = 0; i < MAX_BUFFER_SIZE; i++) {
+        if (cache_buffer[i].journal == CACHE_JOURNAL_LOGGING) {
+            cache_buffer[i].journal = CACHE_JOURNAL_NONE;
+            held_slots--;
+        }
+    }
+    release_cache_lock();
+#endif
+}
+
+/*! Returns true if SECTOR_IDX is cached and held for the journal. */
+bool cache_journal_held(block_sector_t sector_idx) {
+    bool held = false;
+#ifdef CACHE
+    int i;
+
+    acquire_cache_lock();
+    for (i = 0; i < MAX_BUFFER_SIZE; i++) {
+        if (cache_buffer[i].valid && cache_buffer[i].owner == NULL
+                && cache_buffer[i].sector_idx == sector_idx) {
+            held = cache_buffer[i].journal != CACHE_JOURNAL_NONE;
+            break;
+        }
+    }
+    release_cache_lock();
+#endif
+    return held;
+}
+
+/*! Returns the number of sectors held for the journal. */
+size_t cache_journal_held_cnt(void) {
+    return held_slots;
+}
+
+/*! Print the cache's hits and misses by class. */
+void cache_print_stats(void) {
+    printf("Cache: %llu data hits, %llu data misses, "
+           "%llu metadata hits, %llu metadata misses\n",
+           class_hits[CACHE_DATA], class_misses[CACHE_DATA],
+           class_hits[CACHE_META], class_misses[CACHE_META]);
+}
@@ -14,20 +14,58 @@
 /* One of the cache slots is used by keeping the inode_disk data in inode. */
 #define MAX_BUFFER_SIZE 63
 
+/* Most cache slots that may hold delayed blocks at once. */
+#define CACHE_DELAYED_MAX 32
+
+struct inode;
+
+/* Priority classes of cached sectors. */
+enum cache_class {
+    CACHE_DATA,                         /*!< File data. */
+    CACHE_META,                         /*!< Inodes, indirect blocks,
+                                             directories and the free map. */
+    CACHE_CLASS_CNT
+};
+
+/* Queues of the 2Q replacement policy. */
+enum cache_queue {
+    CACHE_QUEUE_NONE,                   /*!< On no queue: free or delayed. */
+    CACHE_QUEUE_A1,                     /*!< Touched once; first in, first
+                                             out. */
+    CACHE_QUEUE_AM                      /*!< Touched again, or metadata;
+                                             least recently used first. */
+};
+
+/* Where a cached sector stands with the metadata journal. */
+enum cache_journal {
+    CACHE_JOURNAL_NONE,                 /*!< May be written back. */
+    CACHE_JOURNAL_HELD,                 /*!< Changed by metadata writes that
+                                             are not yet logged. */
+    CACHE_JOURNAL_LOGGING               /*!< Being copied into the log. */
+};
+
 /* Flag which indicates that filesys_done has been called. */
 bool filesys_done_wait;
 struct semaphore read_ahead_sema;
 
 
 /* We would like our cache sector to be in a list for
-   easier eviction. We will use sector index as the key. */
+   easier eviction. We will use sector index as the key, or for a delayed
+   block, which has no sector yet, its owner and block number. */
 struct cache_sector {
-    block_sector_t sector_idx;          /*!< Sector index on filesys block. */
+    block_sector_t sector_idx;          /*!< Sector index on filesys block,
+                                             or block number in OWNER. */
+    const struct inode *owner;          /*!< File of a delayed block, or
+                                             null for a sector. */
     bool valid;                         /*!< True if sector is used. False when evicted. */
     bool evicting;                      /*!< True if sector is being evicted. */
-    bool accessed;                      /*!< Sector access level. */
+    enum cache_queue queue;             /*!< Queue the slot is on. */
+    enum cache_class cls;               /*!< Class it was last used as. */
+    bool spared;                        /*!< Metadata passed over once by
+                                             eviction since last used. */
     bool dirty;                         /*!< Boolean if sector is dirty. */
-    struct list_elem cache_list_elem;   /*!< Makes it part of an eviction list. */
+    enum cache_journal journal;         /*!< Held back for the journal. */
+    struct list_elem cache_list_elem;   /*!< Element in its queue. */
     uint8_t sector[BLOCK_SECTOR_SIZE];  /*!< Each sector is 512 bytes. */
     struct rw_lock read_write_lock;     /*!< For synchronizing readers/writers. */
     struct lock block_lock;             /*!< Lock for using block. */
@@ -41,14 +79,41 @@ struct read_ahead_sector {
 
 /* Cache initialization. */
 void cache_table_init(void);
+void cache_print_stats(void);
 
 /* Writing/Reading to/from disk methods. */
 void write_all_dirty(void);
-void write_to_cache(block_sector_t sector_idx, const void *data);
+void write_to_cache(block_sector_t sector_idx, const void *data,
+    enum cache_class cls);
 void write_cache_offset(block_sector_t sector_idx, const void *data, off_t ofs,
-    size_t bytes);
-void read_from_cache(block_sector_t sector_idx, void *data);
+    size_t bytes, enum cache_class cls);
+void read_from_cache(block_sector_t sector_idx, void *data,
+    enum cache_class cls);
 void read_cache_offset(block_sector_t sector_idx, void *data, off_t ofs,
-    size_t bytes);
+    size_t bytes, enum cache_class cls);
+void read_cache_range(block_sector_t sector_idx, off_t ofs, void *data,
+    size_t bytes, enum cache_class cls);
+void write_cache_range(block_sector_t sector_idx, off_t ofs, const void *data,
+    size_t bytes, enum cache_class cls);
+void copy_cache_offset(block_sector_t dst_idx, off_t dst_ofs,
+    block_sector_t src_idx, off_t src_ofs, size_t bytes);
+
+/* Delayed blocks, which are written before they are given a sector. */
+bool write_cache_delayed(const struct inode *owner, block_sector_t block,
+    off_t ofs, const void *data, size_t bytes, bool create);
+bool read_cache_delayed(const struct inode *owner, block_sector_t block,
+    off_t ofs, void *data, size_t bytes);
+size_t cache_delayed_blocks(const struct inode *owner,
+    block_sector_t blocks[CACHE_DELAYED_MAX]);
+void cache_delayed_assign(const struct inode *owner, block_sector_t block,
+    block_sector_t sector_idx);
+size_t cache_delayed_discard(const struct inode *owner);
+
+/* Sectors held back until the journal logs them. */
+size_t cache_journal_collect(block_sector_t sectors[MAX_BUFFER_SIZE],
+    uint8_t data[MAX_BUFFER_SIZE][BLOCK_SECTOR_SIZE]);
+void cache_journal_release(void);
+bool cache_journal_held(block_sector_t sector_idx);
+size_t cache_journal_held_cnt(void);
 
 #endif /* BUFFER_CACHE_H_ */
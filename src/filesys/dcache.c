@@ -0,0 +1,160 @@
+/*! \file dcache.c
+ *
+ * Directory entry cache.  Maps a directory's inode sector and a name in it
+ * to the inode sector the name refers to, or to DCACHE_NEGATIVE if the
+ * name is known to be absent, so that resolving a path does not search
+ * each directory along it.  The cache holds at most DCACHE_SIZE entries
+ * and evicts the least recently used.
+ *
+ * directory.c keeps the cache coherent.  It inserts and looks up entries
+ * for a directory only while holding that directory's lock, records every
+ * dir_add() and dir_remove(), and purges a sector's entries when a new
+ * directory is created there.
+ */
+
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/*! Most entries cached at once. */
+#define DCACHE_SIZE 128
+
+/*! A cached directory entry. */
+struct dentry {
+    struct hash_elem hash_elem;         /*!< Element in dcache. */
+    struct list_elem lru_elem;          /*!< Element in dcache_lru. */
+    block_sector_t parent;              /*!< Directory's inode sector. */
+    block_sector_t child;               /*!< Named inode, or DCACHE_NEGATIVE. */
+    char name[NAME_MAX + 1];            /*!< Null terminated file name. */
+};
+
+static struct hash dcache;
+static struct list dcache_lru;          /*!< Most recently used first. */
+static struct lock dcache_lock;
+
+static unsigned dentry_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool dentry_less(const struct hash_elem *a, const struct hash_elem *b,
+                        void *aux UNUSED);
+static struct dentry *dentry_find(block_sector_t parent, const char *name);
+static void dentry_drop(struct dentry *d);
+
+/*! Initializes the directory entry cache. */
+void dcache_init(void) {
+    hash_init(&dcache, dentry_hash, dentry_less, NULL);
+    list_init(&dcache_lru);
+    lock_init(&dcache_lock);
+}
+
+/*! Looks up NAME in the directory at sector PARENT.  If the answer is
+    cached, stores the named inode's sector, or DCACHE_NEGATIVE, in *CHILD
+    and returns true. */
+bool dcache_lookup(block_sector_t parent, const char *name,
+                   block_sector_t *child) {
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    d = dentry_find(parent, name);
+    if (d != NULL) {
+        *child = d->child;
+        list_remove(&d->lru_elem);
+        list_push_front(&dcache_lru, &d->lru_elem);
+    }
+    lock_release(&dcache_lock);
+
+    return d != NULL;
+}
+
+/*! Records that NAME in the directory at sector PARENT refers to the inode
+    at sector CHILD, or to nothing if CHILD is DCACHE_NEGATIVE.  Names too
+    long to be valid are not cached. */
+void dcache_insert(block_sector_t parent, const char *name,
+                   block_sector_t child) {
+    struct dentry *d;
+
+    if (strlen(name) > NAME_MAX)
+        return;
+
+    lock_acquire(&dcache_lock);
+    d = dentry_find(parent, name);
+    if (d != NULL) {
+        list_remove(&d->lru_elem);
+    }
+    else {
+        if (hash_size(&dcache) >= DCACHE_SIZE) {
+            dentry_drop(list_entry(list_back(&dcache_lru),
+                                   struct dentry, lru_elem));
+        }
+        d = malloc(sizeof *d);
+        if (d == NULL) {
+            lock_release(&dcache_lock);
+            return;
+        }
+        d->parent = parent;
+        strlcpy(d->name, name, sizeof d->name);
+        hash_insert(&dcache, &d->hash_elem);
+    }
+    d->child = child;
+    list_push_front(&dcache_lru, &d->lru_elem);
+    lock_release(&dcache_lock);
+}
+
+/*! Drops every entry for names in the directory at sector PARENT. */
+void dcache_purge(block_sector_t parent) {
+    struct list_elem *e;
+
+    lock_acquire(&dcache_lock);
+    e = list_begin(&dcache_lru);
+    while (e != list_end(&dcache_lru)) {
+        struct dentry *d = list_entry(e, struct dentry, lru_elem);
+        e = list_next(e);
+        if (d->parent == parent)
+            dentry_drop(d);
+    }
+    lock_release(&dcache_lock);
+}
+
+/*! Hashes a dentry by directory and name. */
+static unsigned dentry_hash(const struct hash_elem *e, void *aux UNUSED) {
+    const struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+    return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+/*! Orders dentries by directory, then by name. */
+static bool dentry_less(const struct hash_elem *a, const struct hash_elem *b,
+                        void *aux UNUSED) {
+    const struct dentry *da = hash_entry(a, struct dentry, hash_elem);
+    const struct dentry *db = hash_entry(b, struct dentry, hash_elem);
+
+    if (da->parent != db->parent)
+        return da->parent < db->parent;
+    return strcmp(da->name, db->name) < 0;
+}
+
+/*! Returns the entry for NAME in the directory at sector PARENT, or a null
+    pointer if there is none.  The cache's lock must be held. */
+static struct dentry *dentry_find(block_sector_t parent, const char *name) {
+    struct dentry key;
+    struct hash_elem *e;
+
+    ASSERT(lock_held_by_current_thread(&dcache_lock));
+
+    if (strlen(name) > NAME_MAX)
+        return NULL;
+    key.parent = parent;
+    strlcpy(key.name, name, sizeof key.name);
+    e = hash_find(&dcache, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct dentry, hash_elem) : NULL;
+}
+
+/*! Removes D from the cache and frees it.  The cache's lock must be
+    held. */
+static void dentry_drop(struct dentry *d) {
+    hash_delete(&dcache, &d->hash_elem);
+    list_remove(&d->lru_elem);
+    free(d);
+}
@@ -0,0 +1,22 @@
+/*! \file dcache.h
+ *
+ * Declarations for the cache of directory entries.
+ */
+
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/*! Stands in for the child sector of a name known not to exist. */
+#define DCACHE_NEGATIVE ((block_sector_t) -1)
+
+void dcache_init(void);
+bool dcache_lookup(block_sector_t parent, const char *name,
+                   block_sector_t *child);
+void dcache_insert(block_sector_t parent, const char *name,
+                   block_sector_t child);
+void dcache_purge(block_sector_t parent);
+
+#endif /* filesys/dcache.h */
@@ -1,7 +1,24 @@
+/*! \file directory.c
+ *
+ * A directory is an array of struct dir_entry slots.  Small directories
+ * are searched from one end to the other.  Once a directory outgrows
+ * DIR_LINEAR_SLOTS slots it is rebuilt as a hash table.  Slot 0 becomes a
+ * header that is never in use, and the remaining slots form buckets of
+ * DIR_BUCKET_SLOTS each.  A name is only ever stored in the bucket its
+ * hash selects, so finding, adding or removing it reads that one bucket,
+ * at most two sectors.  A full bucket makes the table double in size.
+ *
+ * Code that only walks the slots looking for entries in use, such as
+ * dir_readdir(), reads both layouts alike, and directories written in
+ * the linear layout stay valid as they are.
+ */
+
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -13,8 +30,9 @@ struct dir {
     struct inode *inode;                /*!< Backing store. */
     off_t pos;                          /*!< Current position. */
     struct lock dir_lock;               /*!< Lock for I/O operations. */
-    struct list_elem elem;              /*!< Element in inode list. */
+    struct hash_elem elem;              /*!< Element in open_dirs. */
     int open_cnt;                       /*!< Number of times dir has been opened. */
+    size_t bucket_cnt;                  /*!< Hash buckets, 0 if linear. */
 };
 
 /*! A single directory entry. */
@@ -24,6 +42,23 @@ struct dir_entry {
     bool in_use;                        /*!< In use or free? */
 };
 
+/*! Marks slot 0 of a hashed directory, in place of an inode sector.  The
+    slot is not in use and has an empty name, which no real entry has. */
+#define DIR_HASH_MAGIC 0x48534844
+
+/*! Slots a directory may have before it is rebuilt as a hash table. */
+#define DIR_LINEAR_SLOTS 32
+
+/*! Slots per hash bucket.  A bucket fits in 500 bytes. */
+#define DIR_BUCKET_SLOTS 25
+
+/*! Fewest and most buckets in a hashed directory. */
+#define DIR_BUCKETS_MIN 4
+#define DIR_BUCKETS_MAX 1024
+
+static size_t dir_read_bucket_cnt(struct inode *inode);
+static bool dir_rebuild(struct dir *dir);
+
 static void acquire_dir_lock(struct dir *dir) {
     lock_acquire(&dir->dir_lock);
 }
@@ -32,52 +67,83 @@ static void release_dir_lock(struct dir *dir) {
     lock_release(&dir->dir_lock);
 }
 
-/*! List of open directories, so that opening a single directory twice
-    returns the same `struct dir'. */
-static struct list open_dirs;
+/*! Open directories, hashed by inode sector, so that opening a single
+    directory twice returns the same `struct dir'. */
+static struct hash open_dirs;
+static struct lock open_dirs_lock;
+
+/*! Hashes a directory by its inode's sector. */
+static unsigned dir_hash(const struct hash_elem *e, void *aux UNUSED) {
+    return hash_int(inode_get_inumber(hash_entry(e, struct dir, elem)->inode));
+}
+
+/*! Orders directories by their inodes' sectors. */
+static bool dir_less(const struct hash_elem *a, const struct hash_elem *b,
+                     void *aux UNUSED) {
+    return (inode_get_inumber(hash_entry(a, struct dir, elem)->inode) <
+            inode_get_inumber(hash_entry(b, struct dir, elem)->inode));
+}
+
+/*! Returns the open directory for INODE, or a null pointer if there is
+    none.  The open directory lock must be held. */
+static struct dir *find_open_dir(struct inode *inode) {
+    struct dir key;
+    struct hash_elem *e;
+
+    key.inode = inode;
+    e = hash_find(&open_dirs, &key.elem);
+    return e != NULL ? hash_entry(e, struct dir, elem) : NULL;
+}
 
 /*! Initializes the inode module. */
 void directory_init(void) {
-    list_init(&open_dirs);
+    hash_init(&open_dirs, dir_hash, dir_less, NULL);
+    lock_init(&open_dirs_lock);
+    dcache_init();
 }
 
 /*! Creates a directory with space for ENTRY_CNT entries in the
     given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt) {
+    /* Forget names cached for whatever directory used SECTOR before. */
+    dcache_purge(sector);
     return inode_create(sector, entry_cnt * sizeof(struct dir_entry));
 }
 
 /*! Opens and returns the directory for the given INODE, of which
     it takes ownership.  Returns a null pointer on failure. */
 struct dir * dir_open(struct inode *inode) {
-    struct list_elem *e;
     struct dir *dir;
 
+    if (inode == NULL)
+        return NULL;
+
     /* Check if inode is already open as dir */
-    for (e = list_begin(&open_dirs); e != list_end(&open_dirs);
-         e = list_next(e)) {
-        dir = list_entry(e, struct dir, elem);
-        if (dir_get_inode(dir) == inode) {
-            dir->open_cnt++;
-            inc_in_use(inode);
-            return dir;
-        }
+    lock_acquire(&open_dirs_lock);
+    dir = find_open_dir(inode);
+    if (dir != NULL) {
+        dir->open_cnt++;
+        inc_in_use(inode);
+        lock_release(&open_dirs_lock);
+        return dir;
     }
 
     /* Couldn't find open dir. */
     dir = calloc(1, sizeof(*dir));
-    if (inode != NULL && dir != NULL) {
-        list_push_front(&open_dirs, &dir->elem);
+    if (dir != NULL) {
         dir->inode = inode;
         dir->pos = 0;
         lock_init(&dir->dir_lock);
         dir->open_cnt++;
+        dir->bucket_cnt = dir_read_bucket_cnt(inode);
         inc_in_use(dir->inode);
+        hash_insert(&open_dirs, &dir->elem);
+        lock_release(&open_dirs_lock);
         return dir;
     }
     else {
+        lock_release(&open_dirs_lock);
         inode_close(inode);
-        free(dir);
         return NULL;
     }
 }
@@ -97,15 +163,19 @@ struct dir * dir_reopen(struct dir *dir) {
 /*! Destroys DIR and frees associated resources. */
 void dir_close(struct dir *dir) {
     if (dir != NULL) {
+        lock_acquire(&open_dirs_lock);
         dec_in_use(dir->inode);
         dir->open_cnt--;
-        if(dir->open_cnt == 0) {
+        bool last = dir->open_cnt == 0;
+        if (last)
+            hash_delete(&open_dirs, &dir->elem);
+        lock_release(&open_dirs_lock);
+
+        if (last) {
             /* Release resources if this was the last opener. */
-            list_remove(&dir->elem);
             inode_close(dir->inode);
             free(dir);
         }
-
     }
 }
 
@@ -114,30 +184,85 @@ struct inode * dir_get_inode(struct dir *dir) {
     return dir->inode;
 }
 
+/*! Returns the number of hash buckets in the directory in INODE, or 0 if
+    it is laid out linearly. */
+static size_t dir_read_bucket_cnt(struct inode *inode) {
+    struct dir_entry e;
+
+    if (inode_read_at(inode, &e, sizeof(e), 0) != sizeof(e) || e.in_use ||
+        e.name[0] != '\0' || e.inode_sector != DIR_HASH_MAGIC)
+        return 0;
+    return (inode_length(inode) / sizeof(e) - 1) / DIR_BUCKET_SLOTS;
+}
+
+/*! Returns the byte offset of bucket BUCKET in a hashed directory. */
+static off_t dir_bucket_ofs(size_t bucket) {
+    return (1 + bucket * DIR_BUCKET_SLOTS) * sizeof(struct dir_entry);
+}
+
 /*! Searches DIR for a file with the given NAME.
     If successful, returns true, sets *EP to the directory entry
     if EP is non-null, and sets *OFSP to the byte offset of the
     directory entry if OFSP is non-null.
-    otherwise, returns false and ignores EP and OFSP. */
+    otherwise, returns false and ignores EP and OFSP.
+    Either way, if FREEP is non-null, sets *FREEP to the offset of the
+    first free slot where NAME could be added, or to -1 if there is
+    none.  Only NAME's bucket is searched in a hashed directory. */
 static bool lookup(const struct dir *dir, const char *name,
-                   struct dir_entry *ep, off_t *ofsp) {
-    struct dir_entry e;
-    size_t ofs;
+                   struct dir_entry *ep, off_t *ofsp, off_t *freep) {
+    struct dir_entry *slots, slot;
+    size_t slot_cnt = DIR_BUCKET_SLOTS;
+    off_t ofs, end;
+    bool found = false;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof(e), ofs) == sizeof(e);
-         ofs += sizeof(e)) {
-        if (e.in_use && !strcmp(name, e.name)) {
-            if (ep != NULL)
-                *ep = e;
-            if (ofsp != NULL)
-                *ofsp = ofs;
-            return true;
+    if (dir->bucket_cnt > 0) {
+        ofs = dir_bucket_ofs(hash_string(name) % dir->bucket_cnt);
+        end = ofs + DIR_BUCKET_SLOTS * sizeof(struct dir_entry);
+    }
+    else {
+        ofs = 0;
+        end = inode_length(dir->inode);
+    }
+    if (freep != NULL)
+        *freep = -1;
+
+    /* Read a bucket's worth of slots at a time, or one if memory is
+       short. */
+    slots = malloc(slot_cnt * sizeof *slots);
+    if (slots == NULL) {
+        slots = &slot;
+        slot_cnt = 1;
+    }
+    while (!found && ofs < end) {
+        off_t size = end - ofs;
+        size_t i, cnt;
+
+        if (size > (off_t) (slot_cnt * sizeof *slots))
+            size = slot_cnt * sizeof *slots;
+        cnt = inode_read_at(dir->inode, slots, size, ofs) / sizeof *slots;
+        if (cnt == 0)
+            break;
+
+        for (i = 0; i < cnt; i++, ofs += sizeof *slots) {
+            struct dir_entry *e = &slots[i];
+            if (e->in_use && !strcmp(name, e->name)) {
+                if (ep != NULL)
+                    *ep = *e;
+                if (ofsp != NULL)
+                    *ofsp = ofs;
+                found = true;
+                break;
+            }
+            if (!e->in_use && freep != NULL && *freep == -1)
+                *freep = ofs;
         }
     }
-    return false;
+    if (slots != &slot)
+        free(slots);
+    return found;
 }
 
 /*! Searches DIR for a file with the given NAME and returns true if one exists,
@@ -145,15 +270,25 @@ static bool lookup(const struct dir *dir, const char *name,
     otherwise to a null pointer.  The caller must close *INODE. */
 bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode) {
 
+    block_sector_t sector, child;
     struct dir_entry e;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
-    if (lookup(dir, name, &e, NULL))
-        *inode = inode_open(e.inode_sector);
-    else
-        *inode = NULL;
+    sector = inode_get_inumber(dir->inode);
+
+    /* The directory may be rebuilt by a concurrent dir_add(), and the
+       cache must not learn an answer that dir_add() has made stale. */
+    acquire_dir_lock((struct dir *) dir);
+    if (!dcache_lookup(sector, name, &child)) {
+        child = lookup(dir, name, &e, NULL, NULL) ? e.inode_sector
+                                                  : DCACHE_NEGATIVE;
+        if (!inode_is_removed(dir->inode))
+            dcache_insert(sector, name, child);
+    }
+    *inode = child != DCACHE_NEGATIVE ? inode_open(child) : NULL;
+    release_dir_lock((struct dir *) dir);
 
     return *inode != NULL;
 }
@@ -176,21 +311,23 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector) {
         return false;
 
     acquire_dir_lock(dir);
-    /* Check that NAME is not in use. */
-    if (lookup(dir, name, NULL, NULL))
-        goto done;
-
-    /* Set OFS to offset of free slot.
-       If there are no free slots, then it will be set to the
-       current end-of-file.
+    for (;;) {
+        /* Check that NAME is not in use, and find a free slot for it. */
+        if (lookup(dir, name, NULL, NULL, &ofs))
+            goto done;
+        if (ofs != -1)
+            break;
 
-       inode_read_at() will only return a short read at end of file.
-       Otherwise, we'd need to verify that we didn't get a short
-       read due to something intermittent such as low memory. */
-    for (ofs = 0; inode_read_at(dir->inode, &e, sizeof(e), ofs) == sizeof(e);
-         ofs += sizeof(e)) {
-        if (!e.in_use)
+        /* With no free slot, a small linear directory is extended at the
+           end.  Anything else is rebuilt as a larger hash table. */
+        off_t length = inode_length(dir->inode);
+        if (dir->bucket_cnt == 0 &&
+            length / (off_t) sizeof(e) < DIR_LINEAR_SLOTS) {
+            ofs = length;
             break;
+        }
+        if (!dir_rebuild(dir))
+            goto done;
     }
 
     /* Write slot. */
@@ -198,12 +335,91 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector) {
     strlcpy(e.name, name, sizeof e.name);
     e.inode_sector = inode_sector;
     success = inode_write_at(dir->inode, &e, sizeof(e), ofs) == sizeof(e);
+    if (success)
+        dcache_insert(inode_get_inumber(dir->inode), name, inode_sector);
 
 done:
     release_dir_lock(dir);
     return success;
 }
 
+/*! Rewrites DIR as a hash table with room to spare: twice as many buckets
+    as it has now, or enough for twice its entries if it is linear.  The
+    table keeps doubling until every entry fits in its bucket.  Returns
+    false if the directory cannot grow further or memory runs out.  The
+    directory's lock must be held. */
+static bool dir_rebuild(struct dir *dir) {
+    off_t old_length = inode_length(dir->inode);
+    size_t old_cnt = old_length / sizeof(struct dir_entry);
+    size_t bucket_cnt, slot_cnt, used = 0, i;
+    struct dir_entry *old, *new = NULL;
+    bool success = false;
+
+    ASSERT(lock_held_by_current_thread(&dir->dir_lock));
+
+    old = malloc(old_length);
+    if (old == NULL || inode_read_at(dir->inode, old, old_length, 0)
+                       != old_length)
+        goto done;
+    for (i = 0; i < old_cnt; i++) {
+        if (old[i].in_use)
+            used++;
+    }
+
+    /* The new table covers every old slot, so the directory never
+       shrinks. */
+    if (dir->bucket_cnt > 0) {
+        bucket_cnt = dir->bucket_cnt * 2;
+    }
+    else {
+        bucket_cnt = DIR_BUCKETS_MIN;
+        while (bucket_cnt * DIR_BUCKET_SLOTS < 2 * (used + 1) ||
+               1 + bucket_cnt * DIR_BUCKET_SLOTS < old_cnt)
+            bucket_cnt *= 2;
+    }
+
+    for (; bucket_cnt <= DIR_BUCKETS_MAX; bucket_cnt *= 2) {
+        slot_cnt = 1 + bucket_cnt * DIR_BUCKET_SLOTS;
+        free(new);
+        new = calloc(slot_cnt, sizeof *new);
+        if (new == NULL)
+            goto done;
+        new[0].inode_sector = DIR_HASH_MAGIC;
+
+        /* Place each entry in the first free slot of its bucket. */
+        for (i = 0; i < old_cnt; i++) {
+            size_t bucket, j;
+            struct dir_entry *slots;
+
+            if (!old[i].in_use)
+                continue;
+            bucket = hash_string(old[i].name) % bucket_cnt;
+            slots = new + dir_bucket_ofs(bucket) / sizeof *new;
+            for (j = 0; j < DIR_BUCKET_SLOTS && slots[j].in_use; j++)
+                continue;
+            if (j == DIR_BUCKET_SLOTS)
+                break;
+            slots[j] = old[i];
+        }
+        if (i < old_cnt)
+            continue;
+
+        /* Every entry fits, so put the table in place of the old slots.
+           It may be far larger than the cache, so it is not written over
+           them through the journal. */
+        if (inode_replace(dir->inode, new, slot_cnt * sizeof *new)) {
+            dir->bucket_cnt = bucket_cnt;
+            success = true;
+        }
+        break;
+    }
+
+done:
+    free(old);
+    free(new);
+    return success;
+}
+
 /*! Removes any entry for NAME in DIR.  Returns true if successful, false on
     failure, which occurs only if there is no file with the given NAME. */
 bool dir_remove(struct dir *dir, const char *name) {
@@ -217,7 +433,7 @@ bool dir_remove(struct dir *dir, const char *name) {
 
     acquire_dir_lock(dir);
     /* Find directory entry. */
-    if (!lookup(dir, name, &e, &ofs))
+    if (!lookup(dir, name, &e, &ofs, NULL))
         goto done;
 
     /* Open inode. */
@@ -243,6 +459,8 @@ bool dir_remove(struct dir *dir, const char *name) {
 
     /* Remove inode. */
     inode_remove(inode);
+    dcache_insert(inode_get_inumber(dir->inode), name, DCACHE_NEGATIVE);
+    dcache_purge(e.inode_sector);
     success = true;
 
 done:
@@ -292,17 +510,12 @@ bool is_empty_dir(struct inode *inode) {
 
 /* Returns previously opened directory with given inode */
 struct dir *get_open_dir(struct inode *inode) {
-    struct list_elem *e;
     struct dir *dir;
 
-    for (e = list_begin(&open_dirs); e != list_end(&open_dirs);
-         e = list_next(e)) {
-        dir = list_entry(e, struct dir, elem);
-        if (dir_get_inode(dir) == inode) {
-            return dir;
-        }
-    }
-    return NULL;
+    lock_acquire(&open_dirs_lock);
+    dir = find_open_dir(inode);
+    lock_release(&open_dirs_lock);
+    return dir;
 }
 
 /* Initializes subdirectory. */
@@ -88,6 +88,15 @@ off_t file_write_at(struct file *file, const void *buffer, off_t size,
     return inode_write_at(file->inode, buffer, size, file_ofs);
 }
 
+/*! Copies SIZE bytes of SRC starting at offset SRC_OFS into DST starting at
+    offset DST_OFS, without passing the data through a caller's buffer.
+    Returns the number of bytes actually copied, which may be less than
+    SIZE if SRC ends first.  The positions of both files are unaffected. */
+off_t file_copy_at(struct file *dst, off_t dst_ofs, struct file *src,
+                   off_t src_ofs, off_t size) {
+    return inode_copy_at(dst->inode, dst_ofs, src->inode, src_ofs, size);
+}
+
 /*! Prevents write operations on FILE's underlying inode
     until file_allow_write() is called or FILE is closed. */
 void file_deny_write(struct file *file) {
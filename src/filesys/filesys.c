@@ -7,6 +7,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
@@ -18,17 +19,23 @@ static void do_format(void);
 /*! Initializes the file system module.
     If FORMAT is true, reformats the file system. */
 void filesys_init(bool format) {
+    /* Write-behind flushes open inodes as soon as it starts. */
+    inode_init();
     cache_table_init();
     fs_device = block_get_role(BLOCK_FILESYS);
     if (fs_device == NULL)
         PANIC("No file system device found, can't initialize file system.");
 
-    inode_init();
     directory_init();
     free_map_init();
 
+    /* Replay the journal before anything is read through the cache. */
+    journal_init(format);
     if (format)
         do_format();
+    else if (!inode_format_ok(FREE_MAP_SECTOR) ||
+             !inode_format_ok(ROOT_DIR_SECTOR))
+        PANIC("file system is in an older format; reformat it");
 
     free_map_open();
 
@@ -46,8 +53,10 @@ void filesys_done(void) {
     filesys_done_wait = true;
     sema_up(&read_ahead_sema);
     timer_sleep(TIMER_FREQ);
-    write_all_dirty();
+    inode_flush_all();
+    journal_done();
     free_map_close();
+    write_all_dirty();
 }
 
 /*! Creates a file at path PATH with the given INITIAL_SIZE.  Returns true if
@@ -66,14 +75,19 @@ bool filesys_create(const char *path, off_t initial_size) {
     strlcpy(path_copy, path, strlen(path) + 1);
     parse_path(path_copy, &dir, &name);
 
+    /* Place the file with its directory. */
+    journal_begin();
     bool success = (dir != NULL &&
-                    free_map_allocate(1, &inode_sector) &&
+                    free_map_allocate(1,
+                                      inode_get_inumber(dir_get_inode(dir)),
+                                      &inode_sector) &&
                     inode_create(inode_sector, initial_size) &&
                     dir_add(dir, name, inode_sector));
 
     if (!success && inode_sector != 0)
         free_map_release(inode_sector, 1);
     dir_close(dir);
+    journal_end();
     free(path_copy);
     return success;
 }
@@ -129,8 +143,10 @@ bool filesys_remove(const char *path) {
     strlcpy(path_copy, path, strlen(path) + 1);
     parse_path(path_copy, &dir, &name);
 
+    journal_begin();
     bool success = dir != NULL && dir_remove(dir, name);
     dir_close(dir);
+    journal_end();
 
     return success;
 }
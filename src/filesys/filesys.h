@@ -9,6 +9,7 @@
 /*! Sectors of system file inodes. @{ */
 #define FREE_MAP_SECTOR 0       /*!< Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /*!< Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /*!< Journal header sector. */
 /*! @} */
 
 #define MAX_PATH_SIZE BLOCK_SECTOR_SIZE
@@ -1,45 +1,202 @@
+/*! \file free-map.c
+ *
+ * Free map, one bit per sector of the file system device.  The device is
+ * divided into allocation groups of FREE_MAP_GROUP_SECTORS sectors, and
+ * the number of free sectors in each is kept alongside the bitmap.
+ * Allocations take a hint, a sector they would like to be near, and get
+ * the first free sectors at or after it, skipping over full groups.  New
+ * directories are hinted to the group with the most room, files to their
+ * directory, and a file's blocks to its inode or the block before, so
+ * that what is read together lies together on disk.
+ */
+
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /*!< Free map file. */
 static struct bitmap *free_map;      /*!< Free map, one bit per sector. */
+static struct lock free_map_lock;    /*!< Guards the free map and counts. */
+static size_t free_cnt;              /*!< Sectors not in use. */
+static size_t reserved_cnt;          /*!< Free sectors promised to writes
+                                          whose allocation is delayed. */
+static struct bitmap *deferred;      /*!< Released sectors not yet free
+                                          because the journal logged them. */
+static size_t *group_free;           /*!< Free sectors in each group. */
+static size_t group_cnt;             /*!< Number of allocation groups. */
+
+static bool allocate(size_t cnt, block_sector_t hint, block_sector_t *sectorp,
+                     bool reserved);
+static void count_groups(void);
+static void mark_groups(block_sector_t sector, size_t cnt, bool used);
 
 /*! Initializes the free map. */
 void free_map_init(void) {
     free_map = bitmap_create(block_size(fs_device));
-    if (free_map == NULL)
+    deferred = bitmap_create(block_size(fs_device));
+    group_cnt = DIV_ROUND_UP(block_size(fs_device), FREE_MAP_GROUP_SECTORS);
+    group_free = malloc(group_cnt * sizeof *group_free);
+    if (free_map == NULL || deferred == NULL || group_free == NULL)
         PANIC("bitmap creation failed--file system device is too large");
     bitmap_mark(free_map, FREE_MAP_SECTOR);
     bitmap_mark(free_map, ROOT_DIR_SECTOR);
+    bitmap_set_multiple(free_map, JOURNAL_SECTOR, JOURNAL_SECTORS + 1, true);
+    lock_init(&free_map_lock);
+    free_cnt = bitmap_count(free_map, 0, bitmap_size(free_map), false);
+    reserved_cnt = 0;
+    count_groups();
 }
 
 /*! Allocates CNT consecutive sectors from the free map and stores the first
-    into *SECTORP.
+    into *SECTORP.  The first free sectors at or after HINT are taken, or
+    failing that the first on the disk.  Sectors that have been reserved
+    are not handed out.
     Returns true if successful, false if not enough consecutive sectors were
     available or if the free_map file could not be written. */
-bool free_map_allocate(size_t cnt, block_sector_t *sectorp) {
-    block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
+bool free_map_allocate(size_t cnt, block_sector_t hint,
+                       block_sector_t *sectorp) {
+    return allocate(cnt, hint, sectorp, false);
+}
+
+/*! Like free_map_allocate(), but takes the CNT sectors out of those
+    reserved earlier by free_map_reserve().  May still fail if the free
+    sectors are not consecutive. */
+bool free_map_allocate_reserved(size_t cnt, block_sector_t hint,
+                                block_sector_t *sectorp) {
+    return allocate(cnt, hint, sectorp, true);
+}
+
+/*! Returns a hint for placing a new directory: the first sector of the
+    group with the most free sectors.  Directories thus spread out over
+    the disk, leaving room near each for the files put in it. */
+block_sector_t free_map_spread_hint(void) {
+    size_t best = 0, group;
+
+    lock_acquire(&free_map_lock);
+    for (group = 1; group < group_cnt; group++) {
+        if (group_free[group] > group_free[best])
+            best = group;
+    }
+    lock_release(&free_map_lock);
+    return best * FREE_MAP_GROUP_SECTORS;
+}
+
+/*! Promises CNT free sectors to a later free_map_allocate_reserved(),
+    without choosing them yet.  Returns false if fewer than CNT sectors are
+    free and unpromised. */
+bool free_map_reserve(size_t cnt) {
+    bool success;
+
+    lock_acquire(&free_map_lock);
+    success = free_cnt - reserved_cnt >= cnt;
+    if (success)
+        reserved_cnt += cnt;
+    lock_release(&free_map_lock);
+    return success;
+}
+
+/*! Withdraws a promise of CNT sectors made by free_map_reserve(). */
+void free_map_unreserve(size_t cnt) {
+    lock_acquire(&free_map_lock);
+    ASSERT(reserved_cnt >= cnt);
+    reserved_cnt -= cnt;
+    lock_release(&free_map_lock);
+}
+
+/*! Makes CNT sectors starting at SECTOR available for use.  A sector
+    that the journal holds a copy of stays in use until the journal is
+    checkpointed, since replaying the log would overwrite whatever was
+    written there next. */
+void free_map_release(block_sector_t sector, size_t cnt) {
+    size_t i;
+
+    lock_acquire(&free_map_lock);
+    ASSERT(bitmap_all(free_map, sector, cnt));
+    for (i = 0; i < cnt; i++) {
+        if (journal_logged(sector + i)) {
+            bitmap_mark(deferred, sector + i);
+        }
+        else {
+            bitmap_reset(free_map, sector + i);
+            mark_groups(sector + i, 1, false);
+            free_cnt++;
+        }
+    }
+    bitmap_write(free_map, free_map_file);
+    lock_release(&free_map_lock);
+}
+
+/*! Makes available the sectors that free_map_release() kept in use and
+    that the journal no longer holds copies of. */
+void free_map_release_deferred(void) {
+    size_t sector = 0;
+    bool changed = false;
+
+    journal_begin();
+    lock_acquire(&free_map_lock);
+    while ((sector = bitmap_scan(deferred, sector, 1, true)) != BITMAP_ERROR) {
+        if (!journal_logged(sector)) {
+            bitmap_reset(deferred, sector);
+            bitmap_reset(free_map, sector);
+            mark_groups(sector, 1, false);
+            free_cnt++;
+            changed = true;
+        }
+        sector++;
+    }
+    if (changed)
+        bitmap_write(free_map, free_map_file);
+    lock_release(&free_map_lock);
+    journal_end();
+}
+
+/*! Allocates CNT consecutive sectors near HINT and stores the first into
+    *SECTORP, counting them against the reservation if RESERVED and
+    otherwise leaving reserved sectors alone. */
+static bool allocate(size_t cnt, block_sector_t hint, block_sector_t *sectorp,
+                     bool reserved) {
+    block_sector_t sector = BITMAP_ERROR;
+
+    lock_acquire(&free_map_lock);
+    ASSERT(!reserved || reserved_cnt >= cnt);
+    if (reserved || free_cnt - reserved_cnt >= cnt) {
+        /* Start from the first group at or after HINT's with room. */
+        size_t group, i;
+
+        if (hint >= bitmap_size(free_map))
+            hint = 0;
+        group = hint / FREE_MAP_GROUP_SECTORS;
+        for (i = 0; i < group_cnt && group_free[group] == 0; i++) {
+            group = (group + 1) % group_cnt;
+            hint = group * FREE_MAP_GROUP_SECTORS;
+        }
+        sector = bitmap_scan_and_flip(free_map, hint, cnt, false);
+        if (sector == BITMAP_ERROR && hint > 0)
+            sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
+    }
     if (sector != BITMAP_ERROR && free_map_file != NULL &&
         !bitmap_write(free_map, free_map_file)) {
         bitmap_set_multiple(free_map, sector, cnt, false); 
         sector = BITMAP_ERROR;
     }
-    if (sector != BITMAP_ERROR)
+    if (sector != BITMAP_ERROR) {
+        mark_groups(sector, cnt, true);
+        free_cnt -= cnt;
+        if (reserved)
+            reserved_cnt -= cnt;
         *sectorp = sector;
+    }
+    lock_release(&free_map_lock);
     return sector != BITMAP_ERROR;
 }
 
-/*! Makes CNT sectors starting at SECTOR available for use. */
-void free_map_release(block_sector_t sector, size_t cnt) {
-    ASSERT(bitmap_all(free_map, sector, cnt));
-    bitmap_set_multiple(free_map, sector, cnt, false);
-    bitmap_write(free_map, free_map_file);
-}
-
 /*! Opens the free map file and reads it from disk. */
 void free_map_open(void) {
     free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
@@ -47,6 +204,35 @@ void free_map_open(void) {
         PANIC("can't open free map");
     if (!bitmap_read(free_map, free_map_file))
         PANIC("can't read free map");
+    free_cnt = bitmap_count(free_map, 0, bitmap_size(free_map), false);
+    count_groups();
+}
+
+/*! Counts the free sectors in each group from scratch. */
+static void count_groups(void) {
+    size_t size = bitmap_size(free_map);
+    size_t group;
+
+    for (group = 0; group < group_cnt; group++) {
+        size_t start = group * FREE_MAP_GROUP_SECTORS;
+        size_t cnt = size - start < FREE_MAP_GROUP_SECTORS
+                     ? size - start : FREE_MAP_GROUP_SECTORS;
+        group_free[group] = bitmap_count(free_map, start, cnt, false);
+    }
+}
+
+/*! Counts CNT sectors starting at SECTOR, which may span groups, as used
+    if USED or else as free. */
+static void mark_groups(block_sector_t sector, size_t cnt, bool used) {
+    size_t i;
+
+    for (i = 0; i < cnt; i++) {
+        size_t group = (sector + i) / FREE_MAP_GROUP_SECTORS;
+        if (used)
+            group_free[group]--;
+        else
+            group_free[group]++;
+    }
 }
 
 /*! Writes the free map to disk and closes the free map file. */
@@ -57,7 +243,7 @@ void free_map_close(void) {
 /*! Creates a new free map file on disk and writes the free map to it. */
 void free_map_create(void) {
     /* Create inode. */
-    if (!inode_create(FREE_MAP_SECTOR, bitmap_file_size(free_map)))
+    if (!inode_create_allocated(FREE_MAP_SECTOR, bitmap_file_size(free_map)))
         PANIC("free map creation failed");
 
     /* Write bitmap to file. */
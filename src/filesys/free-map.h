@@ -5,14 +5,24 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+/*! Sectors in each allocation group, the unit of the free map's summary
+    of where free space lies. */
+#define FREE_MAP_GROUP_SECTORS 512
+
 void free_map_init(void);
 void free_map_read(void);
 void free_map_create(void);
 void free_map_open(void);
 void free_map_close(void);
 
-bool free_map_allocate(size_t, block_sector_t *);
+bool free_map_allocate(size_t, block_sector_t hint, block_sector_t *);
+bool free_map_allocate_reserved(size_t, block_sector_t hint,
+                                block_sector_t *);
+block_sector_t free_map_spread_hint(void);
+bool free_map_reserve(size_t);
+void free_map_unreserve(size_t);
 void free_map_release(block_sector_t, size_t);
+void free_map_release_deferred(void);
 
 #endif /* filesys/free-map.h */
 
@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -7,11 +8,31 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/range-lock.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 
-/*! Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/*! Identifies an inode.  Changed whenever struct inode_disk is laid out
+    anew, so that a disk in an older layout is rejected, not misread. */
+#define INODE_MAGIC 0x494e4f45
+
+/*! Most sectors looked up at once by a read or write. */
+#define INODE_MAP_BATCH 64
+
+/*! How inode_map() treats holes. */
+enum map_mode {
+    MAP_LOOKUP,         /*!< Report each hole as 0. */
+    MAP_TABLES,         /*!< Allocate the indirect blocks that lead to
+                             holes, but still report the holes as 0. */
+    MAP_ALLOCATE,       /*!< Give each hole a zeroed sector. */
+    MAP_ASSIGN          /*!< Fill each hole with the sector passed in. */
+};
+
+/*! Largest file an inode can address. */
+#define INODE_MAX_LENGTH                                                \
+    ((off_t) (DIRECT_BLOCK_COUNT + TOTAL_SECTOR_COUNT +                 \
+              TOTAL_SECTOR_COUNT * TOTAL_SECTOR_COUNT) * BLOCK_SECTOR_SIZE)
 
 /*! On-disk inode.
     Must be exactly BLOCK_SECTOR_SIZE bytes long. */
@@ -21,6 +42,7 @@ struct inode_disk {
     block_sector_t double_indirect_block;               /*!< Index for double indirect block */
 
     off_t length;                                       /*!< File size in bytes. */
+    uint32_t is_dir;                                    /*!< Nonzero for a directory. */
     unsigned magic;                                     /*!< Magic number. */
 };
 
@@ -36,16 +58,22 @@ static inline size_t bytes_to_sectors(off_t size) {
 
 /*! In-memory inode. */
 struct inode {
-    struct list_elem elem;              /*!< Element in inode list. */
+    struct hash_elem elem;              /*!< Element in open_inodes. */
     block_sector_t sector;              /*!< Sector number of disk location. */
     int open_cnt;                       /*!< Number of openers. */
     bool removed;                       /*!< True if deleted, false otherwise. */
     int deny_write_cnt;                 /*!< 0: writes ok, >0: deny writes. */
+    unsigned generation;                /*!< Bumped on every write. */
+    size_t delayed_cnt;                 /*!< Blocks written but not yet
+                                             given sectors. */
+    struct inode_disk data;             /*!< Copy of the on-disk inode. */
 
 #ifdef CACHE
     bool is_dir;                        /*!< Directory or normal file. */
     int in_use;                         /*!< Number of files/dirs open. */
     struct lock node_lock;              /*!< Locking for file extension */
+    struct range_lock ranges;           /*!< Byte ranges being read and
+                                             written. */
 #endif
 };
 
@@ -65,334 +93,535 @@ static struct indirect_block *indirect_inode_new(void) {
     return new_indir_block;
 }
 
-/* Handles populating the actual sectors pointed by the indirect block */
-static bool handle_indirect_block(struct indirect_block *block, size_t num_indirect) {
-    static char zeros[BLOCK_SECTOR_SIZE];
-    unsigned idx;
+/*! Returns the cache class of INODE's data.  Directories and the free map
+    are metadata, like the inodes and tables that index them. */
+static enum cache_class data_class(const struct inode *inode) {
+#ifdef CACHE
+    if (inode->is_dir)
+        return CACHE_META;
+#endif
+    return inode->sector == FREE_MAP_SECTOR ? CACHE_META : CACHE_DATA;
+}
 
-    for (idx = 0; idx < num_indirect; idx++) {
-        /* Ensure not allocated yet */
-        if (block->blocks[idx] == 0) {
-            if (!free_map_allocate(1, &block->blocks[idx]))
-                return false;
-            write_to_cache(block->blocks[idx], zeros);
-        }
-    }
+/*! Allocates a sector as near after HINT as the disk allows, fills it with
+    zeros, and stores its number in *SECTORP.  The zeros are cached as
+    class CLS.  Returns false if the disk is full. */
+static bool sector_allocate(block_sector_t *sectorp, block_sector_t hint,
+                            enum cache_class cls) {
+    static char zeros[BLOCK_SECTOR_SIZE];
+    block_sector_t sector;
 
+    if (!free_map_allocate(1, hint, &sector))
+        return false;
+    write_to_cache(sector, zeros, cls);
+    *sectorp = sector;
     return true;
 }
 
-/* Handles the free-map allocations for direct blocks */
-static bool handle_direct_alloc(struct inode_disk *disk, size_t num_direct) {
-    static char zeros[BLOCK_SECTOR_SIZE];
+/* Releases the indirect block at SECTOR and every data sector it lists. */
+static void release_indirect_block(block_sector_t sector) {
+    struct indirect_block *block = indirect_inode_new();
     unsigned idx;
 
-    /* We want to free map one at a time */
-    for (idx = 0; idx < num_direct; idx++) {
-        /* Ensure not allocated yet */
-        if (disk->direct_blocks[idx] == 0) {
-            if (!free_map_allocate(1, &disk->direct_blocks[idx]))
-                return false;
-            write_to_cache(disk->direct_blocks[idx], zeros);
-        }
+    read_from_cache(sector, block, CACHE_META);
+    for (idx = 0; idx < TOTAL_SECTOR_COUNT; idx++) {
+        if (block->blocks[idx] != 0)
+            free_map_release(block->blocks[idx], 1);
     }
-
-    return true;
+    free_map_release(sector, 1);
+    free(block);
 }
 
-/* Handles the free-map allocations for indirect blocks. Will invoke handle_indirect_block */
-static bool handle_indirect_alloc(struct inode_disk *disk, size_t num_indirect) {
-    static char zeros[BLOCK_SECTOR_SIZE];
+/* This will release the bitmap in free_map when we're freeing an inode.
+   Every sector DISK points to is released, directly or through its
+   indirect blocks.  Holes are skipped. */
+static void inode_release_free_map(struct inode_disk *disk) {
+    unsigned idx;
 
-    if (num_indirect > 0) {
-        struct indirect_block *new_indir_block = indirect_inode_new();
+    /* First, release all direct block sectors */
+    for (idx = 0; idx < DIRECT_BLOCK_COUNT; idx++) {
+        if (disk->direct_blocks[idx] != 0)
+            free_map_release(disk->direct_blocks[idx], 1);
+    }
 
-        /* If indirect block not allocated */
-        if (disk->indirect_block == 0) {
-            if (!free_map_allocate(1, &disk->indirect_block))
-                return false;
-            write_to_cache(disk->indirect_block, zeros);
-        }
-        read_from_cache(disk->indirect_block, new_indir_block);
+    /* Next, release all indirect block sectors */
+    if (disk->indirect_block != 0)
+        release_indirect_block(disk->indirect_block);
 
-        /* Populate the pointers inside the indirect block */
-        if (!handle_indirect_block(new_indir_block, num_indirect)) {
-            free(new_indir_block);
-            return false;
+    /* Finally, release all doubly indirect block sectors */
+    if (disk->double_indirect_block != 0) {
+        struct indirect_block *temp_double_block = indirect_inode_new();
+        read_from_cache(disk->double_indirect_block, temp_double_block,
+                        CACHE_META);
+        for (idx = 0; idx < TOTAL_SECTOR_COUNT; idx++) {
+            if (temp_double_block->blocks[idx] != 0)
+                release_indirect_block(temp_double_block->blocks[idx]);
         }
-
-        /* Write entire indirect block into cache */
-        write_to_cache(disk->indirect_block, new_indir_block);
-        free(new_indir_block);
+        free_map_release(disk->double_indirect_block, 1);
+        free(temp_double_block);
     }
-
-    return true;
 }
 
-/* Handles the free-map allocations for double indirect blocks. Will invoke
-   handle_indirect_block several times */
-static bool handle_double_indirect_alloc(struct inode_disk *disk, size_t num_double_indirect) {
-    static char zeros[BLOCK_SECTOR_SIZE];
-
-    /* If the file is actually large enough for a doubly indirect block... */
-    if (num_double_indirect > 0) {
-        /* Number of iterations we need to do */
-        size_t indirect_blocks = DIV_ROUND_UP(num_double_indirect, TOTAL_SECTOR_COUNT);
-        unsigned indirect_idx;
+/*! Stores in SECTORS the device sectors holding sectors FIRST through
+    FIRST + CNT - 1 of the file whose on-disk inode is DISK.  A sector
+    that was never written, or whose allocation is delayed, is a hole,
+    which is stored as 0.  Other MODEs than MAP_LOOKUP change DISK as they
+    describe, allocating any indirect blocks needed, and write DISK back to
+    INODE_SECTOR if it changed; the caller must then hold the inode's
+    extension lock.  For MAP_ASSIGN, SECTORS holds on entry the sector for
+    each hole.  Returns the number stored, which is less than CNT only past
+    the last sector an inode can address or when the disk fills up.  Each
+    indirect block involved is read only once.  Sectors allocated are
+    placed after the last sector mapped, or at first after the inode. */
+static size_t inode_map(struct inode_disk *disk, block_sector_t inode_sector,
+                        size_t first, block_sector_t *sectors, size_t cnt,
+                        enum map_mode mode) {
+    struct indirect_block *indirect = NULL;
+    struct indirect_block *double_indirect = NULL;
+    block_sector_t indirect_sector = 0;
+    bool disk_dirty = false, indirect_dirty = false, double_dirty = false;
+    block_sector_t hint = inode_sector;
+    size_t i;
+
+    for (i = 0; i < cnt; i++) {
+        size_t sector_ofs = first + i;
+        block_sector_t *slot;
+        bool *slot_dirty;
 
-
-        /* If double indirect block not allocated, allocate that. */
-        if (disk->double_indirect_block == 0) {
-            if (!free_map_allocate(1, &disk->double_indirect_block))
-                return false;
-            write_to_cache(disk->double_indirect_block, zeros);
+        if (sector_ofs < DIRECT_BLOCK_COUNT) {
+            /* Direct blocks need no further lookup. */
+            slot = &disk->direct_blocks[sector_ofs];
+            slot_dirty = &disk_dirty;
         }
+        else {
+            block_sector_t *table;
+            bool *table_dirty;
 
-        /* Create an doubly indirect block */
-        struct indirect_block *new_double_indirect_block = indirect_inode_new();
-        read_from_cache(disk->double_indirect_block, new_double_indirect_block);
-
-        /* For each indirect block, we will essentially do what handle_indirect_alloc does */
-        for (indirect_idx = 0; indirect_idx < indirect_blocks; indirect_idx++) {
-            size_t num_sectors_in_indir = (num_double_indirect < TOTAL_SECTOR_COUNT) ?
-                                          num_double_indirect : TOTAL_SECTOR_COUNT;
-
-            if (new_double_indirect_block->blocks[indirect_idx] == 0) {
-                if (!free_map_allocate(1, &new_double_indirect_block->blocks[indirect_idx])) {
-                    free(new_double_indirect_block);
-                    return false;
+            /* Find the indirect block listing this sector. */
+            sector_ofs -= DIRECT_BLOCK_COUNT;
+            if (sector_ofs < TOTAL_SECTOR_COUNT) {
+                table = &disk->indirect_block;
+                table_dirty = &disk_dirty;
+            }
+            else {
+                sector_ofs -= TOTAL_SECTOR_COUNT;
+                if (sector_ofs >= TOTAL_SECTOR_COUNT * TOTAL_SECTOR_COUNT)
+                    break;
+
+                if (disk->double_indirect_block == 0) {
+                    if (mode == MAP_LOOKUP) {
+                        sectors[i] = 0;
+                        continue;
+                    }
+                    if (!sector_allocate(&disk->double_indirect_block,
+                                         hint, CACHE_META))
+                        break;
+                    disk_dirty = true;
                 }
-
-                write_to_cache(new_double_indirect_block->blocks[indirect_idx], zeros);
+                if (double_indirect == NULL) {
+                    double_indirect = indirect_inode_new();
+                    read_from_cache(disk->double_indirect_block,
+                                    double_indirect, CACHE_META);
+                }
+                table = &double_indirect->blocks[sector_ofs / TOTAL_SECTOR_COUNT];
+                table_dirty = &double_dirty;
+                sector_ofs %= TOTAL_SECTOR_COUNT;
             }
 
-            struct indirect_block *new_indir_block = indirect_inode_new();
-            read_from_cache(new_double_indirect_block->blocks[indirect_idx], new_indir_block);
-
-            if (!handle_indirect_block(new_indir_block, num_sectors_in_indir)) {
-                free(new_indir_block);
-                free(new_double_indirect_block);
-                return false;
+            /* A missing indirect block is a hole as wide as it is. */
+            if (*table == 0) {
+                if (mode == MAP_LOOKUP) {
+                    sectors[i] = 0;
+                    continue;
+                }
+                if (!sector_allocate(table, hint, CACHE_META))
+                    break;
+                *table_dirty = true;
             }
 
-            /* Writing this indirect block information on one of the indices in the doubly indirect
-               block */
-            write_to_cache(new_double_indirect_block->blocks[indirect_idx], new_indir_block);
-            free(new_indir_block);
-
-            num_double_indirect -= num_sectors_in_indir;
+            if (indirect == NULL)
+                indirect = indirect_inode_new();
+            if (*table != indirect_sector) {
+                if (indirect_dirty)
+                    write_to_cache(indirect_sector, indirect, CACHE_META);
+                read_from_cache(*table, indirect, CACHE_META);
+                indirect_sector = *table;
+                indirect_dirty = false;
+            }
+            slot = &indirect->blocks[sector_ofs];
+            slot_dirty = &indirect_dirty;
         }
 
-        ASSERT(num_double_indirect == 0);
-
-        /* Doubly indirect block should be finished. Write all of that to inode_disk */
-        write_to_cache(disk->double_indirect_block, new_double_indirect_block);
-        free(new_double_indirect_block);
+        if (mode == MAP_ASSIGN) {
+            ASSERT(*slot == 0);
+            *slot = sectors[i];
+            *slot_dirty = true;
+        }
+        else if (*slot == 0 && mode == MAP_ALLOCATE) {
+            if (!sector_allocate(slot, hint, CACHE_DATA))
+                break;
+            *slot_dirty = true;
+        }
+        sectors[i] = *slot;
+        if (*slot != 0)
+            hint = *slot + 1;
     }
 
-    return true;
+    /* Write back whatever gained sectors, innermost first. */
+    if (indirect_dirty)
+        write_to_cache(indirect_sector, indirect, CACHE_META);
+    if (double_dirty)
+        write_to_cache(disk->double_indirect_block, double_indirect,
+                       CACHE_META);
+    if (disk_dirty)
+        write_to_cache(inode_sector, disk, CACHE_META);
+
+    free(indirect);
+    free(double_indirect);
+    return i;
 }
 
-/* Based on the number of direct, indirect, and doubly indirect blocks, we
-   map the appropriate sectors.
-
-   Returns true if free_map was allocated properly given the disk
-   Returns false otherwise. */
-static bool inode_allocate_free_map(struct inode_disk *disk) {
-    off_t length = disk->length;
-    ASSERT(length >= 0);        /* We would hope that the length would be non-negative */
-
-    size_t num_sectors = bytes_to_sectors(length);
-
-    /* First, handle the direct blocks */
-    size_t num_direct = (num_sectors < DIRECT_BLOCK_COUNT) ? num_sectors : DIRECT_BLOCK_COUNT;
-    if (!handle_direct_alloc(disk, num_direct))
-        return false;
-    num_sectors -= num_direct;
-
-    /* Next, handle the indirect block */
-    size_t num_indirect = (num_sectors < TOTAL_SECTOR_COUNT) ? num_sectors : TOTAL_SECTOR_COUNT;
-    if (!handle_indirect_alloc(disk, num_indirect))
-        return false;
-    num_sectors -= num_indirect;
-
-
-    /* Finally, handle the doubly indirect block */
-    size_t num_double_indirect = num_sectors;
-    ASSERT(num_double_indirect < TOTAL_SECTOR_COUNT * TOTAL_SECTOR_COUNT);
-
-    if (!handle_double_indirect_alloc(disk, num_double_indirect))
-        return false;
-    num_sectors -= num_double_indirect;
-
-    /* All sectors should be accounted for */
-    ASSERT(num_sectors == 0);
-    return true;
-}
-
-/* This will release the bitmap in free_map when we're freeing an inode.
-   Since we filled up inode direct -> indirect -> doubly indirect,
-   we will release in the same order */
-static void inode_release_free_map(struct inode_disk *disk) {
-    unsigned idx;
-    size_t length = disk->length;
-    size_t num_sectors = bytes_to_sectors(length);
-
-    /* First, release all direct block sectors */
-    size_t num_direct = (num_sectors < DIRECT_BLOCK_COUNT) ? num_sectors : DIRECT_BLOCK_COUNT;
-    for (idx = 0; idx < num_direct; idx++) {
-        /* It's assumed that it has been allocated already */
-        ASSERT(disk->direct_blocks[idx] != 0);
-        free_map_release(disk->direct_blocks[idx], 1);
-    }
-
-    num_sectors -= num_direct;
+/*! Gives each delayed block of INODE a sector, placing each run of
+    consecutive blocks in one extent where the disk has room for it.  The
+    blocks stay in the cache, now as dirty copies of their sectors.  The
+    caller must hold INODE's extension lock. */
+static void inode_flush_locked(struct inode *inode) {
+    block_sector_t blocks[CACHE_DELAYED_MAX];
+    block_sector_t sectors[CACHE_DELAYED_MAX];
+
+    while (inode->delayed_cnt > 0) {
+        size_t cnt = cache_delayed_blocks(inode, blocks);
+        size_t i, j, run;
+
+        ASSERT(cnt > 0);
+        for (i = 0; i < cnt; i += run) {
+            block_sector_t start, hint = 0;
+
+            run = 1;
+            while (i + run < cnt && blocks[i + run] == blocks[i] + run)
+                run++;
+
+            /* Follow on from the block before, or else the inode. */
+            if (blocks[i] > 0)
+                inode_map(&inode->data, inode->sector, blocks[i] - 1, &hint,
+                          1, MAP_LOOKUP);
+            hint = hint != 0 ? hint + 1 : inode->sector;
+
+            /* The sectors are reserved, so single ones are always free. */
+            while (!free_map_allocate_reserved(run, hint, &start)) {
+                ASSERT(run > 1);
+                run /= 2;
+            }
 
-    /* Next, release all indirect block sectors */
-    size_t num_indirect = (num_sectors < TOTAL_SECTOR_COUNT) ? num_sectors : TOTAL_SECTOR_COUNT;
-    struct indirect_block *temp_block = indirect_inode_new();
-    if (num_indirect > 0) {
-        read_from_cache(disk->indirect_block, temp_block);
-
-        for (idx = 0; idx < num_indirect; idx++) {
-            ASSERT(temp_block->blocks[idx] != 0);
-            free_map_release(temp_block->blocks[idx], 1);
+            /* Rekey the cached blocks before the inode points at them, so
+               that a reader never finds a sector that is not cached. */
+            for (j = 0; j < run; j++) {
+                cache_delayed_assign(inode, blocks[i + j], start + j);
+                sectors[j] = start + j;
+            }
+            inode_map(&inode->data, inode->sector, blocks[i], sectors, run,
+                      MAP_ASSIGN);
+            inode->delayed_cnt -= run;
         }
-
-        free_map_release(disk->indirect_block, 1);
     }
-    free(temp_block);
-    temp_block = NULL;
-
-    num_sectors -= num_indirect;
+}
 
-    /* Finally, release all doubly indirect block sectors */
-    size_t num_double_indirect = num_sectors;
-    ASSERT(num_double_indirect < TOTAL_SECTOR_COUNT * TOTAL_SECTOR_COUNT);
+/*! Gives each delayed block of INODE a sector. */
+static void inode_flush(struct inode *inode) {
+    if (inode->delayed_cnt > 0) {
+        journal_begin();
+        extension_lock_acquire(inode);
+        inode_flush_locked(inode);
+        extension_lock_release(inode);
+        journal_end();
+    }
+}
 
-    struct indirect_block *temp_double_block = indirect_inode_new();
-    if (num_double_indirect > 0) {
-        unsigned indirect_idx;
-        /* Number of second layer indirects to account for... */
-        size_t num_second_layer_blocks = DIV_ROUND_UP(num_double_indirect, TOTAL_SECTOR_COUNT);
+/*! Returns the block device sector that contains byte offset POS
+    within INODE, or 0 if POS falls in a hole.
+    Returns -1 if INODE does not contain data for a byte at offset
+    POS. */
+static block_sector_t byte_to_sector(struct inode *inode, off_t pos) {
+    block_sector_t sector_idx;
 
-        /* Writing the double indirect block struct into this pointer */
-        ASSERT(disk->double_indirect_block != 0);
-        read_from_cache(disk->double_indirect_block, temp_double_block);
+    ASSERT(inode != NULL);
+    if (pos >= inode->data.length)
+        return -1;
+    if (inode_map(&inode->data, inode->sector, pos / BLOCK_SECTOR_SIZE,
+                  &sector_idx, 1, MAP_LOOKUP) != 1)
+        return -1;
+    return sector_idx;
+}
 
-        for (indirect_idx = 0; indirect_idx < num_second_layer_blocks; indirect_idx++) {
-            ASSERT(temp_double_block->blocks[indirect_idx] != 0);
-            struct indirect_block *second_layer_block = indirect_inode_new();
+/*! Returns the sector holding byte offset POS within INODE, allocating
+    it first if POS falls in a hole.  Returns 0 if the disk is full. */
+static block_sector_t byte_to_sector_alloc(struct inode *inode, off_t pos) {
+    block_sector_t sector_idx;
+    size_t cnt;
+
+    extension_lock_acquire(inode);
+    inode_flush_locked(inode);
+    cnt = inode_map(&inode->data, inode->sector, pos / BLOCK_SECTOR_SIZE,
+                    &sector_idx, 1, MAP_ALLOCATE);
+    extension_lock_release(inode);
+    return cnt == 1 ? sector_idx : 0;
+}
 
-            read_from_cache(temp_double_block->blocks[indirect_idx], second_layer_block);
+/*! Writes BYTES bytes from DATA at offset OFS of BLOCK, which was a hole in
+    INODE when last looked up.  A block still in a hole is kept in the
+    cache as a delayed block, with a sector reserved for it but not yet
+    chosen; if the cache holds all the delayed blocks it can, the block is
+    allocated now instead.  A directory's block is always allocated now,
+    since the journal can only hold a block that has a sector.  Returns
+    false if the disk is full.  The caller must hold INODE's extension
+    lock. */
+static bool inode_write_hole(struct inode *inode, block_sector_t block,
+                             off_t ofs, const uint8_t *data, size_t bytes) {
+    block_sector_t sector_idx;
 
-            size_t num_sectors_in_indir = (num_double_indirect < TOTAL_SECTOR_COUNT) ?
-                                           num_double_indirect : TOTAL_SECTOR_COUNT;
+    if (write_cache_delayed(inode, block, ofs, data, bytes, false))
+        return true;
 
-            for (idx = 0; idx < num_sectors_in_indir; idx++) {
-                ASSERT(second_layer_block->blocks[idx] != 0);
-                free_map_release(second_layer_block->blocks[idx], 1);
+    /* The block may have been flushed since it was looked up. */
+    inode_map(&inode->data, inode->sector, block, &sector_idx, 1,
+              MAP_LOOKUP);
+    if (sector_idx == 0 && data_class(inode) == CACHE_META) {
+        if (inode_map(&inode->data, inode->sector, block, &sector_idx, 1,
+                      MAP_ALLOCATE) != 1)
+            return false;
+    }
+    if (sector_idx == 0) {
+        if (!free_map_reserve(1))
+            return false;
+        if (!write_cache_delayed(inode, block, ofs, data, bytes, true)) {
+            inode_flush_locked(inode);
+            if (!write_cache_delayed(inode, block, ofs, data, bytes, true)) {
+                free_map_unreserve(1);
+                if (inode_map(&inode->data, inode->sector, block,
+                              &sector_idx, 1, MAP_ALLOCATE) != 1)
+                    return false;
+                write_cache_offset(sector_idx, data, ofs, bytes,
+                                   data_class(inode));
+                return true;
             }
-
-            free_map_release(temp_double_block->blocks[indirect_idx], 1);
-            free(second_layer_block);
-            num_double_indirect -= num_sectors_in_indir;
         }
-        free_map_release(disk->double_indirect_block, 1);
+        inode->delayed_cnt++;
+        return true;
     }
-    free(temp_double_block);
+    write_cache_offset(sector_idx, data, ofs, bytes, data_class(inode));
+    return true;
 }
 
-/*! Returns the block device sector that contains byte offset POS
-    within INODE.
-    Returns -1 if INODE does not contain data for a byte at offset
-    POS. */
-static block_sector_t byte_to_sector(const struct inode *inode, off_t pos) {
-    ASSERT(inode != NULL);
+/*! Reads BYTES bytes at offset OFS of BLOCK, which was a hole in INODE when
+    last looked up, into DATA.  The caller must hold INODE's extension
+    lock. */
+static void inode_read_hole(struct inode *inode, block_sector_t block,
+                            off_t ofs, uint8_t *data, size_t bytes) {
     block_sector_t sector_idx;
 
-    /* Calculate file length. */
-    struct inode_disk disk;
-    read_from_cache(inode->sector, &disk);
+    if (read_cache_delayed(inode, block, ofs, data, bytes))
+        return;
+    inode_map(&inode->data, inode->sector, block, &sector_idx, 1,
+              MAP_LOOKUP);
+    if (sector_idx != 0)
+        read_cache_offset(sector_idx, data, ofs, bytes, data_class(inode));
+    else
+        memset(data, 0, bytes);
+}
 
-    int length = disk.length;
+/*! Copies SIZE bytes between BUFFER and the run of holes in INODE that
+    starts OFS bytes into its sector BLOCK, as inode_transfer() does.
+    DELAYED says whether INODE had delayed blocks before the holes were
+    looked up; if not, they read as zeros.  Returns the number of bytes
+    copied. */
+static off_t inode_transfer_holes(struct inode *inode, block_sector_t block,
+                                  int ofs, uint8_t *buffer, off_t size,
+                                  bool write, bool delayed) {
+    off_t bytes_done = 0;
+
+    if (!write && !delayed) {
+        memset(buffer, 0, size);
+        return size;
+    }
 
-    if (pos < length) {
-        int sector_ofs = pos / BLOCK_SECTOR_SIZE;
+    extension_lock_acquire(inode);
+    while (bytes_done < size) {
+        size_t chunk_size = BLOCK_SECTOR_SIZE - ofs;
+        if (chunk_size > (size_t) (size - bytes_done))
+            chunk_size = size - bytes_done;
+
+        if (!write)
+            inode_read_hole(inode, block, ofs, buffer + bytes_done,
+                            chunk_size);
+        else if (!inode_write_hole(inode, block, ofs, buffer + bytes_done,
+                                   chunk_size))
+            break;
 
-        /* Check whether it should be a direct block. */
-        if (sector_ofs < DIRECT_BLOCK_COUNT) {
-            /* Return direct block */
-            sector_idx = disk.direct_blocks[sector_ofs];
-            return sector_idx;
-        }
-        else {
-            sector_ofs -= DIRECT_BLOCK_COUNT;
+        bytes_done += chunk_size;
+        block++;
+        ofs = 0;
+    }
+    extension_lock_release(inode);
+    return bytes_done;
+}
 
-            /* Check whether it should be an indirect block. */
-            struct indirect_block *indirect = indirect_inode_new();
-            if (sector_ofs < TOTAL_SECTOR_COUNT) {
-                /* Get indirect block from cache. */
-                read_from_cache(disk.indirect_block, indirect);
+/*! Copies SIZE bytes between BUFFER and INODE, starting at byte OFFSET
+    of the file: into the file if WRITE, out of it otherwise.  The bytes
+    must lie within the file.  Sectors are looked up INODE_MAP_BATCH at a
+    time and each run of them that is contiguous on disk moves through the
+    cache as one range.  Holes read as zeros, and writes to them are
+    delayed, with sectors chosen only when the file is flushed.  Returns
+    the number of bytes copied, which is less than SIZE only if the disk
+    fills up. */
+static off_t inode_transfer(struct inode *inode, uint8_t *buffer,
+                            off_t size, off_t offset, bool write) {
+    block_sector_t sectors[INODE_MAP_BATCH];
+    off_t bytes_done = 0;
 
-                /* Get sector. */
-                sector_idx = indirect->blocks[sector_ofs];
-                free(indirect);
-                return sector_idx;
+    while (size > 0) {
+        int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+        size_t first = offset / BLOCK_SECTOR_SIZE;
+        size_t cnt = DIV_ROUND_UP(sector_ofs + size, BLOCK_SECTOR_SIZE);
+        size_t i;
+
+        if (cnt > INODE_MAP_BATCH)
+            cnt = INODE_MAP_BATCH;
+
+        /* A flush gives blocks sectors before it counts them off, so a
+           hole found after seeing no delayed blocks is a real one. */
+        bool delayed = inode->delayed_cnt > 0;
+        barrier();
+        cnt = inode_map(&inode->data, inode->sector, first, sectors, cnt,
+                        MAP_LOOKUP);
+        if (write) {
+            /* Sectors never move once given, so only a write into holes
+               needs the extension lock, to add indirect blocks. */
+            for (i = 0; i < cnt && sectors[i] != 0; i++)
+                continue;
+            if (i < cnt) {
+                extension_lock_acquire(inode);
+                cnt = inode_map(&inode->data, inode->sector, first, sectors,
+                                cnt, MAP_TABLES);
+                extension_lock_release(inode);
             }
-            else {
-                /* Handle doubly indirect blocks. */
-                sector_ofs -= TOTAL_SECTOR_COUNT;
-
-                if (sector_ofs >= TOTAL_SECTOR_COUNT * TOTAL_SECTOR_COUNT) {
-                    /* Error if asking for block after doubly indirect. */
-                    return -1;
-                }
+        }
+        if (cnt == 0)
+            break;
 
-                /* Calculate indexes of blocks. */
-                int indir_idx = sector_ofs / TOTAL_SECTOR_COUNT;
-                int double_indir_idx = sector_ofs % TOTAL_SECTOR_COUNT;
+        for (i = 0; i < cnt; ) {
+            /* Extend the run while the next sector follows on disk, or
+               while the holes continue. */
+            size_t run = 1;
+            if (sectors[i] == 0) {
+                while (i + run < cnt && sectors[i + run] == 0)
+                    run++;
+            }
+            else {
+                while (i + run < cnt && sectors[i + run] == sectors[i] + run)
+                    run++;
+            }
 
-                /* Read double indirect block from cache. */
+            off_t chunk_size = run * BLOCK_SECTOR_SIZE - sector_ofs;
+            if (chunk_size > size)
+                chunk_size = size;
+
+            if (sectors[i] == 0) {
+                off_t hole_done = inode_transfer_holes(inode, first + i,
+                                                       sector_ofs,
+                                                       buffer + bytes_done,
+                                                       chunk_size, write,
+                                                       delayed);
+                if (hole_done < chunk_size)
+                    return bytes_done + hole_done;
+            }
+            else if (write)
+                write_cache_range(sectors[i], sector_ofs,
+                                  buffer + bytes_done, chunk_size,
+                                  data_class(inode));
+            else
+                read_cache_range(sectors[i], sector_ofs,
+                                 buffer + bytes_done, chunk_size,
+                                 data_class(inode));
+
+            /* Advance. */
+            size -= chunk_size;
+            offset += chunk_size;
+            bytes_done += chunk_size;
+            sector_ofs = 0;
+            i += run;
+        }
+    }
 
-                struct indirect_block *double_indirect = indirect_inode_new();
-                read_from_cache(disk.double_indirect_block, double_indirect);
+    return bytes_done;
+}
 
-                /* Read appropriate block in double indirect from cache. */
-                block_sector_t indir_sector_idx =
-                    double_indirect->blocks[indir_idx];
-                read_from_cache(indir_sector_idx, indirect);
+/*! Returns the offset of the first byte at or after POS in INODE that lies
+    in a sector holding data, if DATA, or in a hole otherwise.  Returns the
+    length of INODE if there is no such byte before the end of file. */
+static off_t inode_seek_sector(struct inode *inode, off_t pos, bool data) {
+    block_sector_t sectors[INODE_MAP_BATCH];
+    off_t length = inode->data.length;
+
+    inode_flush(inode);
+    while (pos < length) {
+        size_t first = pos / BLOCK_SECTOR_SIZE;
+        size_t cnt = bytes_to_sectors(length) - first;
+        size_t i;
+
+        if (cnt > INODE_MAP_BATCH)
+            cnt = INODE_MAP_BATCH;
+        cnt = inode_map(&inode->data, inode->sector, first, sectors, cnt,
+                        MAP_LOOKUP);
+        if (cnt == 0)
+            break;
 
-                /* Get sector. */
-                sector_idx = indirect->blocks[double_indir_idx];
-                free(indirect);
-                free(double_indirect);
-                return sector_idx;
+        for (i = 0; i < cnt; i++) {
+            if ((sectors[i] != 0) == data) {
+                off_t start = (first + i) * BLOCK_SECTOR_SIZE;
+                return start > pos ? start : pos;
             }
         }
+        pos = (first + cnt) * BLOCK_SECTOR_SIZE;
     }
-    else {
-        /* Invalid position. */
-        return -1;
-    }
+    return length;
+}
 
+/*! Returns the end of the SIZE bytes at OFFSET, which must be less than
+    INODE_MAX_LENGTH, without running past INODE_MAX_LENGTH. */
+static off_t range_end(off_t offset, off_t size) {
+    ASSERT(offset >= 0 && offset < INODE_MAX_LENGTH);
+    return size < INODE_MAX_LENGTH - offset ? offset + size : INODE_MAX_LENGTH;
 }
 
-/*! List of open inodes, so that opening a single inode twice
+/*! Open inodes, hashed by sector, so that opening a single inode twice
     returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/*! Hashes an inode by sector. */
+static unsigned inode_hash(const struct hash_elem *e, void *aux UNUSED) {
+    return hash_int(hash_entry(e, struct inode, elem)->sector);
+}
+
+/*! Orders inodes by sector. */
+static bool inode_less(const struct hash_elem *a, const struct hash_elem *b,
+                       void *aux UNUSED) {
+    return (hash_entry(a, struct inode, elem)->sector <
+            hash_entry(b, struct inode, elem)->sector);
+}
 
 /*! Initializes the inode module. */
 void inode_init(void) {
-    list_init(&open_inodes);
+    hash_init(&open_inodes, inode_hash, inode_less, NULL);
+    lock_init(&open_inodes_lock);
 }
 
-/*! Initializes an inode with LENGTH bytes of data and
-    writes the new inode to sector SECTOR on the file system
-    device.
+/*! Writes a new inode with LENGTH bytes of data to SECTOR on the file
+    system device.  If ALLOCATE, every sector of data is allocated and
+    zeroed now; otherwise the data starts out as one hole.
     Returns true if successful.
     Returns false if memory or disk allocation fails. */
-bool inode_create(block_sector_t sector, off_t length) {
+static bool inode_make(block_sector_t sector, off_t length, bool allocate) {
     struct inode_disk *disk_inode = NULL;
     bool success = false;
 
@@ -402,57 +631,120 @@ bool inode_create(block_sector_t sector, off_t length) {
        one sector in size, and you should fix that. */
     ASSERT(sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+    if (length > INODE_MAX_LENGTH)
+        return false;
+
     disk_inode = calloc(1, sizeof *disk_inode);
     if (disk_inode != NULL) {
+        journal_begin();
+        block_sector_t sectors[INODE_MAP_BATCH];
+        size_t sector_cnt = bytes_to_sectors(length);
+        size_t first, cnt;
+
         disk_inode->length = length;
         disk_inode->magic = INODE_MAGIC;
-        if (inode_allocate_free_map(disk_inode)) {
-            write_to_cache(sector, disk_inode);
-            success = true;
+        success = true;
+        for (first = 0; allocate && first < sector_cnt; first += cnt) {
+            cnt = sector_cnt - first;
+            if (cnt > INODE_MAP_BATCH)
+                cnt = INODE_MAP_BATCH;
+            if (inode_map(disk_inode, sector, first, sectors, cnt,
+                          MAP_ALLOCATE)
+                != cnt) {
+                inode_release_free_map(disk_inode);
+                success = false;
+                break;
+            }
         }
+        if (success)
+            write_to_cache(sector, disk_inode, CACHE_META);
+        journal_end();
         free(disk_inode);
     }
     return success;
 }
 
+/*! Initializes an inode with LENGTH bytes of data and
+    writes the new inode to sector SECTOR on the file system
+    device.  The data is a hole that reads as zeros; sectors are only
+    allocated as they are written.
+    Returns true if successful.
+    Returns false if memory or disk allocation fails. */
+bool inode_create(block_sector_t sector, off_t length) {
+    return inode_make(sector, length, false);
+}
+
+/*! Like inode_create(), but allocates every sector of data up front, so
+    that writes within LENGTH never need to allocate.  The free map's own
+    file is created this way, since it is written while allocating. */
+bool inode_create_allocated(block_sector_t sector, off_t length) {
+    return inode_make(sector, length, true);
+}
+
+/*! Returns true if the inode in SECTOR is laid out as this kernel lays
+    out inodes. */
+bool inode_format_ok(block_sector_t sector) {
+    struct inode_disk *disk = malloc(sizeof *disk);
+    bool ok;
+
+    if (disk == NULL)
+        return false;
+    read_from_cache(sector, disk, CACHE_META);
+    ok = disk->magic == INODE_MAGIC;
+    free(disk);
+    return ok;
+}
+
 /*! Reads an inode from SECTOR
     and returns a `struct inode' that contains it.
     Returns a null pointer if memory allocation fails. */
 struct inode * inode_open(block_sector_t sector) {
-    struct list_elem *e;
+    struct inode key;
+    struct hash_elem *e;
     struct inode *inode;
 
     /* Check whether this inode is already open. */
-    for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
-         e = list_next(e)) {
-        inode = list_entry(e, struct inode, elem);
-        if (inode->sector == sector) {
-            inode_reopen(inode);
-            return inode;
-        }
+    lock_acquire(&open_inodes_lock);
+    key.sector = sector;
+    e = hash_find(&open_inodes, &key.elem);
+    if (e != NULL) {
+        inode = hash_entry(e, struct inode, elem);
+        inode->open_cnt++;
+        lock_release(&open_inodes_lock);
+        return inode;
     }
 
     /* Allocate memory. */
     inode = malloc(sizeof *inode);
-    if (inode == NULL)
+    if (inode == NULL) {
+        lock_release(&open_inodes_lock);
         return NULL;
+    }
 
     /* Initialize. */
-    list_push_front(&open_inodes, &inode->elem);
     inode->sector = sector;
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
+    inode->generation = 0;
+    inode->delayed_cnt = 0;
     inode->removed = false;
-    inode->is_dir = false; // fix this?
     inode->in_use = 0; // only increment when corresponding file/dir is opened
     lock_init(&inode->node_lock);
+    range_lock_init(&inode->ranges);
+    read_from_cache(sector, &inode->data, CACHE_META);
+    inode->is_dir = inode->data.is_dir != 0;
+    hash_insert(&open_inodes, &inode->elem);
+    lock_release(&open_inodes_lock);
     return inode;
 }
 
 /*! Reopens and returns INODE. */
 struct inode * inode_reopen(struct inode *inode) {
-    if (inode != NULL)
+    if (inode != NULL) {
+        lock_acquire(&open_inodes_lock);
         inode->open_cnt++;
+        lock_release(&open_inodes_lock);
+    }
     return inode;
 }
 
@@ -461,6 +753,12 @@ block_sector_t inode_get_inumber(const struct inode *inode) {
     return inode->sector;
 }
 
+/*! Returns INODE's write generation, which changes whenever its data does.
+    Only meaningful while INODE is held open. */
+unsigned inode_generation(const struct inode *inode) {
+    return inode->generation;
+}
+
 /*! Closes INODE and writes it to disk.
     If this was the last reference to INODE, frees its memory.
     If INODE was also a removed inode, frees its blocks. */
@@ -469,19 +767,37 @@ void inode_close(struct inode *inode) {
     if (inode == NULL)
         return;
 
-    struct inode_disk disk;
-    read_from_cache(inode->sector, &disk);
+    /* Before the last opener lets go, give the delayed blocks sectors
+       while the inode can still be found, so that an inode_open() in the
+       meantime shares this inode instead of reading a stale one from
+       disk.  Another opener may come and write more meanwhile. */
+    lock_acquire(&open_inodes_lock);
+    while (inode->open_cnt == 1 && inode->in_use == 0 && !inode->removed
+           && inode->delayed_cnt > 0) {
+        lock_release(&open_inodes_lock);
+        inode_flush(inode);
+        lock_acquire(&open_inodes_lock);
+    }
 
     /* Release resources if this was the last opener. */
-    if (--inode->open_cnt == 0 && inode->in_use == 0) {
+    bool last = --inode->open_cnt == 0 && inode->in_use == 0;
+    if (last) {
         /* Remove from inode list and release lock. */
-        list_remove(&inode->elem);
+        hash_delete(&open_inodes, &inode->elem);
+    }
+    lock_release(&open_inodes_lock);
 
-        /* Deallocate blocks if removed. */
+    if (last) {
+        /* Deallocate blocks if removed.  Delayed blocks of a removed file
+           never need sectors at all. */
         if (inode->removed) {
+            journal_begin();
+            free_map_unreserve(cache_delayed_discard(inode));
             free_map_release(inode->sector, 1);
-            inode_release_free_map(&disk);
+            inode_release_free_map(&inode->data);
+            journal_end();
         }
+        ASSERT(inode->delayed_cnt == 0 || inode->removed);
 
         free(inode);
     }
@@ -494,45 +810,69 @@ void inode_remove(struct inode *inode) {
     inode->removed = true;
 }
 
+/*! Grows INODE to at least LENGTH bytes.  The new bytes are a hole, so
+    only the length changes.  Returns false if LENGTH is more than an inode
+    can address. */
+static bool inode_extend(struct inode *inode, off_t length) {
+    if (length < 0 || length > INODE_MAX_LENGTH)
+        return false;
+
+    if (inode->data.length < length) {
+        /* Use double check locking. */
+        extension_lock_acquire(inode);
+        if (((volatile struct inode *) inode)->data.length < length) {
+            inode->data.length = length;
+            write_to_cache(inode->sector, &inode->data, CACHE_META);
+        }
+        extension_lock_release(inode);
+    }
+    return true;
+}
+
+/*! Shrinks INODE back from LENGTH to END, or to OLD_LENGTH if that is
+    larger, after a write that grew the file from OLD_LENGTH to LENGTH
+    stopped at END because the disk filled up.  Does nothing if the length
+    has changed since. */
+static void inode_trim(struct inode *inode, off_t old_length, off_t length,
+                       off_t end) {
+    if (end < old_length)
+        end = old_length;
+    if (end >= length)
+        return;
+
+    extension_lock_acquire(inode);
+    if (inode->data.length == length) {
+        inode->data.length = end;
+        write_to_cache(inode->sector, &inode->data, CACHE_META);
+    }
+    extension_lock_release(inode);
+}
+
 /*! Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset) {
     uint8_t *buffer = buffer_;
+    struct range range;
     off_t bytes_read = 0;
 
-    struct inode_disk disk;
-    read_from_cache(inode->sector, &disk);
-
-    /* If offset goes past EOF, return 0 */
-    if (offset > disk.length) {
-        return bytes_read;
+    /* If offset is at or past EOF, return 0 */
+    if (offset >= inode->data.length || size <= 0) {
+        return 0;
     }
 
-    while (size > 0) {
-        /* Disk sector to read, starting byte offset within sector. */
-        block_sector_t sector_idx = byte_to_sector (inode, offset);
-        int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-        /* Bytes left in inode, bytes left in sector, lesser of the two. */
-        off_t inode_left = inode_length(inode) - offset;
-        int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-        int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-        /* Number of bytes to actually copy out of this sector. */
-        int chunk_size = size < min_left ? size : min_left;
-        if (chunk_size <= 0)
-            break;
-
-        read_cache_offset(sector_idx, buffer + bytes_read, sector_ofs,
-                chunk_size);
-
-        /* Advance. */
-        size -= chunk_size;
-        offset += chunk_size;
-        bytes_read += chunk_size;
+    /* Wait out overlapping writes, then take the length once for the
+       whole call. */
+    range_lock_acquire(&inode->ranges, &range, offset,
+                       range_end(offset, size), false);
+    off_t length = inode->data.length;
+    barrier();
+    if (offset < length) {
+        if (size > length - offset)
+            size = length - offset;
+        bytes_read = inode_transfer(inode, buffer, size, offset, false);
     }
-
+    range_lock_release(&inode->ranges, &range);
     return bytes_read;
 }
 
@@ -542,58 +882,282 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
     A write at end of file will extend the inode. */
 
 off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offset) {
-    const uint8_t *buffer = buffer_;
+    uint8_t *buffer = (uint8_t *) buffer_;
+    struct range range;
     off_t bytes_written = 0;
 
-    if (inode->deny_write_cnt)
+    if (inode->deny_write_cnt || size <= 0 || offset >= INODE_MAX_LENGTH)
         return 0;
+    inode->generation++;
 
-    struct inode_disk disk;
-    read_from_cache(inode->sector, &disk);
+    /* Writes to disjoint ranges run at the same time; overlapping ones
+       wait their turn. */
+    journal_begin();
+    range_lock_acquire(&inode->ranges, &range, offset,
+                       range_end(offset, size), true);
+    off_t old_length = inode->data.length;
 
     /* If I write past EOF, expand file */
-    if (disk.length < offset + size) {
-        /* Use double check locking. */
-        extension_lock_acquire(inode);
-        if (((volatile int) disk.length) < offset + size) {
-            /* Expand the file */
-            disk.length = size + offset;
-            if (!inode_allocate_free_map(&disk)) {
-                extension_lock_release(inode);
-                return bytes_written;
-            }
+    if (inode_extend(inode, range_end(offset, size))) {
+        /* Take the length once, after any growth. */
+        off_t length = inode->data.length;
+        barrier();
+        if (size > length - offset)
+            size = length - offset;
+
+        bytes_written = inode_transfer(inode, buffer, size, offset, true);
+        if (bytes_written < size)
+            inode_trim(inode, old_length, length, offset + bytes_written);
+    }
+    range_lock_release(&inode->ranges, &range);
+    journal_end();
+    return bytes_written;
+}
+
+/*! Does the work of inode_copy_at() once its ranges are locked and SIZE
+    is known to be positive and within SRC. */
+static off_t inode_copy_sectors(struct inode *dst, off_t dst_ofs,
+                                struct inode *src, off_t src_ofs,
+                                off_t size) {
+    static char zeros[BLOCK_SECTOR_SIZE];
+    off_t bytes_copied = 0;
+    off_t old_length = dst->data.length;
+
+    /* Copy sector to sector, so nothing may wait in the cache. */
+    inode_flush(src);
+    inode_flush(dst);
+    if (!inode_extend(dst, dst_ofs + size))
+        return 0;
 
-            /* Editted inode, write back to sector */
-            write_to_cache(inode->sector, &disk);
+    while (size > 0) {
+        block_sector_t src_sector = byte_to_sector(src, src_ofs);
+        block_sector_t dst_sector = byte_to_sector(dst, dst_ofs);
+        int src_sector_ofs = src_ofs % BLOCK_SECTOR_SIZE;
+        int dst_sector_ofs = dst_ofs % BLOCK_SECTOR_SIZE;
+
+        /* Stop at the end of whichever sector ends first. */
+        int chunk_size = BLOCK_SECTOR_SIZE - src_sector_ofs;
+        if (BLOCK_SECTOR_SIZE - dst_sector_ofs < chunk_size)
+            chunk_size = BLOCK_SECTOR_SIZE - dst_sector_ofs;
+        if (size < chunk_size)
+            chunk_size = size;
+
+        if (src_sector == 0) {
+            /* A hole reads as zeros, which a hole in DST already holds. */
+            if (dst_sector != 0)
+                write_cache_offset(dst_sector, zeros, dst_sector_ofs,
+                                   chunk_size, data_class(dst));
         }
-        extension_lock_release(inode);
+        else {
+            if (dst_sector == 0) {
+                dst_sector = byte_to_sector_alloc(dst, dst_ofs);
+                if (dst_sector == 0) {
+                    inode_trim(dst, old_length, inode_length(dst), dst_ofs);
+                    break;
+                }
+            }
+            copy_cache_offset(dst_sector, dst_sector_ofs, src_sector,
+                              src_sector_ofs, chunk_size);
+        }
+
+        /* Advance. */
+        size -= chunk_size;
+        src_ofs += chunk_size;
+        dst_ofs += chunk_size;
+        bytes_copied += chunk_size;
     }
 
-    while (size > 0) {
-        /* Sector to write, starting byte offset within sector. */
-        block_sector_t sector_idx = byte_to_sector(inode, offset);
-        int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+    return bytes_copied;
+}
+
+/*! Copies SIZE bytes of SRC starting at SRC_OFS into DST starting at
+    DST_OFS as one journal operation, once both ranges are locked.  SIZE
+    must be positive, and the ranges must not overlap if DST is SRC. */
+static off_t inode_copy_piece(struct inode *dst, off_t dst_ofs,
+                              struct inode *src, off_t src_ofs, off_t size) {
+    struct range src_range, dst_range;
+    off_t bytes_copied = 0;
+
+    /* Take the two ranges in a fixed order, by inode and then by offset,
+       so that two copies never each hold a range the other waits for. */
+    journal_begin();
+    off_t src_end = range_end(src_ofs, size);
+    off_t dst_end = range_end(dst_ofs, size);
+    bool src_first = src == dst ? src_ofs < dst_ofs : src->sector < dst->sector;
+    if (src_first)
+        range_lock_acquire(&src->ranges, &src_range, src_ofs, src_end, false);
+    range_lock_acquire(&dst->ranges, &dst_range, dst_ofs, dst_end, true);
+    if (!src_first)
+        range_lock_acquire(&src->ranges, &src_range, src_ofs, src_end, false);
+
+    off_t src_left = inode_length(src) - src_ofs;
+    if (size > src_left)
+        size = src_left;
+    if (size > dst_end - dst_ofs)
+        size = dst_end - dst_ofs;
+    if (size > 0)
+        bytes_copied = inode_copy_sectors(dst, dst_ofs, src, src_ofs, size);
+
+    range_lock_release(&src->ranges, &src_range);
+    range_lock_release(&dst->ranges, &dst_range);
+    journal_end();
+    return bytes_copied;
+}
+
+/*! Copies SIZE bytes of SRC starting at SRC_OFS into DST starting at
+    DST_OFS, sector by sector through the buffer cache.  Returns the number
+    of bytes copied, which is less than SIZE if SRC ends first or DST
+    cannot grow.  The two ranges must not overlap if DST is SRC. */
+off_t inode_copy_at(struct inode *dst, off_t dst_ofs, struct inode *src,
+                    off_t src_ofs, off_t size) {
+    off_t bytes_copied = 0;
 
-        /* Bytes left in inode, bytes left in sector, lesser of the two. */
-        off_t inode_left = inode_length(inode) - offset;
-        int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-        int min_left = inode_left < sector_left ? inode_left : sector_left;
+    if (dst->deny_write_cnt || size <= 0 || src_ofs >= inode_length(src)
+        || dst_ofs >= INODE_MAX_LENGTH)
+        return 0;
 
-        /* Number of bytes to actually write into this sector. */
-        int chunk_size = size < min_left ? size : min_left;
-        if (chunk_size <= 0)
+    /* Lock no more of SRC than it holds.  Overlapping ranges of one file
+       cannot be copied; the write range would wait for the read range
+       held by the same thread. */
+    if (size > inode_length(src) - src_ofs)
+        size = inode_length(src) - src_ofs;
+    if (src == dst && src_ofs < range_end(dst_ofs, size)
+        && dst_ofs < range_end(src_ofs, size))
+        return 0;
+    dst->generation++;
+
+    /* Copy INODE_MAP_BATCH sectors at a time, each piece an operation of
+       its own, so that the indirect blocks a long copy allocates are not
+       all held for the journal at once. */
+    while (bytes_copied < size && dst_ofs + bytes_copied < INODE_MAX_LENGTH
+           && src_ofs + bytes_copied < inode_length(src)) {
+        off_t chunk = size - bytes_copied;
+        if (chunk > INODE_MAP_BATCH * BLOCK_SECTOR_SIZE)
+            chunk = INODE_MAP_BATCH * BLOCK_SECTOR_SIZE;
+
+        off_t done = inode_copy_piece(dst, dst_ofs + bytes_copied, src,
+                                      src_ofs + bytes_copied, chunk);
+        bytes_copied += done;
+        if (done < chunk)
             break;
+    }
+    return bytes_copied;
+}
 
-        write_cache_offset(sector_idx, buffer + bytes_written, sector_ofs,
-            chunk_size);
+/*! Replaces the contents of INODE by the SIZE bytes in BUFFER.  They are
+    written to newly allocated sectors as file data, which the journal
+    does not hold, however many there are, and reach the disk before
+    INODE is switched over to them, so that a crash leaves either the old
+    contents or the new.  Returns false if memory or disk allocation
+    fails, leaving INODE as it was. */
+bool inode_replace(struct inode *inode, const void *buffer_, off_t size) {
+    const uint8_t *buffer = buffer_;
+    block_sector_t sectors[INODE_MAP_BATCH];
+    size_t sector_cnt = bytes_to_sectors(size);
+    struct inode_disk *disk, *old;
+    block_sector_t disk_sector = 0;
+    struct range range;
+    size_t first, cnt, i;
+    bool success = true;
+
+    if (inode->deny_write_cnt || size < 0 || size > INODE_MAX_LENGTH)
+        return false;
+    disk = calloc(1, sizeof *disk);
+    old = malloc(sizeof *old);
+    if (disk == NULL || old == NULL) {
+        free(disk);
+        free(old);
+        return false;
+    }
 
-        /* Advance. */
-        size -= chunk_size;
-        offset += chunk_size;
-        bytes_written += chunk_size;
+    journal_begin();
+    range_lock_acquire(&inode->ranges, &range, 0, INODE_MAX_LENGTH, true);
+    inode->generation++;
+
+    /* Build the new layout in an inode of its own, which nothing points
+       to until it is complete. */
+    disk->length = size;
+    disk->is_dir = inode->data.is_dir;
+    disk->magic = INODE_MAGIC;
+    success = free_map_allocate(1, inode->sector, &disk_sector);
+    for (first = 0; success && first < sector_cnt; first += cnt) {
+        cnt = sector_cnt - first;
+        if (cnt > INODE_MAP_BATCH)
+            cnt = INODE_MAP_BATCH;
+        if (inode_map(disk, disk_sector, first, sectors, cnt, MAP_ALLOCATE)
+            != cnt) {
+            inode_release_free_map(disk);
+            success = false;
+            break;
+        }
+        for (i = 0; i < cnt; i++) {
+            off_t ofs = (first + i) * BLOCK_SECTOR_SIZE;
+            size_t bytes = size - ofs < BLOCK_SECTOR_SIZE ? size - ofs
+                                                          : BLOCK_SECTOR_SIZE;
+            write_cache_offset(sectors[i], buffer + ofs, 0, bytes,
+                               CACHE_DATA);
+        }
     }
 
-    return bytes_written;
+    if (success) {
+        write_all_dirty();
+
+        extension_lock_acquire(inode);
+        inode_flush_locked(inode);
+        *old = inode->data;
+        inode->data = *disk;
+        write_to_cache(inode->sector, &inode->data, CACHE_META);
+        extension_lock_release(inode);
+        inode_release_free_map(old);
+    }
+    if (disk_sector != 0)
+        free_map_release(disk_sector, 1);
+    range_lock_release(&inode->ranges, &range);
+    journal_end();
+
+    free(disk);
+    free(old);
+    return success;
+}
+
+/*! Gives every delayed block of every open inode a sector, so that the
+    cache can write it back. */
+void inode_flush_all(void) {
+    struct inode *inodes[CACHE_DELAYED_MAX];
+    struct hash_iterator i;
+    size_t cnt = 0, idx;
+
+    /* Hold each inode open while it is flushed.  No more inodes than
+       blocks can have delayed blocks. */
+    lock_acquire(&open_inodes_lock);
+    hash_first(&i, &open_inodes);
+    while (cnt < CACHE_DELAYED_MAX && hash_next(&i)) {
+        struct inode *inode = hash_entry(hash_cur(&i), struct inode, elem);
+        if (inode->delayed_cnt > 0) {
+            inode->open_cnt++;
+            inodes[cnt++] = inode;
+        }
+    }
+    lock_release(&open_inodes_lock);
+
+    for (idx = 0; idx < cnt; idx++) {
+        inode_flush(inodes[idx]);
+        inode_close(inodes[idx]);
+    }
+}
+
+/*! Returns the offset of the first byte at or after POS in INODE that
+    holds data, as opposed to lying in a hole, or INODE's length if there
+    is none.  Data is found a sector at a time, so the offset may be that
+    of zeros written explicitly. */
+off_t inode_next_data(struct inode *inode, off_t pos) {
+    return inode_seek_sector(inode, pos, true);
+}
+
+/*! Returns the offset of the first byte at or after POS in INODE that lies
+    in a hole, counting the end of file as one. */
+off_t inode_next_hole(struct inode *inode, off_t pos) {
+    return inode_seek_sector(inode, pos, false);
 }
 
 /*! Disables writes to INODE.
@@ -614,9 +1178,7 @@ void inode_allow_write (struct inode *inode) {
 
 /*! Returns the length, in bytes, of INODE's data. */
 off_t inode_length(const struct inode *inode) {
-    struct inode_disk disk;
-    read_from_cache(inode->sector, &disk);
-    return disk.length;
+    return inode->data.length;
 }
 
 #ifdef CACHE
@@ -634,9 +1196,20 @@ bool is_dir(const struct inode *inode) {
     return inode->is_dir;
 }
 
-/* Sets inode's is_dir flag to specified bool. */
+/* Sets inode's is_dir flag to specified bool.  The flag is kept in the
+   on-disk inode too, so a reopened directory still has its blocks cached
+   as metadata. */
 void set_dir(struct inode *inode, bool is_dir) {
     inode->is_dir = is_dir;
+    if ((inode->data.is_dir != 0) == is_dir)
+        return;
+
+    journal_begin();
+    extension_lock_acquire(inode);
+    inode->data.is_dir = is_dir;
+    write_to_cache(inode->sector, &inode->data, CACHE_META);
+    extension_lock_release(inode);
+    journal_end();
 }
 
 /* Returns number of times inode has been opened as a file/dir. */
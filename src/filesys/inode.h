@@ -6,26 +6,35 @@
 #include "filesys/off_t.h"
 #include "filesys/file.h"
 
-/* Each inode_disk will have 124 direct, 1 indirect, and 1 double indirect
- * 124 direct indices + 128 indirect indices + 128 ^ 2 double indirect indices
- * = 16636 indices > 16384 */
-#define DIRECT_BLOCK_COUNT 124
+/* Each inode_disk will have 123 direct, 1 indirect, and 1 double indirect
+ * 123 direct indices + 128 indirect indices + 128 ^ 2 double indirect indices
+ * = 16635 indices > 16384 */
+#define DIRECT_BLOCK_COUNT 123
 #define TOTAL_SECTOR_COUNT 128
 
 struct bitmap;
 
 void inode_init(void);
 bool inode_create(block_sector_t, off_t);
+bool inode_create_allocated(block_sector_t, off_t);
+bool inode_format_ok(block_sector_t);
 struct inode *inode_open(block_sector_t);
 struct inode *inode_reopen(struct inode *);
 block_sector_t inode_get_inumber(const struct inode *);
+unsigned inode_generation(const struct inode *);
 void inode_close(struct inode *);
 void inode_remove(struct inode *);
 off_t inode_read_at(struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at(struct inode *, const void *, off_t size, off_t offset);
+bool inode_replace(struct inode *, const void *, off_t);
+off_t inode_copy_at(struct inode *dst, off_t dst_ofs, struct inode *src,
+                    off_t src_ofs, off_t size);
 void inode_deny_write(struct inode *);
 void inode_allow_write(struct inode *);
 off_t inode_length(const struct inode *);
+off_t inode_next_data(struct inode *, off_t pos);
+off_t inode_next_hole(struct inode *, off_t pos);
+void inode_flush_all(void);
 
 #ifdef CACHE
 bool inode_is_removed(const struct inode *inode);
@@ -0,0 +1,417 @@
+/*! \file journal.c
+ *
+ * Write-ahead journal of file system metadata.  A write to a sector of
+ * class CACHE_META holds that sector in the buffer cache, where neither
+ * eviction nor write-behind may write it back, until the journal has
+ * logged it.  Operations that change metadata bracket their writes with
+ * journal_begin() and journal_end().  Whenever none is in progress, every
+ * held sector is logged as one transaction in a circular log that follows
+ * JOURNAL_SECTOR: a descriptor listing the sectors' home locations, their
+ * contents, and a commit record, written one after another.  A commit
+ * thread does this every COMMIT_TICKS, so the operations of those ticks
+ * share one sequential write; if too many sectors are held, the last
+ * operation to end commits them at once instead.
+ *
+ * Held sectors cannot leave the cache, so their number is kept down: each
+ * operation in progress sets aside OP_RESERVE sectors, and an operation
+ * that would take the total past HELD_LIMIT waits, along with every one
+ * after it, for those in progress to end and be committed.  Operations
+ * that nest inside one already begun never wait.
+ *
+ * Logged sectors are ordinary dirty sectors again and reach their homes
+ * lazily.  Once the log runs short of room for another transaction it is
+ * checkpointed: the cache is written back and the log emptied.  At mount,
+ * the committed transactions still in the log are replayed to their homes.
+ *
+ * Replay writes sectors as they were when logged, so a freed sector that
+ * the log holds a copy of must not be reused before the next checkpoint;
+ * free_map_release() holds such sectors back.  File data is not logged.
+ */
+
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Identify the header, descriptors and commit records. */
+#define JOURNAL_MAGIC 0x4a524e4c
+#define DESC_MAGIC 0x4a444553
+#define COMMIT_MAGIC 0x4a434d54
+
+/* Layout of the journal, and of the sectors it takes from the rest of
+   the file system.  Bumped whenever either changes. */
+#define JOURNAL_VERSION 1
+
+/* Most sectors one transaction logs: every slot of the cache. */
+#define TXN_MAX MAX_BUFFER_SIZE
+
+/* Most log sectors one transaction takes, with its descriptor and commit
+   record. */
+#define TXN_SECTORS (TXN_MAX + 2)
+
+/* Ticks between commits. */
+#define COMMIT_TICKS 5
+
+/* Held sectors past which the last operation to end commits them. */
+#define HELD_MAX (MAX_BUFFER_SIZE / 4)
+
+/* Sectors set aside for each operation in progress: its inode, indirect
+   blocks, directory sectors and the free map. */
+#define OP_RESERVE 8
+
+/* Most sectors that may be held or set aside.  The rest of the cache is
+   left for delayed blocks and for sectors pinned while in use. */
+#define HELD_LIMIT (MAX_BUFFER_SIZE - CACHE_DELAYED_MAX - OP_RESERVE)
+
+/*! On-disk journal header, at JOURNAL_SECTOR.
+    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header {
+    uint32_t magic;                     /*!< JOURNAL_MAGIC. */
+    uint32_t seq;                       /*!< Sequence number of the oldest
+                                             transaction in the log. */
+    uint32_t start;                     /*!< Log position of that
+                                             transaction. */
+    uint32_t version;                   /*!< JOURNAL_VERSION. */
+    uint32_t unused[124];               /*!< Not used. */
+};
+
+/*! Starts a transaction in the log.  The CNT sectors it logs follow,
+    then a commit record.  Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_desc {
+    uint32_t magic;                     /*!< DESC_MAGIC. */
+    uint32_t seq;                       /*!< Sequence number. */
+    uint32_t cnt;                       /*!< Number of sectors logged. */
+    block_sector_t sectors[125];        /*!< Home of each sector logged. */
+};
+
+/*! Ends a transaction.  A transaction without one is not replayed.
+    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_commit {
+    uint32_t magic;                     /*!< COMMIT_MAGIC. */
+    uint32_t seq;                       /*!< Sequence number. */
+    uint32_t cnt;                       /*!< Number of sectors logged. */
+    uint32_t unused[125];               /*!< Not used. */
+};
+
+static struct lock journal_lock;        /*!< Guards the members below. */
+static struct condition journal_idle;   /*!< Signaled when no operation is
+                                             in progress. */
+static int active_cnt;                  /*!< Operations in progress. */
+static bool draining;                   /*!< New operations wait for those
+                                             in progress to be committed. */
+static uint32_t start_seq;              /*!< Sequence number of the oldest
+                                             transaction in the log. */
+static uint32_t next_seq;               /*!< Sequence number of the next. */
+static uint32_t log_start;              /*!< Log position of the oldest. */
+static uint32_t log_used;               /*!< Log sectors in use. */
+static struct bitmap *logged;           /*!< Sectors copied into the log. */
+static bool checkpointed;               /*!< Checkpointed since the frees
+                                             held back were released. */
+
+/* The transaction being logged. */
+static block_sector_t txn_sectors[TXN_MAX];
+static uint8_t (*txn_data)[BLOCK_SECTOR_SIZE];
+static struct journal_desc desc;
+static struct journal_commit commit;
+
+static void journal_format(void);
+static void journal_recover(void);
+static void journal_daemon(void *aux UNUSED);
+static void commit_locked(void);
+static void checkpoint_locked(void);
+static void checkpoint(void);
+
+/*! Reads the sector at log position POS into BUFFER. */
+static void log_read(uint32_t pos, void *buffer) {
+    block_read(fs_device, JOURNAL_SECTOR + 1 + pos % JOURNAL_SECTORS, buffer);
+}
+
+/*! Writes BUFFER to the sector at log position POS. */
+static void log_write(uint32_t pos, const void *buffer) {
+    block_write(fs_device, JOURNAL_SECTOR + 1 + pos % JOURNAL_SECTORS,
+                buffer);
+}
+
+/*! Writes out the header, which marks where the log starts. */
+static void write_header(void) {
+    static struct journal_header header;
+
+    memset(&header, 0, sizeof header);
+    header.magic = JOURNAL_MAGIC;
+    header.seq = start_seq;
+    header.start = log_start;
+    header.version = JOURNAL_VERSION;
+    block_write(fs_device, JOURNAL_SECTOR, &header);
+}
+
+/*! Initializes the journal.  If FORMAT, starts an empty log; otherwise
+    replays the log left by the last mount.  Must be called before the
+    file system is used. */
+void journal_init(bool format) {
+    ASSERT(sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+    ASSERT(sizeof (struct journal_desc) == BLOCK_SECTOR_SIZE);
+    ASSERT(sizeof (struct journal_commit) == BLOCK_SECTOR_SIZE);
+
+    lock_init(&journal_lock);
+    cond_init(&journal_idle);
+    active_cnt = 0;
+    draining = false;
+    checkpointed = false;
+    logged = bitmap_create(block_size(fs_device));
+    txn_data = malloc(TXN_MAX * BLOCK_SECTOR_SIZE);
+    if (logged == NULL || txn_data == NULL)
+        PANIC("not enough memory for the journal");
+
+    if (format)
+        journal_format();
+    else
+        journal_recover();
+
+    thread_create("journal", PRI_DEFAULT, journal_daemon, NULL);
+}
+
+/*! Commits and checkpoints everything, leaving the log empty for the next
+    mount. */
+void journal_done(void) {
+    checkpoint();
+
+    /* Releasing the frees held back writes the free map once more. */
+    free_map_release_deferred();
+    checkpoint();
+}
+
+/*! Returns true if the cache has room for one more operation's
+    writes. */
+static bool op_fits(void) {
+    return (cache_journal_held_cnt() + (active_cnt + 1) * OP_RESERVE
+            <= HELD_LIMIT);
+}
+
+/*! Starts an operation whose metadata writes must be logged together.
+    Operations may nest.  An operation that does not nest in another waits
+    while too many sectors are held; the caller must not hold a lock that
+    an operation in progress may need. */
+void journal_begin(void) {
+    struct thread *cur = thread_current();
+
+    lock_acquire(&journal_lock);
+    if (cur->journal_depth++ == 0) {
+        while (draining || !op_fits()) {
+            if (active_cnt == 0) {
+                commit_locked();
+                draining = false;
+            }
+            else {
+                draining = true;
+                cond_wait(&journal_idle, &journal_lock);
+            }
+        }
+        active_cnt++;
+    }
+    lock_release(&journal_lock);
+}
+
+/*! Ends an operation started by journal_begin().  If it was the last in
+    progress and many sectors are held, or operations are waiting for room,
+    logs them now. */
+void journal_end(void) {
+    struct thread *cur = thread_current();
+
+    lock_acquire(&journal_lock);
+    ASSERT(cur->journal_depth > 0);
+    if (--cur->journal_depth == 0) {
+        ASSERT(active_cnt > 0);
+        if (--active_cnt == 0) {
+            if (draining || cache_journal_held_cnt() >= HELD_MAX)
+                commit_locked();
+            draining = false;
+            cond_broadcast(&journal_idle, &journal_lock);
+        }
+    }
+    lock_release(&journal_lock);
+}
+
+/*! Waits until no operation is in progress, then logs every held sector.
+    Lets go of the frees held back if the log has been checkpointed. */
+void journal_commit(void) {
+    bool release;
+
+    lock_acquire(&journal_lock);
+    while (active_cnt > 0)
+        cond_wait(&journal_idle, &journal_lock);
+    commit_locked();
+    release = checkpointed;
+    checkpointed = false;
+    lock_release(&journal_lock);
+
+    if (release)
+        free_map_release_deferred();
+}
+
+/*! Returns true if the log holds, or is about to hold, a copy of SECTOR. */
+bool journal_logged(block_sector_t sector) {
+    bool copied;
+
+    lock_acquire(&journal_lock);
+    copied = bitmap_test(logged, sector) || cache_journal_held(sector);
+    lock_release(&journal_lock);
+    return copied;
+}
+
+/*! Starts an empty log.  Sequence numbers carry on from the journal on
+    the disk, if any, so that nothing it left in the log can pass for part
+    of the new one; otherwise the log is zeroed. */
+static void journal_format(void) {
+    static struct journal_header header;
+
+    block_read(fs_device, JOURNAL_SECTOR, &header);
+    if (header.magic == JOURNAL_MAGIC) {
+        next_seq = header.seq + JOURNAL_SECTORS;
+    }
+    else {
+        static char zeros[BLOCK_SECTOR_SIZE];
+        uint32_t pos;
+
+        for (pos = 0; pos < JOURNAL_SECTORS; pos++)
+            log_write(pos, zeros);
+        next_seq = 1;
+    }
+    start_seq = next_seq;
+    log_start = log_used = 0;
+    write_header();
+}
+
+/*! Replays each committed transaction in the log, oldest first, to the
+    home sectors it logged, then empties the log. */
+static void journal_recover(void) {
+    static struct journal_header header;
+    block_sector_t sector_cnt = block_size(fs_device);
+    int replayed = 0;
+
+    block_read(fs_device, JOURNAL_SECTOR, &header);
+    /* Disks made before the journal keep other data in its sectors. */
+    if (header.magic != JOURNAL_MAGIC)
+        PANIC("file system is in an older format without a journal; "
+              "reformat it");
+    if (header.version != JOURNAL_VERSION)
+        PANIC("file system journal is version %"PRIu32", not %d; "
+              "reformat it", header.version, JOURNAL_VERSION);
+    start_seq = next_seq = header.seq;
+    log_start = header.start % JOURNAL_SECTORS;
+    log_used = 0;
+
+    for (;;) {
+        uint32_t pos = log_start + log_used;
+        uint32_t i;
+
+        log_read(pos, &desc);
+        if (desc.magic != DESC_MAGIC || desc.seq != next_seq
+            || desc.cnt > TXN_MAX || log_used + desc.cnt + 2 > JOURNAL_SECTORS)
+            break;
+        log_read(pos + 1 + desc.cnt, &commit);
+        if (commit.magic != COMMIT_MAGIC || commit.seq != next_seq
+            || commit.cnt != desc.cnt)
+            break;
+
+        for (i = 0; i < desc.cnt; i++) {
+            if (desc.sectors[i] >= sector_cnt)
+                PANIC("journal names sector %"PRDSNu" past end of disk",
+                      desc.sectors[i]);
+            log_read(pos + 1 + i, txn_data[0]);
+            block_write(fs_device, desc.sectors[i], txn_data[0]);
+        }
+        log_used += desc.cnt + 2;
+        next_seq++;
+        replayed++;
+    }
+    if (replayed > 0)
+        printf("Replayed %d journal transactions.\n", replayed);
+
+    /* Everything logged is now home. */
+    log_start = (log_start + log_used) % JOURNAL_SECTORS;
+    log_used = 0;
+    start_seq = next_seq;
+    write_header();
+}
+
+/*! Commits every few ticks until the file system shuts down. */
+static void journal_daemon(void *aux UNUSED) {
+    while (!filesys_done_wait) {
+        timer_sleep(COMMIT_TICKS);
+        journal_commit();
+    }
+}
+
+/*! Logs every held sector as one transaction.  The journal lock must be
+    held with no operation in progress, so that the transaction holds only
+    whole operations. */
+static void commit_locked(void) {
+    size_t cnt = cache_journal_collect(txn_sectors, txn_data);
+    uint32_t pos = log_start + log_used;
+    size_t i;
+
+    ASSERT(active_cnt == 0);
+    if (cnt == 0)
+        return;
+    ASSERT(log_used + cnt + 2 <= JOURNAL_SECTORS);
+
+    memset(&desc, 0, sizeof desc);
+    desc.magic = DESC_MAGIC;
+    desc.seq = next_seq;
+    desc.cnt = cnt;
+    memcpy(desc.sectors, txn_sectors, cnt * sizeof *txn_sectors);
+    log_write(pos, &desc);
+    for (i = 0; i < cnt; i++)
+        log_write(pos + 1 + i, txn_data[i]);
+
+    /* Only once the rest is on disk may the commit record be. */
+    memset(&commit, 0, sizeof commit);
+    commit.magic = COMMIT_MAGIC;
+    commit.seq = next_seq;
+    commit.cnt = cnt;
+    log_write(pos + 1 + cnt, &commit);
+
+    log_used += cnt + 2;
+    next_seq++;
+    for (i = 0; i < cnt; i++)
+        bitmap_mark(logged, txn_sectors[i]);
+    cache_journal_release();
+
+    /* Keep room for the largest transaction. */
+    if (JOURNAL_SECTORS - log_used < TXN_SECTORS)
+        checkpoint_locked();
+}
+
+/*! Writes every logged sector home and empties the log.  The journal lock
+    must be held with no operation in progress. */
+static void checkpoint_locked(void) {
+    write_all_dirty();
+    log_start = (log_start + log_used) % JOURNAL_SECTORS;
+    log_used = 0;
+    start_seq = next_seq;
+    write_header();
+    bitmap_set_all(logged, false);
+    checkpointed = true;
+}
+
+/*! Waits until no operation is in progress, then logs every held sector
+    and checkpoints. */
+static void checkpoint(void) {
+    lock_acquire(&journal_lock);
+    while (active_cnt > 0)
+        cond_wait(&journal_idle, &journal_lock);
+    commit_locked();
+    checkpoint_locked();
+    checkpointed = false;
+    lock_release(&journal_lock);
+}
@@ -0,0 +1,24 @@
+/*! \file journal.h
+ *
+ * Declarations for the write-ahead journal of file system metadata.
+ */
+
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/*! Sectors in the circular log, which follows JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 128
+
+void journal_init(bool format);
+void journal_done(void);
+
+void journal_begin(void);
+void journal_end(void);
+void journal_commit(void);
+
+bool journal_logged(block_sector_t sector);
+
+#endif /* filesys/journal.h */
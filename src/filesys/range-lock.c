@@ -0,0 +1,68 @@
+/*! \file range-lock.c
+ *
+ * Byte-range locks.  A thread locks the bytes of a file it is about to
+ * read or write, shared for reading and exclusive for writing, so that
+ * reads and writes of disjoint ranges proceed at the same time while
+ * overlapping writes happen one after another instead of tearing.
+ *
+ * Each range_lock keeps every range that is held or waited for on one
+ * list, in the order they were asked for.  A range is granted once no
+ * range ahead of it on the list conflicts with it, so conflicting ranges
+ * are granted first come, first served and a stream of readers cannot
+ * starve a writer.  Files are seldom locked by more than a few threads at
+ * once, so a list is searched rather than an interval tree.
+ */
+
+#include "filesys/range-lock.h"
+#include <debug.h>
+
+/*! Returns true if A and B overlap and at least one is a write. */
+static bool conflicts(const struct range *a, const struct range *b) {
+    return (a->write || b->write) && a->start < b->end && b->start < a->end;
+}
+
+/*! Returns true if no range ahead of R in RL conflicts with it. */
+static bool grantable(struct range_lock *rl, const struct range *r) {
+    struct list_elem *e;
+
+    for (e = list_begin(&rl->ranges); e != &r->elem; e = list_next(e)) {
+        if (conflicts(list_entry(e, struct range, elem), r)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*! Initializes RL with no ranges locked. */
+void range_lock_init(struct range_lock *rl) {
+    lock_init(&rl->lock);
+    cond_init(&rl->released);
+    list_init(&rl->ranges);
+}
+
+/*! Locks bytes START through END - 1 of RL's file using R, exclusively if
+    WRITE and shared otherwise, waiting for conflicting ranges asked for
+    earlier to be released. */
+void range_lock_acquire(struct range_lock *rl, struct range *r,
+                        off_t start, off_t end, bool write) {
+    ASSERT(start <= end);
+
+    r->start = start;
+    r->end = end;
+    r->write = write;
+
+    lock_acquire(&rl->lock);
+    list_push_back(&rl->ranges, &r->elem);
+    while (!grantable(rl, r)) {
+        cond_wait(&rl->released, &rl->lock);
+    }
+    lock_release(&rl->lock);
+}
+
+/*! Releases R, which must have been acquired on RL. */
+void range_lock_release(struct range_lock *rl, struct range *r) {
+    lock_acquire(&rl->lock);
+    list_remove(&r->elem);
+    cond_broadcast(&rl->released, &rl->lock);
+    lock_release(&rl->lock);
+}
@@ -0,0 +1,36 @@
+/*! \file range-lock.h
+ *
+ * Declarations for locks on byte ranges of a file.
+ */
+
+#ifndef FILESYS_RANGE_LOCK_H
+#define FILESYS_RANGE_LOCK_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+/*! Locks on byte ranges of one file. */
+struct range_lock {
+    struct lock lock;           /*!< Protects RANGES. */
+    struct condition released;  /*!< Signaled when a range is released. */
+    struct list ranges;         /*!< Held and waiting ranges, in arrival
+                                     order. */
+};
+
+/*! A byte range held, or waited for, by one thread.  Usually lives on the
+    holder's stack. */
+struct range {
+    struct list_elem elem;      /*!< Element in range_lock's RANGES. */
+    off_t start;                /*!< First byte. */
+    off_t end;                  /*!< One past the last byte. */
+    bool write;                 /*!< Exclusive if true, else shared. */
+};
+
+void range_lock_init(struct range_lock *);
+void range_lock_acquire(struct range_lock *, struct range *,
+                        off_t start, off_t end, bool write);
+void range_lock_release(struct range_lock *, struct range *);
+
+#endif /* filesys/range-lock.h */
@@ -34,8 +34,20 @@ enum {
     SYS_MKDIR,                  /*!< Create a directory. */
     SYS_READDIR,                /*!< Reads a directory entry. */
     SYS_ISDIR,                  /*!< Tests if a fd represents a directory. */
-    SYS_INUMBER                 /*!< Returns the inode number for a fd. */
+    SYS_INUMBER,                /*!< Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FEATURES,               /*!< Report optional kernel features. */
+    SYS_FORK,                   /*!< Duplicate the current process. */
+    SYS_COPY_FILE_RANGE,        /*!< Copy between files in the kernel. */
+    SYS_PIPE,                   /*!< Create a pipe. */
+    SYS_RING_ENTER,             /*!< Run a batch of queued calls. */
+    SYS_GETRUSAGE,              /*!< Report resources used. */
+    SYS_LSEEK                   /*!< Move a file position, or find data. */
 };
 
+/*! Bits returned by SYS_FEATURES. */
+#define SYSCALL_FEATURE_SYSENTER 0x1    /*!< SYSENTER may be used. */
+
 #endif /* lib/syscall-nr.h */
 
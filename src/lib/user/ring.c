@@ -0,0 +1,56 @@
+/*! \file ring.c
+ *
+ * Batched system calls.  Operations are queued on a struct ring in the
+ * process's own memory and handed to the kernel together by one
+ * ring_enter() call, which runs them in order and posts a completion for
+ * each.  A loop of small reads or writes thus costs one trap per batch
+ * instead of one per call.
+ */
+
+#include <ring.h>
+#include <string.h>
+#include <syscall.h>
+
+/*! Empties RING. */
+void ring_init(struct ring *ring) {
+    memset(ring, 0, sizeof *ring);
+}
+
+/*! Queues operation OP on RING, to be run by the next ring_submit().
+    FD, BUF and LEN are its arguments, as described for enum ring_op, and
+    USER_DATA is passed through to its completion.  Returns false if the
+    submission queue is full. */
+bool ring_queue(struct ring *ring, enum ring_op op, int fd, void *buf,
+                unsigned len, uint32_t user_data) {
+    struct ring_sqe *sqe;
+
+    if (ring->sq_tail - ring->sq_head == RING_ENTRIES) {
+        return false;
+    }
+    sqe = &ring->sq[ring->sq_tail % RING_ENTRIES];
+    sqe->op = op;
+    sqe->fd = fd;
+    sqe->buf = buf;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    ring->sq_tail++;
+    return true;
+}
+
+/*! Runs the operations queued on RING.  Returns the number run, which is
+    less than the number queued only if the completion queue filled up, or
+    -1 if RING is corrupt. */
+int ring_submit(struct ring *ring) {
+    return ring_enter(ring);
+}
+
+/*! Takes the oldest completion off RING and stores it in CQE.  Returns
+    false if there is none. */
+bool ring_reap(struct ring *ring, struct ring_cqe *cqe) {
+    if (ring->cq_head == ring->cq_tail) {
+        return false;
+    }
+    *cqe = ring->cq[ring->cq_head % RING_ENTRIES];
+    ring->cq_head++;
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef __LIB_USER_RING_H
+#define __LIB_USER_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*! Entries in each queue of a ring.  Must be a power of two. */
+#define RING_ENTRIES 64
+
+/*! Operations that can be queued on a ring. */
+enum ring_op {
+    RING_NOP,                   /*!< Does nothing; completes with 0. */
+    RING_READ,                  /*!< read(fd, buf, len). */
+    RING_WRITE,                 /*!< write(fd, buf, len). */
+    RING_SEEK,                  /*!< seek(fd, len); completes with 0. */
+    RING_OPEN,                  /*!< open(buf); FD is ignored. */
+    RING_CLOSE                  /*!< close(fd); completes with 0. */
+};
+
+/*! A submitted operation. */
+struct ring_sqe {
+    uint32_t op;                /*!< One of enum ring_op. */
+    int fd;                     /*!< File descriptor operated on. */
+    void *buf;                  /*!< Data buffer, or file name to open. */
+    unsigned len;               /*!< Byte count, or position to seek to. */
+    uint32_t user_data;         /*!< Copied to the completion as is. */
+};
+
+/*! A completed operation. */
+struct ring_cqe {
+    uint32_t user_data;         /*!< From the submission. */
+    int result;                 /*!< What the system call returned. */
+};
+
+/*! A submission queue and a completion queue in user memory, read and
+    written directly by the kernel on ring_enter().  Indexes run freely and
+    are reduced modulo RING_ENTRIES.  The process advances SQ_TAIL and
+    CQ_HEAD; the kernel advances SQ_HEAD and CQ_TAIL. */
+struct ring {
+    uint32_t sq_head;           /*!< Next submission the kernel takes. */
+    uint32_t sq_tail;           /*!< Next free submission slot. */
+    uint32_t cq_head;           /*!< Next completion to reap. */
+    uint32_t cq_tail;           /*!< Next free completion slot. */
+    struct ring_sqe sq[RING_ENTRIES];
+    struct ring_cqe cq[RING_ENTRIES];
+};
+
+void ring_init(struct ring *);
+bool ring_queue(struct ring *, enum ring_op, int fd, void *buf,
+                unsigned len, uint32_t user_data);
+int ring_submit(struct ring *);
+bool ring_reap(struct ring *, struct ring_cqe *);
+
+#endif /* lib/user/ring.h */
@@ -0,0 +1,22 @@
+#ifndef __LIB_USER_RUSAGE_H
+#define __LIB_USER_RUSAGE_H
+
+#include <stdint.h>
+
+/*! Resources used by a process, as reported by getrusage(). */
+struct rusage {
+    int64_t user_ticks;         /*!< Timer ticks running user code. */
+    int64_t kernel_ticks;       /*!< Timer ticks in the kernel for it. */
+    uint32_t voluntary_switches;    /*!< Times it blocked. */
+    uint32_t involuntary_switches;  /*!< Times it was preempted. */
+    uint32_t minor_faults;      /*!< Page faults served from memory. */
+    uint32_t major_faults;      /*!< Page faults that read a file or swap. */
+    uint32_t swap_ins;          /*!< Pages it brought back from swap. */
+    uint32_t swap_outs;         /*!< Pages its evictions sent to swap. */
+    uint64_t bytes_read;        /*!< Bytes returned by read(). */
+    uint64_t bytes_written;     /*!< Bytes accepted by write(). */
+    uint32_t cache_hits;        /*!< Buffer cache lookups that hit. */
+    uint32_t cache_misses;      /*!< Buffer cache lookups that missed. */
+};
+
+#endif /* lib/user/rusage.h */
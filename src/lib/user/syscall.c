@@ -1,19 +1,43 @@
 /*! \file syscall.c
  *
  * User-space wrappers for invoking system calls through the standard UNIX
- * APIs.  Four macros are defined, syscall0(), syscall1(), syscall2(), and
- * syscall3(), to pass the corresponding number of arguments to the system
- * call being invoked.  The remaining functions are wrappers for standard
+ * APIs.  Five macros are defined, syscall0(), syscall1(), syscall2(),
+ * syscall3(), and syscall5(), to pass the corresponding number of
+ * arguments to the system call being invoked.  The remaining functions are wrappers for standard
  * UNIX operations, which simply use the syscall macros to invoke the
  * system call.
+ *
+ * System calls go through SYSENTER, with arguments in registers, if the
+ * kernel reports that it supports it, and through "int $0x30", with
+ * arguments on the stack, otherwise.  syscall5() always uses "int $0x30",
+ * since only three arguments fit in registers.
  */
 
 #include <syscall.h>
 #include "../syscall-nr.h"
 
-/*! Invokes syscall NUMBER, passing no arguments, and returns the
-    return value as an `int'. */
-#define syscall0(NUMBER)                                        \
+static bool use_sysenter(void);
+
+/*! Invokes syscall NUMBER through SYSENTER, passing arguments ARG0, ARG1,
+    and ARG2 in registers, and returns the return value as an `int'.  The
+    kernel resumes at the address in EDX with the stack pointer in ECX. */
+#define sysenter3(NUMBER, ARG0, ARG1, ARG2)                     \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("movl %%esp, %%ecx; movl $1f, %%edx; sysenter; 1:" \
+               : "=a" (retval)                                  \
+               : "a" (NUMBER),                                  \
+                 "b" (ARG0),                                    \
+                 "S" (ARG1),                                    \
+                 "D" (ARG2)                                     \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
+        })
+
+/*! Invokes syscall NUMBER through "int $0x30", passing no arguments,
+    and returns the return value as an `int'. */
+#define int_syscall0(NUMBER)                                    \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
@@ -24,9 +48,9 @@
           retval;                                               \
         })
 
-/*! Invokes syscall NUMBER, passing argument ARG0, and returns the
-    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
+/*! Invokes syscall NUMBER through "int $0x30", passing argument ARG0,
+    and returns the return value as an `int'. */
+#define int_syscall1(NUMBER, ARG0)                                       \
         ({                                                               \
           int retval;                                                    \
           asm volatile                                                   \
@@ -38,9 +62,9 @@
           retval;                                                        \
         })
 
-/*! Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
-    returns the return value as an `int'. */
-#define syscall2(NUMBER, ARG0, ARG1)                            \
+/*! Invokes syscall NUMBER through "int $0x30", passing arguments ARG0
+    and ARG1, and returns the return value as an `int'. */
+#define int_syscall2(NUMBER, ARG0, ARG1)                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
@@ -54,9 +78,9 @@
           retval;                                               \
         })
 
-/*! Invokes syscall NUMBER, passing arguments ARG0, ARG1, and
-    ARG2, and returns the return value as an `int'. */
-#define syscall3(NUMBER, ARG0, ARG1, ARG2)                      \
+/*! Invokes syscall NUMBER through "int $0x30", passing arguments ARG0,
+    ARG1, and ARG2, and returns the return value as an `int'. */
+#define int_syscall3(NUMBER, ARG0, ARG1, ARG2)                  \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
@@ -71,6 +95,54 @@
           retval;                                               \
         })
 
+/*! Invokes syscall NUMBER through "int $0x30", passing arguments ARG0
+    through ARG4, and returns the return value as an `int'. */
+#define int_syscall5(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4)      \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg4]; pushl %[arg3]; pushl %[arg2]; "    \
+             "pushl %[arg1]; pushl %[arg0]; "                   \
+             "pushl %[number]; int $0x30; addl $24, %%esp"      \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3),                             \
+                 [arg4] "r" (ARG4)                              \
+               : "memory");                                     \
+          retval;                                               \
+        })
+
+/*! Invoke syscall NUMBER with the given arguments by whichever entry
+    path the kernel supports. */
+#define syscall0(NUMBER)                                        \
+        (use_sysenter() ? sysenter3(NUMBER, 0, 0, 0)            \
+                        : int_syscall0(NUMBER))
+#define syscall1(NUMBER, ARG0)                                  \
+        (use_sysenter() ? sysenter3(NUMBER, ARG0, 0, 0)         \
+                        : int_syscall1(NUMBER, ARG0))
+#define syscall2(NUMBER, ARG0, ARG1)                            \
+        (use_sysenter() ? sysenter3(NUMBER, ARG0, ARG1, 0)      \
+                        : int_syscall2(NUMBER, ARG0, ARG1))
+#define syscall3(NUMBER, ARG0, ARG1, ARG2)                      \
+        (use_sysenter() ? sysenter3(NUMBER, ARG0, ARG1, ARG2)   \
+                        : int_syscall3(NUMBER, ARG0, ARG1, ARG2))
+#define syscall5(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4)          \
+        int_syscall5(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4)
+
+/*! Returns true if the kernel accepts SYSENTER.  The kernel is asked
+    once, through "int $0x30", and the answer kept for later calls. */
+static bool use_sysenter(void) {
+    static int sysenter_ok = -1;
+    if (sysenter_ok < 0) {
+        sysenter_ok = (int_syscall0(SYS_FEATURES)
+                       & SYSCALL_FEATURE_SYSENTER) != 0;
+    }
+    return sysenter_ok;
+}
+
 void halt(void) {
     syscall0(SYS_HALT);
     NOT_REACHED();
@@ -153,3 +225,29 @@ int inumber(int fd) {
     return syscall1(SYS_INUMBER, fd);
 }
 
+pid_t fork(void) {
+    return (pid_t) syscall0(SYS_FORK);
+}
+
+int copy_file_range(int in_fd, int in_off, int out_fd, int out_off,
+                    unsigned length) {
+    return syscall5(SYS_COPY_FILE_RANGE, in_fd, in_off, out_fd, out_off,
+                    length);
+}
+
+int pipe(int fds[2]) {
+    return syscall1(SYS_PIPE, fds);
+}
+
+int ring_enter(struct ring *ring) {
+    return syscall1(SYS_RING_ENTER, ring);
+}
+
+int getrusage(struct rusage *usage) {
+    return syscall1(SYS_GETRUSAGE, usage);
+}
+
+int lseek(int fd, int offset, int whence) {
+    return syscall3(SYS_LSEEK, fd, offset, whence);
+}
+
@@ -15,6 +15,13 @@ typedef int mapid_t;
 /*! Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/*! Origins for lseek(). */
+#define SEEK_SET 0              /*!< From the beginning of the file. */
+#define SEEK_CUR 1              /*!< From the current position. */
+#define SEEK_END 2              /*!< From the end of the file. */
+#define SEEK_DATA 3             /*!< To the next data at or after it. */
+#define SEEK_HOLE 4             /*!< To the next hole at or after it. */
+
 /*! Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /*!< Successful execution. */
 #define EXIT_FAILURE 1          /*!< Unsuccessful execution. */
@@ -45,5 +52,16 @@ bool readdir(int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir(int fd);
 int inumber(int fd);
 
+/* Extensions. */
+pid_t fork(void);
+int copy_file_range(int in_fd, int in_off, int out_fd, int out_off,
+                    unsigned length);
+int pipe(int fds[2]);
+struct ring;
+int ring_enter(struct ring *);
+struct rusage;
+int getrusage(struct rusage *);
+int lseek(int fd, int offset, int whence);
+
 #endif /* lib/user/syscall.h */
 
@@ -0,0 +1,75 @@
+/*! \file vdata.c
+ *
+ * Reads the kernel data page without a system call.  The kernel may update
+ * the page between any two instructions here, so each reader copies what
+ * it needs and retries if the sequence count was odd, meaning an update
+ * was in progress, or changed while it was copying.
+ */
+
+#include <vdata.h>
+
+/*! Reads the time stamp counter. */
+static uint64_t read_tsc(void) {
+    uint64_t tsc;
+    asm volatile ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+/*! Returns the number of timer ticks since the kernel booted. */
+int64_t clock_ticks(void) {
+    uint32_t seq;
+    int64_t ticks;
+
+    do {
+        seq = VDATA->seq;
+        asm volatile ("" : : : "memory");
+        ticks = VDATA->ticks;
+        asm volatile ("" : : : "memory");
+    } while ((seq & 1) || seq != VDATA->seq);
+    return ticks;
+}
+
+/*! Returns the number of nanoseconds since the kernel booted.  Between
+    timer ticks this is interpolated with the time stamp counter if there
+    is one, and otherwise advances a tick at a time. */
+uint64_t clock_ns(void) {
+    uint32_t seq, ns_per_tick, tsc_per_tick, tsc_mult, tsc_shift;
+    int64_t ticks;
+    uint64_t tick_tsc, tsc = 0;
+
+    do {
+        seq = VDATA->seq;
+        asm volatile ("" : : : "memory");
+        ticks = VDATA->ticks;
+        ns_per_tick = VDATA->ns_per_tick;
+        tick_tsc = VDATA->tick_tsc;
+        tsc_per_tick = VDATA->tsc_per_tick;
+        tsc_mult = VDATA->tsc_mult;
+        tsc_shift = VDATA->tsc_shift;
+        if (tsc_per_tick != 0)
+            tsc = read_tsc();
+        asm volatile ("" : : : "memory");
+    } while ((seq & 1) || seq != VDATA->seq);
+
+    uint64_t ns = (uint64_t) ticks * ns_per_tick;
+    if (tsc_per_tick != 0) {
+        /* Never run past the next tick, in case it is late. */
+        uint64_t cycles = tsc - tick_tsc;
+        if (cycles > tsc_per_tick)
+            cycles = tsc_per_tick;
+        ns += (cycles * tsc_mult) >> tsc_shift;
+    }
+    return ns;
+}
+
+/*! Copies the whole kernel data page into VD. */
+void vdata_read(struct vdata *vd) {
+    uint32_t seq;
+
+    do {
+        seq = VDATA->seq;
+        asm volatile ("" : : : "memory");
+        *vd = *(const struct vdata *) VDATA;
+        asm volatile ("" : : : "memory");
+    } while ((seq & 1) || seq != VDATA->seq);
+}
@@ -0,0 +1,31 @@
+#ifndef __LIB_USER_VDATA_H
+#define __LIB_USER_VDATA_H
+
+#include <stdint.h>
+
+/*! User virtual address of the kernel data page, below where programs
+    are loaded. */
+#define VDATA_ADDR 0x08000000
+
+/*! Kernel data mapped read-only into every process at VDATA_ADDR.  The
+    kernel updates it on every timer tick, making SEQ odd while it does. */
+struct vdata {
+    uint32_t seq;               /*!< Update count, times two. */
+    uint32_t ns_per_tick;       /*!< Nanoseconds per timer tick. */
+    int64_t ticks;              /*!< Timer ticks since boot. */
+    uint64_t tick_tsc;          /*!< Time stamp counter at the last tick. */
+    uint32_t tsc_per_tick;      /*!< TSC cycles per tick, or 0 if no TSC. */
+    uint32_t tsc_mult;          /*!< Nanoseconds are cycles times TSC_MULT, */
+    uint32_t tsc_shift;         /*!< ...shifted right by TSC_SHIFT. */
+    uint32_t free_frames;       /*!< Free pages in the user pool. */
+    uint64_t page_faults;       /*!< Page faults since boot. */
+};
+
+/*! The kernel data page, as seen by a process. */
+#define VDATA ((const volatile struct vdata *) VDATA_ADDR)
+
+int64_t clock_ticks(void);
+uint64_t clock_ns(void);
+void vdata_read(struct vdata *);
+
+#endif /* lib/user/vdata.h */
@@ -0,0 +1,55 @@
+/* Copies one file into others with copy_file_range(), both at
+   sector-aligned and at unaligned offsets, and checks the results. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE 5000
+
+static char buf[SIZE];
+static char expected[SIZE + 600];
+
+void
+test_main (void)
+{
+  int in_fd, out_fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK ((in_fd = open ("src")) > 1, "open \"src\"");
+  CHECK (write (in_fd, buf, SIZE) == SIZE, "write \"src\"");
+
+  /* Whole file, using and advancing both file positions. */
+  CHECK (create ("aligned", 0), "create \"aligned\"");
+  CHECK ((out_fd = open ("aligned")) > 1, "open \"aligned\"");
+  seek (in_fd, 0);
+  CHECK (copy_file_range (in_fd, -1, out_fd, -1, 4096) == 4096,
+         "copy 4096 bytes");
+  CHECK (copy_file_range (in_fd, -1, out_fd, -1, SIZE) == SIZE - 4096,
+         "copy rest of \"src\"");
+  CHECK (tell (in_fd) == SIZE && tell (out_fd) == SIZE,
+         "positions advanced");
+  close (out_fd);
+  check_file ("aligned", buf, SIZE);
+
+  /* Part of the file at offsets that straddle sectors, leaving a hole. */
+  CHECK (create ("unaligned", 0), "create \"unaligned\"");
+  CHECK ((out_fd = open ("unaligned")) > 1, "open \"unaligned\"");
+  CHECK (copy_file_range (in_fd, 7, out_fd, 600, SIZE - 7) == SIZE - 7,
+         "copy at unaligned offsets");
+  CHECK (tell (in_fd) == SIZE && tell (out_fd) == 0,
+         "positions unchanged");
+  close (out_fd);
+  memcpy (expected + 600, buf + 7, SIZE - 7);
+  check_file ("unaligned", expected, SIZE + 593);
+
+  /* Overlapping ranges of one file are refused. */
+  CHECK (copy_file_range (in_fd, 0, in_fd, 100, 200) == -1,
+         "overlapping copy fails");
+  close (in_fd);
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-range) begin
+(copy-range) create "src"
+(copy-range) open "src"
+(copy-range) write "src"
+(copy-range) create "aligned"
+(copy-range) open "aligned"
+(copy-range) copy 4096 bytes
+(copy-range) copy rest of "src"
+(copy-range) positions advanced
+(copy-range) open "aligned" for verification
+(copy-range) verified contents of "aligned"
+(copy-range) close "aligned"
+(copy-range) create "unaligned"
+(copy-range) open "unaligned"
+(copy-range) copy at unaligned offsets
+(copy-range) positions unchanged
+(copy-range) open "unaligned" for verification
+(copy-range) verified contents of "unaligned"
+(copy-range) close "unaligned"
+(copy-range) overlapping copy fails
+(copy-range) end
+EOF
+pass;
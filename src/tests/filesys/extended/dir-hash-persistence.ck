@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($d) = {};
+$d->{"f" . (2 * $_ + 1)} = [''] foreach 0...59;
+check_archive ({'d' => $d});
+pass;
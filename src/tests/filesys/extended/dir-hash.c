@@ -0,0 +1,54 @@
+/* Creates enough files in one directory for it to be hashed,
+   removes every other one, and checks that the right names can
+   still be found and read back. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 120
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  char file_name[16];
+  int fd, cnt;
+  int i;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+
+  msg ("creating d/f0 through d/f%d...", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "d/f%d", i);
+      if (!create (file_name, 0))
+        fail ("create \"%s\"", file_name);
+    }
+
+  msg ("removing even-numbered files...");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      snprintf (file_name, sizeof file_name, "d/f%d", i);
+      if (!remove (file_name))
+        fail ("remove \"%s\"", file_name);
+    }
+
+  msg ("looking up every name...");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "d/f%d", i);
+      fd = open (file_name);
+      if ((fd > 1) != (i % 2 == 1))
+        fail ("open \"%s\" returned %d", file_name, fd);
+      if (fd > 1)
+        close (fd);
+    }
+
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  for (cnt = 0; readdir (fd, name); cnt++)
+    continue;
+  CHECK (cnt == FILE_CNT / 2, "readdir found %d entries", cnt);
+  close (fd);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hash) begin
+(dir-hash) mkdir "d"
+(dir-hash) creating d/f0 through d/f119...
+(dir-hash) removing even-numbered files...
+(dir-hash) looking up every name...
+(dir-hash) open "d"
+(dir-hash) readdir found 60 entries
+(dir-hash) end
+EOF
+pass;
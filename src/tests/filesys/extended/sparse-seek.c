@@ -0,0 +1,42 @@
+/* Writes one block far past the start of an empty file, checks
+   that SEEK_DATA and SEEK_HOLE find it and the hole before it,
+   and that the hole reads back as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOLE_SIZE 40960
+#define DATA_SIZE 512
+
+static char buf[HOLE_SIZE + DATA_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "sparse";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\" to %d", file_name, HOLE_SIZE);
+  seek (fd, HOLE_SIZE);
+  memset (buf + HOLE_SIZE, 'x', DATA_SIZE);
+  CHECK (write (fd, buf + HOLE_SIZE, DATA_SIZE) == DATA_SIZE,
+         "write \"%s\"", file_name);
+
+  CHECK (lseek (fd, 0, SEEK_DATA) == HOLE_SIZE,
+         "SEEK_DATA from 0 finds the data");
+  CHECK (lseek (fd, 0, SEEK_HOLE) == 0, "SEEK_HOLE from 0 finds the hole");
+  CHECK (lseek (fd, HOLE_SIZE, SEEK_HOLE) == HOLE_SIZE + DATA_SIZE,
+         "SEEK_HOLE from the data finds end of file");
+  CHECK (lseek (fd, HOLE_SIZE + DATA_SIZE, SEEK_DATA) == -1,
+         "SEEK_DATA at end of file fails");
+  CHECK (lseek (fd, 0, SEEK_END) == HOLE_SIZE + DATA_SIZE,
+         "SEEK_END finds end of file");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, sizeof buf);
+}
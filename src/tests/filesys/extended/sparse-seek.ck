@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sparse-seek) begin
+(sparse-seek) create "sparse"
+(sparse-seek) open "sparse"
+(sparse-seek) seek "sparse" to 40960
+(sparse-seek) write "sparse"
+(sparse-seek) SEEK_DATA from 0 finds the data
+(sparse-seek) SEEK_HOLE from 0 finds the hole
+(sparse-seek) SEEK_HOLE from the data finds end of file
+(sparse-seek) SEEK_DATA at end of file fails
+(sparse-seek) SEEK_END finds end of file
+(sparse-seek) close "sparse"
+(sparse-seek) open "sparse" for verification
+(sparse-seek) verified contents of "sparse"
+(sparse-seek) close "sparse"
+(sparse-seek) end
+EOF
+pass;
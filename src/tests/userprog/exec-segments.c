@@ -0,0 +1,84 @@
+/* Writes out an executable with more loadable segments than the kernel
+   caches per executable, then runs it twice.  The program only exits
+   with status 42. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SEGMENT_CNT 12
+#define BASE 0x08048000
+#define PAGE 0x1000
+
+/* ELF executable header and program header, as the kernel reads them. */
+struct ehdr
+  {
+    unsigned char e_ident[16];
+    uint16_t e_type, e_machine;
+    uint32_t e_version, e_entry, e_phoff, e_shoff, e_flags;
+    uint16_t e_ehsize, e_phentsize, e_phnum;
+    uint16_t e_shentsize, e_shnum, e_shstrndx;
+  };
+
+struct phdr
+  {
+    uint32_t p_type, p_offset, p_vaddr, p_paddr;
+    uint32_t p_filesz, p_memsz, p_flags, p_align;
+  };
+
+/* pushl $42; pushl $SYS_EXIT; int $0x30 */
+static const unsigned char code[] =
+  { 0x6a, 42, 0x6a, SYS_EXIT, 0xcd, 0x30 };
+
+/* The whole executable file. */
+struct image
+  {
+    struct ehdr ehdr;
+    struct phdr phdrs[SEGMENT_CNT];
+    unsigned char code[sizeof code];
+  };
+
+static struct image image;
+
+void
+test_main (void)
+{
+  int handle, i;
+
+  memcpy (image.ehdr.e_ident, "\177ELF\1\1\1", 7);
+  image.ehdr.e_type = 2;
+  image.ehdr.e_machine = 3;
+  image.ehdr.e_version = 1;
+  image.ehdr.e_entry = BASE + offsetof (struct image, code);
+  image.ehdr.e_phoff = offsetof (struct image, phdrs);
+  image.ehdr.e_ehsize = sizeof image.ehdr;
+  image.ehdr.e_phentsize = sizeof (struct phdr);
+  image.ehdr.e_phnum = SEGMENT_CNT;
+
+  /* The first segment maps the file, code included; the rest are a page
+     of zeros each. */
+  for (i = 0; i < SEGMENT_CNT; i++)
+    {
+      struct phdr *p = &image.phdrs[i];
+      p->p_type = 1;
+      p->p_vaddr = p->p_paddr = BASE + i * PAGE;
+      p->p_filesz = i == 0 ? sizeof image : 0;
+      p->p_memsz = PAGE;
+      p->p_flags = i == 0 ? 5 : 6;
+      p->p_align = PAGE;
+    }
+  memcpy (image.code, code, sizeof code);
+
+  CHECK (create ("many-segs", sizeof image), "create \"many-segs\"");
+  CHECK ((handle = open ("many-segs")) > 1, "open \"many-segs\"");
+  CHECK (write (handle, &image, sizeof image) == (int) sizeof image,
+         "write \"many-segs\"");
+  close (handle);
+
+  for (i = 0; i < 2; i++)
+    CHECK (wait (exec ("many-segs")) == 42, "exec \"many-segs\"");
+}
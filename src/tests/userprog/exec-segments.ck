@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(exec-segments) begin
+(exec-segments) create "many-segs"
+(exec-segments) open "many-segs"
+(exec-segments) write "many-segs"
+many-segs: exit(42)
+(exec-segments) exec "many-segs"
+many-segs: exit(42)
+(exec-segments) exec "many-segs"
+(exec-segments) end
+exec-segments: exit(0)
+EOF
+pass;
@@ -0,0 +1,65 @@
+/* Measures the cost of a system call that does no work, first
+   through "int $0x30" and then, if the kernel supports it,
+   through SYSENTER, and reports the average in CPU cycles. */
+
+#include <stdint.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CALLS 10000
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+static int
+int_null (void)
+{
+  int retval;
+  asm volatile ("pushl %[number]; int $0x30; addl $4, %%esp"
+                : "=a" (retval)
+                : [number] "i" (SYS_FEATURES)
+                : "memory");
+  return retval;
+}
+
+static int
+sysenter_null (void)
+{
+  int retval;
+  asm volatile ("movl %%esp, %%ecx; movl $1f, %%edx; sysenter; 1:"
+                : "=a" (retval)
+                : "a" (SYS_FEATURES)
+                : "ecx", "edx", "cc", "memory");
+  return retval;
+}
+
+/* Returns the average number of cycles taken by CALL. */
+static unsigned
+measure (int (*call) (void))
+{
+  uint64_t start;
+  int i;
+
+  start = rdtsc ();
+  for (i = 0; i < CALLS; i++)
+    call ();
+  return (rdtsc () - start) / CALLS;
+}
+
+void
+test_main (void)
+{
+  int features = int_null ();
+
+  msg ("int $0x30: %u cycles per call", measure (int_null));
+  if (features & SYSCALL_FEATURE_SYSENTER)
+    msg ("sysenter: %u cycles per call", measure (sysenter_null));
+  else
+    msg ("sysenter: not supported");
+}
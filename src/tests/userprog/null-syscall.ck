@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+@output = get_core_output ("run", @output);
+fail "missing int \$0x30 timing in output"
+  unless grep (/^\(null-syscall\) int \$0x30: \d+ cycles per call$/, @output);
+fail "missing sysenter timing in output"
+  unless grep (/^\(null-syscall\) sysenter: (\d+ cycles per call|not supported)$/,
+	       @output);
+
+pass;
@@ -0,0 +1,50 @@
+/* Writes more than a page through a pipe, reads it back in odd-sized
+   pieces, and checks end of file and a write with no reader left. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BUF_SIZE (3 * 4096 + 100)
+
+static char out[BUF_SIZE];
+static char in[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  int fds[2];
+  size_t i, ofs;
+
+  for (i = 0; i < sizeof out; i++)
+    out[i] = i * 7 + 3;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  CHECK (fds[0] > 1 && fds[1] > 1 && fds[0] != fds[1], "two new fds");
+  CHECK (write (fds[1], out, sizeof out) == (int) sizeof out,
+         "write %zu bytes", sizeof out);
+  CHECK (read (fds[1], in, 1) == -1, "read write end fails");
+
+  for (ofs = 0; ofs < sizeof in; )
+    {
+      int n = read (fds[0], in + ofs, 1000);
+      if (n <= 0)
+        fail ("read returned %d at offset %zu", n, ofs);
+      ofs += n;
+    }
+  msg ("read %zu bytes", ofs);
+  if (memcmp (in, out, sizeof out))
+    fail ("data read differs from data written");
+
+  msg ("close write end");
+  close (fds[1]);
+  CHECK (read (fds[0], in, 1) == 0, "read at end of file");
+  close (fds[0]);
+
+  CHECK (pipe (fds) == 0, "pipe");
+  msg ("close read end");
+  close (fds[0]);
+  CHECK (write (fds[1], out, 1) == -1, "write with no reader fails");
+  close (fds[1]);
+}
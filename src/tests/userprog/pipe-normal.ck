@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-normal) begin
+(pipe-normal) pipe
+(pipe-normal) two new fds
+(pipe-normal) write 12388 bytes
+(pipe-normal) read write end fails
+(pipe-normal) read 12388 bytes
+(pipe-normal) close write end
+(pipe-normal) read at end of file
+(pipe-normal) pipe
+(pipe-normal) close read end
+(pipe-normal) write with no reader fails
+(pipe-normal) end
+pipe-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,62 @@
+/* Opens, reads, seeks and closes "sample.txt" through batches queued on a
+   ring, and checks each completion. */
+
+#include <ring.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct ring ring;
+static char buf[2][sizeof sample];
+
+/* Submits the queued batch and checks that it completes in order with the
+   CNT results in EXPECTED, tagged 0...CNT-1. */
+static void
+submit (const int *expected, int cnt) 
+{
+  struct ring_cqe cqe;
+  int i;
+
+  CHECK (ring_submit (&ring) == cnt, "submit %d", cnt);
+  for (i = 0; i < cnt; i++) 
+    {
+      if (!ring_reap (&ring, &cqe))
+        fail ("completion %d missing", i);
+      if (cqe.user_data != (uint32_t) i || cqe.result != expected[i])
+        fail ("completion %d: got %d for %u, expected %d", i,
+              cqe.result, cqe.user_data, expected[i]);
+    }
+  if (ring_reap (&ring, &cqe))
+    fail ("extra completion");
+}
+
+void
+test_main (void) 
+{
+  int fds[2];
+  int len = sizeof sample - 1;
+  struct ring_cqe cqe;
+
+  ring_init (&ring);
+  CHECK (ring_queue (&ring, RING_OPEN, 0, "sample.txt", 0, 0)
+         && ring_queue (&ring, RING_OPEN, 0, "sample.txt", 0, 1),
+         "queue two opens");
+  CHECK (ring_submit (&ring) == 2, "submit 2");
+  if (!ring_reap (&ring, &cqe) || (fds[0] = cqe.result) < 2
+      || !ring_reap (&ring, &cqe) || (fds[1] = cqe.result) < 2)
+    fail ("open failed");
+
+  ring_queue (&ring, RING_READ, fds[0], buf[0], len, 0);
+  ring_queue (&ring, RING_SEEK, fds[1], NULL, 10, 1);
+  ring_queue (&ring, RING_READ, fds[1], buf[1], len, 2);
+  ring_queue (&ring, RING_NOP, 0, NULL, 0, 3);
+  submit ((int[]) { len, 0, len - 10, 0 }, 4);
+  if (memcmp (buf[0], sample, len) || memcmp (buf[1], sample + 10, len - 10))
+    fail ("data read differs from sample.txt");
+
+  ring_queue (&ring, RING_CLOSE, fds[0], NULL, 0, 0);
+  ring_queue (&ring, RING_CLOSE, fds[1], NULL, 0, 1);
+  submit ((int[]) { 0, 0 }, 2);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ring-normal) begin
+(ring-normal) queue two opens
+(ring-normal) submit 2
+(ring-normal) submit 4
+(ring-normal) submit 2
+(ring-normal) end
+ring-normal: exit(0)
+EOF
+pass;
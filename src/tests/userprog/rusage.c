@@ -0,0 +1,37 @@
+/* Checks that getrusage() counts bytes read and ticks spent running
+   user code. */
+
+#include <rusage.h>
+#include <syscall.h>
+#include <vdata.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct rusage before, after;
+  char buf[sizeof sample];
+  int handle, byte_cnt;
+  int64_t start;
+
+  CHECK (getrusage (&before) == 0, "getrusage");
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  byte_cnt = read (handle, buf, sizeof sample - 1);
+  close (handle);
+
+  /* Spin in user mode across a few timer ticks. */
+  start = clock_ticks ();
+  while (clock_ticks () < start + 3)
+    continue;
+
+  CHECK (getrusage (&after) == 0, "getrusage");
+  if (after.bytes_read - before.bytes_read != (uint64_t) byte_cnt)
+    fail ("bytes_read grew by %d, expected %d",
+          (int) (after.bytes_read - before.bytes_read), byte_cnt);
+  if (after.user_ticks <= before.user_ticks)
+    fail ("user_ticks did not grow");
+  msg ("usage grew as expected");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rusage) begin
+(rusage) getrusage
+(rusage) open "sample.txt"
+(rusage) getrusage
+(rusage) usage grew as expected
+(rusage) end
+rusage: exit(0)
+EOF
+pass;
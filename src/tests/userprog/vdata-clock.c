@@ -0,0 +1,36 @@
+/* Reads the clock from the kernel data page while spinning across a few
+   timer ticks, then tries to write the page, which should terminate the
+   process with a -1 exit code. */
+
+#include <vdata.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct vdata vd;
+  int64_t start_ticks, ticks;
+  uint64_t start_ns, ns, last_ns;
+
+  vdata_read (&vd);
+  CHECK (vd.ns_per_tick > 0, "read kernel data page");
+
+  start_ticks = clock_ticks ();
+  start_ns = last_ns = clock_ns ();
+  do 
+    {
+      ticks = clock_ticks ();
+      ns = clock_ns ();
+      if (ns < last_ns)
+        fail ("clock went backward");
+      last_ns = ns;
+    }
+  while (ticks < start_ticks + 3);
+  CHECK (ns - start_ns >= 2 * (uint64_t) vd.ns_per_tick,
+         "clock advanced with ticks");
+
+  msg ("write kernel data page");
+  *(volatile uint32_t *) VDATA_ADDR = 0;
+  fail ("should have exited with -1");
+}
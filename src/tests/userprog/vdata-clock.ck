@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(vdata-clock) begin
+(vdata-clock) read kernel data page
+(vdata-clock) clock advanced with ticks
+(vdata-clock) write kernel data page
+vdata-clock: exit(-1)
+EOF
+pass;
@@ -0,0 +1,47 @@
+/* Forks with a large initialized buffer.  The child checks that it sees
+   the parent's data, then overwrites all of it; the parent checks that
+   the child's writes did not reach its own copy. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+static void
+check_buf (char value, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != value)
+      fail ("%s: byte %zu is %d, not %d", who, i, buf[i], value);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  memset (buf, 0x5a, sizeof buf);
+  child = fork ();
+  if (child == 0)
+    {
+      check_buf (0x5a, "child");
+      msg ("child: buffer matches");
+      memset (buf, 0xa5, sizeof buf);
+      check_buf ((char) 0xa5, "child");
+      msg ("child: wrote buffer");
+      exit (81);
+    }
+
+  /* Only fail here: a message would race with the child's. */
+  if (child == PID_ERROR)
+    fail ("fork");
+  CHECK (wait (child) == 81, "wait for child");
+  check_buf (0x5a, "parent");
+  msg ("parent: buffer intact");
+}
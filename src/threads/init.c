@@ -27,9 +27,11 @@
 
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/exec-cache.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/vdata.h"
 
 #else
 
@@ -52,6 +54,7 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #endif
 
 /*! Page directory with kernel mappings only. */
@@ -73,6 +76,11 @@ static const char *swap_bdev_name;
 /*! -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef VM
+/*! -zswap: Number of kernel pages reserved for compressed swap. */
+static size_t zswap_pages = ZSWAP_DEFAULT_PAGES;
+#endif
+
 static void bss_init(void);
 static void paging_init(void);
 
@@ -130,12 +138,16 @@ int main(void) {
 #ifdef USERPROG
     exception_init();
     syscall_init();
+    exec_cache_init();
 #endif
 
     /* Start thread scheduler and enable interrupts. */
     thread_start();
     serial_init_queue();
     timer_calibrate();
+#ifdef USERPROG
+    vdata_init();
+#endif
 
 #ifdef FILESYS
     /* Initialize file system. */
@@ -145,7 +157,8 @@ int main(void) {
 #endif
 
 #ifdef VM
-    swap_table_init();
+    swap_table_init(zswap_pages);
+    frame_zero_pool_init();
 #endif
 
     printf("Boot complete.\n");
@@ -268,6 +281,18 @@ static char ** parse_options(char **argv) {
 #ifdef USERPROG
         else if (!strcmp(name, "-ul"))
             user_page_limit = atoi(value);
+        else if (!strcmp(name, "-fl"))
+            fd_limit = atoi(value);
+        else if (!strcmp(name, "-nosysenter"))
+            syscall_use_sysenter = false;
+        else if (!strcmp(name, "-rusage"))
+            syscall_print_rusage = true;
+#endif
+#ifdef VM
+        else if (!strcmp(name, "-zswap"))
+            zswap_pages = atoi(value);
+        else if (!strcmp(name, "-fa"))
+            fault_around_pages = atoi(value);
 #endif
         else
             PANIC("unknown option `%s' (use -h for help)", name);
@@ -384,6 +409,13 @@ static void usage(void) {
            "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
            "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+           "  -fl=COUNT          Limit each process to COUNT file descriptors.\n"
+           "  -nosysenter        Make system calls only through int $0x30.\n"
+           "  -rusage            Print each process's resource usage at exit.\n"
+#endif
+#ifdef VM
+           "  -zswap=COUNT       Keep up to COUNT pages of compressed swap in RAM.\n"
+           "  -fa=COUNT          Map up to COUNT pages per file-backed page fault.\n"
 #endif
           );
     shutdown_power_off();
@@ -135,6 +135,23 @@ void palloc_free_page(void *page) {
     palloc_free_multiple(page, 1);
 }
 
+/*! Returns the address of the first page in the user pool. */
+void * palloc_user_base(void) {
+    return user_pool.base;
+}
+
+/*! Returns the number of pages in the user pool. */
+size_t palloc_user_page_cnt(void) {
+    return bitmap_size(user_pool.used_map);
+}
+
+/*! Returns the number of free pages in the user pool.  Takes no lock, so
+    the count may be slightly stale. */
+size_t palloc_user_free_cnt(void) {
+    return bitmap_count(user_pool.used_map, 0,
+                        bitmap_size(user_pool.used_map), false);
+}
+
 /*! Initializes pool P as starting at START and ending at END,
     naming it NAME for debugging purposes. */
 static void init_pool(struct pool *p, void *base, size_t page_cnt,
@@ -20,6 +20,7 @@
 #include "threads/vaddr.h"
 #include "userprog/syscall.h"
 #ifdef USERPROG
+#include "userprog/pipe.h"
 #include "userprog/process.h"
 #endif
 #ifdef VM
@@ -71,12 +72,15 @@ static unsigned thread_ticks;   /*!< # of timer ticks since last yield. */
     Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+int fd_limit = FD_LIMIT_DEFAULT;
+
 static void kernel_thread(thread_func *, void *aux);
 
 static void idle(void *aux UNUSED);
 static struct thread *running_thread(void);
 static struct thread *next_thread_to_run(void);
 static void init_thread(struct thread *, const char *name, int priority);
+static bool fd_table_grow(struct thread *t);
 static void *alloc_frame(struct thread *, size_t size);
 static void schedule(void);
 void thread_schedule_tail(struct thread *prev);
@@ -175,9 +179,10 @@ void thread_start(void) {
     sema_down(&idle_started);
 }
 
-/*! Called by the timer interrupt handler at each timer tick.
-    Thus, this function runs in an external interrupt context. */
-void thread_tick(void) {
+/*! Called by the timer interrupt handler at each timer tick.  USER is
+    true if the tick interrupted user code.  Thus, this function runs in an
+    external interrupt context. */
+void thread_tick(bool user) {
     struct thread *t = thread_current();
     int num_ready_threads = list_size(&ready_list);
 
@@ -192,6 +197,12 @@ void thread_tick(void) {
         kernel_ticks++;
         num_ready_threads = list_size(&ready_list) + 1;
     }
+    if (t != idle_thread) {
+        if (user)
+            t->usage.user_ticks++;
+        else
+            t->usage.kernel_ticks++;
+    }
 
     /* Update cpu_usage */
     t->recent_cpu += FIXED_ONE;
@@ -321,6 +332,7 @@ void thread_block(void) {
     ASSERT(intr_get_level() == INTR_OFF);
 
     thread_current()->status = THREAD_BLOCKED;
+    thread_current()->usage.voluntary_switches++;
     schedule();
 }
 
@@ -393,7 +405,8 @@ void thread_exit(void) {
     }
 
     /* All file buffers should be freed in sys_exit. */
-    ASSERT (list_empty(&cur->open_files));
+    ASSERT (cur->num_files == 0);
+    fd_table_destroy(cur);
 
 #ifdef VM
     /* All mappings should be freed in sys_exit too. */
@@ -444,6 +457,7 @@ void thread_yield(void) {
     if (cur != idle_thread) {
         ASSERT(is_thread(cur));
         list_push_back(&ready_list, &cur->elem);
+        cur->usage.involuntary_switches++;
     }
     cur->status = THREAD_READY;
     schedule();
@@ -610,92 +624,179 @@ bool is_valid_fd(int fd) {
 
 /*! Return true if fd is in range and exists. */
 bool is_existing_fd(struct thread *cur, int fd) {
-    if (!is_valid_fd(fd)) {
+    return is_valid_fd(fd) && fd < cur->fd_cnt &&
+        (cur->files[fd].file != NULL || cur->files[fd].pipe != NULL);
+}
+
+/*! Get the lowest unused fd, growing the table if it is full.  Returns ERR
+    if the process has reached fd_limit or memory is short. */
+int next_fd(struct thread *cur) {
+    size_t fd = BITMAP_ERROR;
+    if (cur->fd_map != NULL) {
+        fd = bitmap_scan(cur->fd_map, CONSOLE_FD, 1, false);
+    }
+    if (fd == BITMAP_ERROR) {
+        fd = cur->fd_cnt;
+        if (!fd_table_grow(cur)) {
+            return ERR;
+        }
+    }
+    ASSERT (is_valid_fd(fd) && !is_existing_fd(cur, fd));
+    return fd;
+}
+
+/*! Double the size of T's fd table, up to fd_limit.  Returns false if it
+    is already at the limit or memory is short. */
+static bool fd_table_grow(struct thread *t) {
+    int new_cnt = t->fd_cnt == 0 ? FD_TABLE_MIN : t->fd_cnt * 2;
+    if (new_cnt > fd_limit) {
+        new_cnt = fd_limit;
+    }
+    if (new_cnt <= t->fd_cnt) {
         return false;
     }
 
-    /* Check if fd is in open_files list. */
-    struct list_elem *e;
-    for (e = list_begin(&cur->open_files); e != list_end(&cur->open_files);
-         e = list_next(e)) {
-        struct sys_file *cur_file = list_entry(e, struct sys_file, file_elem);
-        if (cur_file->fd == fd) {
-            return true;
-        }
+    struct bitmap *fd_map = bitmap_create(new_cnt);
+    if (fd_map == NULL) {
+        return false;
+    }
+    struct sys_file *files = realloc(t->files, new_cnt * sizeof *files);
+    if (files == NULL) {
+        bitmap_destroy(fd_map);
+        return false;
     }
 
-    /* Didn't find fd. */
-    return false;
-}
+    /* Carry over used descriptors; the console ones are always used. */
+    int fd;
+    bitmap_set_multiple(fd_map, 0, CONSOLE_FD, true);
+    for (fd = CONSOLE_FD; fd < t->fd_cnt; fd++) {
+        bitmap_set(fd_map, fd, bitmap_test(t->fd_map, fd));
+    }
+    memset(files + t->fd_cnt, 0, (new_cnt - t->fd_cnt) * sizeof *files);
 
-/*! Get next fd. */
-int next_fd(struct thread *cur) {
-    int fd = cur->num_files + CONSOLE_FD;
-    cur->num_files++;
-    ASSERT (is_valid_fd(fd) && !is_existing_fd(cur, fd));
-    return fd;
+    if (t->fd_map != NULL) {
+        bitmap_destroy(t->fd_map);
+    }
+    t->fd_map = fd_map;
+    t->files = files;
+    t->fd_cnt = new_cnt;
+    return true;
 }
 
-/*! Add file to open_files array. Return -1 if fails */
+/*! Add file to the fd table at fd, which should come from next_fd().
+    Return -1 if fails. */
 int add_open_file(struct thread *cur, struct file *file, int fd) {
-    /* Initialize file */
-    struct sys_file *new_file = palloc_get_page(PAL_ZERO);
-    /* Not enough memory. */
-    if (new_file == NULL) {
+    if (!is_valid_fd(fd) || fd >= cur->fd_cnt || is_existing_fd(cur, fd)) {
 #ifdef USERPROG
         file_close(file);
 #endif
         return ERR;
     }
-    memset(new_file, 0, sizeof *new_file);
-    new_file->file = file;
-    new_file->fd = fd;
 
-    if (is_valid_fd(fd) && !is_existing_fd(cur, fd)) {
-        list_push_back(&cur->open_files, &new_file->file_elem);
-        return fd;
+    cur->files[fd].file = file;
+    bitmap_mark(cur->fd_map, fd);
+    cur->num_files++;
+    return fd;
+}
+
+/*! Add an end of PIPE, the write end if WRITER, to the fd table at fd,
+    which should come from next_fd().  Return -1 if fails. */
+int add_open_pipe(struct thread *cur, struct pipe *pipe, bool writer,
+                  int fd) {
+    if (!is_valid_fd(fd) || fd >= cur->fd_cnt || is_existing_fd(cur, fd)) {
+#ifdef USERPROG
+        pipe_close(pipe, writer);
+#endif
+        return ERR;
     }
 
-    /* Couldn't find file. */
-    return ERR;
+    cur->files[fd].pipe = pipe;
+    cur->files[fd].pipe_writer = writer;
+    bitmap_mark(cur->fd_map, fd);
+    cur->num_files++;
+    return fd;
 }
 
-/*! Get file with file descriptor *fd*. */
+/*! Get file with file descriptor *fd*.  Returns NULL if fd is not open or
+    is a pipe. */
 struct file *get_fd(struct thread *cur, int fd) {
-    struct sys_file *cur_file;
-    struct list_elem *e;
-    for (e = list_begin(&cur->open_files);
-         e != list_end(&cur->open_files);
-         e = list_next(e)) {
-        cur_file = list_entry(e, struct sys_file, file_elem);
-        if (cur_file->fd == fd) {
-            return cur_file->file;
-        }
+    if (!is_existing_fd(cur, fd)) {
+        return NULL;
     }
+    return cur->files[fd].file;
+}
 
-    /* Couldn't find file. */
-    return NULL;
+/*! Get pipe with file descriptor *fd*, and store in *writer* whether it is
+    the write end.  Returns NULL if fd is not an open pipe. */
+struct pipe *get_fd_pipe(struct thread *cur, int fd, bool *writer) {
+    if (!is_existing_fd(cur, fd) || cur->files[fd].pipe == NULL) {
+        return NULL;
+    }
+    *writer = cur->files[fd].pipe_writer;
+    return cur->files[fd].pipe;
 }
 
-/*! Close file with file descriptor *fd*. Assumes file is already closed so
-    just need to remove it from the thread's list. */
+/*! Close file with file descriptor *fd* and free its slot for reuse. */
 void close_fd(struct thread *cur, int fd) {
     ASSERT(is_existing_fd(cur, fd));
 
-    struct list_elem *e;
-    for (e = list_begin(&cur->open_files); e != list_end(&cur->open_files);
-         e = list_next(e)) {
-        struct sys_file *cur_file = list_entry(e, struct sys_file, file_elem);
-        if (cur_file->fd == fd) {
-            list_remove(&cur_file->file_elem);
 #ifdef USERPROG
-            file_close(cur_file->file);
+    if (cur->files[fd].pipe != NULL) {
+        pipe_close(cur->files[fd].pipe, cur->files[fd].pipe_writer);
+    }
+    else {
+        file_close(cur->files[fd].file);
+    }
 #endif
-            palloc_free_page(cur_file);
-            return;
+    cur->files[fd].file = NULL;
+    cur->files[fd].pipe = NULL;
+    bitmap_reset(cur->fd_map, fd);
+    cur->num_files--;
+}
+
+/*! Free the fd table of CUR, whose files must all be closed. */
+void fd_table_destroy(struct thread *cur) {
+    ASSERT(cur->num_files == 0);
+    if (cur->fd_map != NULL) {
+        bitmap_destroy(cur->fd_map);
+    }
+    free(cur->files);
+    cur->files = NULL;
+    cur->fd_map = NULL;
+    cur->fd_cnt = 0;
+}
+
+#ifdef USERPROG
+/*! Give CHILD a copy of PARENT's fd table.  Each file is reopened at the
+    same position, so after this the two processes move their offsets
+    independently.  Pipes are shared with the child.  Returns false if
+    memory runs out, leaving the files copied so far open in CHILD. */
+bool fd_table_fork(struct thread *child, struct thread *parent) {
+    int fd;
+
+    while (child->fd_cnt < parent->fd_cnt) {
+        if (!fd_table_grow(child)) {
+            return false;
         }
     }
+    for (fd = CONSOLE_FD; fd < parent->fd_cnt; fd++) {
+        struct pipe *pipe = parent->files[fd].pipe;
+        if (pipe != NULL) {
+            pipe_dup(pipe, parent->files[fd].pipe_writer);
+            add_open_pipe(child, pipe, parent->files[fd].pipe_writer, fd);
+        }
+        else if (is_existing_fd(parent, fd)) {
+            struct file *file = file_reopen(parent->files[fd].file);
+            if (file == NULL) {
+                return false;
+            }
+            file_seek(file, file_tell(parent->files[fd].file));
+            add_open_file(child, file, fd);
+        }
+    }
+    return true;
 }
+#endif
 
 #ifdef VM
 /* Returns true if mapping is >= 0. -1 is for failutres. */
@@ -861,7 +962,9 @@ static void init_thread(struct thread *t, const char *name, int priority) {
     t->sleep_counter = 0; /* set to 0 if thread is not sleeping */
     list_init(&t->locks_acquired);
     list_init(&t->kids);
-    list_init(&t->open_files);
+    t->files = NULL;
+    t->fd_map = NULL;
+    t->fd_cnt = 0;
     /* Block process_wait of parent until this process is ready to die. */
     sema_init(&t->wait_sema, 0);
     sema_init(&t->done_sema, 1);
@@ -895,6 +998,7 @@ static void init_thread(struct thread *t, const char *name, int priority) {
 #endif
 #ifdef CACHE
     t->cur_dir_inode = NULL;
+    t->journal_depth = 0;
 #endif
 
     old_level = intr_disable();
@@ -994,7 +1098,7 @@ void thread_schedule_tail(struct thread *prev) {
 
         /* All lists should be emptied. */
         ASSERT(list_empty(&prev->locks_acquired));
-        ASSERT(list_empty(&prev->open_files));
+        ASSERT(prev->files == NULL);
         ASSERT(list_empty(&prev->kids));
 
         /* Free thread memory. */
@@ -6,17 +6,22 @@
 #ifndef THREADS_THREAD_H
 #define THREADS_THREAD_H
 
+#include <bitmap.h>
 #include <debug.h>
 #include <hash.h>
 #include <list.h>
 #include <stdint.h>
+#include <user/rusage.h>
 #include "synch.h"
+#ifdef VM
+#include "vm/vma.h"
+#endif
 
-/* Open file. This is for a linked list of open files in each thread. */
+/* Open file. This is an entry of each thread's file descriptor table. */
 struct sys_file {
-    struct file *file;
-    int fd;
-    struct list_elem file_elem;
+    struct file *file;  /*!< Open file, or NULL if the slot is free. */
+    struct pipe *pipe;  /*!< Open pipe end, or NULL if not a pipe. */
+    bool pipe_writer;   /*!< True if PIPE is the write end. */
 };
 
 /* Memory mapped files. This is for a linked list of mmapped files in each thread. */
@@ -48,8 +53,14 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /*!< Default priority. */
 #define PRI_MAX 63                      /*!< Highest priority. */
 
+/* Thread niceness. */
+#define NICE_MIN -20                    /*!< Least nice. */
+#define NICE_MAX 20                     /*!< Nicest. */
+
 /* Open files' file descriptors. */
 #define CONSOLE_FD 2                    /*!< fd 0 and 1 reserved. */
+#define FD_TABLE_MIN 16                 /*!< Initial size of fd table. */
+#define FD_LIMIT_DEFAULT 512            /*!< Default per-process fd limit. */
 
 /*! A kernel thread or user process.
 
@@ -130,6 +141,11 @@ struct thread {
     struct list locks_acquired;         /*!< Locks this thread is blocking */
     /**@}*/
 
+    /*! Counted by whichever subsystem the resource belongs to. */
+    /**@{*/
+    struct rusage usage;                /*!< Resources used so far. */
+    /**@}*/
+
     /*! Shared between thread.c and synch.c. */
     /**@{*/
     struct list_elem elem;              /*!< List element. */
@@ -138,8 +154,10 @@ struct thread {
 
     /*! Shared between thread.c and userprog/syscall.c. */
     /**@{*/
-    int num_files;                      /*!< Number of open files (counting closed ones). */
-    struct list open_files;             /*!< Open files. */
+    int num_files;                      /*!< Number of open files. */
+    struct sys_file *files;             /*!< File descriptor table, indexed by fd. */
+    struct bitmap *fd_map;              /*!< Descriptors in use. */
+    int fd_cnt;                         /*!< Number of slots in files. */
     /**@}*/
 
     /*! Shared between userprog/process.c and thread.c. */
@@ -171,6 +189,7 @@ struct thread {
 
 #ifdef VM
     struct hash sup_page;              /*!< Supplemental Page Table. */
+    struct vma_tree vmas;              /*!< Mapped address ranges. */
     struct list mappings;              /*!< Memory mapped files. */
     int num_mappings;                  /*!< Number of mappings (including unmapped). */
     uint8_t *esp;                      /*!< esp to pass to page_fault */
@@ -178,6 +197,8 @@ struct thread {
 
 #ifdef CACHE
     struct inode *cur_dir_inode;               /*!< Current directory inode. */
+    int journal_depth;                         /*!< Journal operations begun
+                                                    and not yet ended. */
 #endif
 
     /*! Owned by thread.c. */
@@ -191,11 +212,15 @@ struct thread {
     Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/*! Largest number of file descriptors a process may use, counting the
+    console.  Controlled by kernel command-line option "-fl". */
+extern int fd_limit;
+
 bool is_thread(struct thread *);
 void thread_init(void);
 void thread_start(void);
 
-void thread_tick(void);
+void thread_tick(bool user);
 void thread_print_stats(void);
 
 typedef void thread_func(void *aux);
@@ -236,7 +261,11 @@ bool is_existing_fd(struct thread *cur, int fd);
 int next_fd(struct thread *cur);
 int add_open_file(struct thread *cur, struct file *file, int fd);
 struct file *get_fd(struct thread *cur, int fd);
+int add_open_pipe(struct thread *cur, struct pipe *pipe, bool writer, int fd);
+struct pipe *get_fd_pipe(struct thread *cur, int fd, bool *writer);
 void close_fd(struct thread *cur, int fd);
+void fd_table_destroy(struct thread *cur);
+bool fd_table_fork(struct thread *child, struct thread *parent);
 
 #ifdef VM
 bool is_valid_mapping(int mapping);
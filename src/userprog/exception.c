@@ -5,6 +5,7 @@
 #include "threads/thread.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
+#include "userprog/uaccess.h"
 #ifdef VM
 #include "threads/pte.h"
 #include "threads/thread.h"
@@ -12,6 +13,7 @@
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/vma.h"
 #endif
 
 /*! Number of page faults processed. */
@@ -69,6 +71,11 @@ void exception_print_stats(void) {
     printf("Exception: %lld page faults\n", page_fault_cnt);
 }
 
+/*! Returns the number of page faults so far. */
+long long exception_page_fault_cnt(void) {
+    return page_fault_cnt;
+}
+
 /*! Handler for an exception (probably) caused by a user process. */
 static void kill(struct intr_frame *f) {
     /* This interrupt is one (probably) caused by a user process.
@@ -145,20 +152,28 @@ static void page_fault(struct intr_frame *f) {
 
     bool success = false;
 #ifdef VM
+    bool major = false;
     if (!is_user_vaddr(fault_addr)) {
         sys_exit(-1);
     }
     if (not_present) {
         struct thread *cur = thread_current();
         /* Locate page that faulted in supplemental page table. */
-        struct sup_page *page = thread_sup_page_get(&cur->sup_page, fault_addr);
+        struct sup_page *page = vma_get_page(cur, fault_addr);
         uint8_t *esp = f->esp;
         if (f->cs == SEL_KCSEG) {
             esp = cur->esp;
         }
         if (page != NULL) {
+            /* Only file data and pages on the swap disk need I/O. */
+            major = page->status == FILE_PAGE ||
+                (page->status == SWAP_PAGE && page->zswap == NULL &&
+                 page->swap_position != NOT_SWAP);
             success = fetch_data_to_frame(page);
             unpin(page->fte);
+            if (success) {
+                fetch_data_around(page);
+            }
         }
         /* Page not in supplemental page table. */
         else if (is_stack_access(fault_addr, esp)) {
@@ -170,6 +185,22 @@ static void page_fault(struct intr_frame *f) {
             unpin(page->fte);
         }
     }
+    else if (write) {
+        /* Writing a page that fork left shared copy-on-write. */
+        struct sup_page *page = thread_sup_page_get(&thread_current()->sup_page,
+                                                    fault_addr);
+        if (page != NULL) {
+            success = sup_page_unshare(page);
+        }
+    }
+    if (success) {
+        if (major) {
+            thread_current()->usage.major_faults++;
+        }
+        else {
+            thread_current()->usage.minor_faults++;
+        }
+    }
     /* To implement virtual memory, delete the rest of the function
        body, and replace it with code that brings in the page to
        which fault_addr refers. */
@@ -177,9 +208,11 @@ static void page_fault(struct intr_frame *f) {
 
     /* Handle process if file doesn't load*/
     if (!success) {
-        if (!user) {
-            f->eip = (void *) f->eax;
-            f->eax = -1;
+        /* Kernel code copying to or from user memory recovers through
+           the exception table. */
+        void *fixup = user ? NULL : uaccess_fixup((void *) f->eip);
+        if (fixup != NULL) {
+            f->eip = fixup;
         }
         else {
             printf("Page fault at %p: %s error %s page in %s context.\n",
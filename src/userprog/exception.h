@@ -9,6 +9,7 @@
 
 void exception_init(void);
 void exception_print_stats(void);
+long long exception_page_fault_cnt(void);
 
 #endif /* userprog/exception.h */
 
@@ -0,0 +1,140 @@
+/*! \file exec-cache.c
+ *
+ * A small cache of parsed executables.  load() stores the segment layout
+ * and entry point it gets out of an ELF file here, keyed by the file's
+ * inode number and write generation, so that executing the same program
+ * again skips reading and checking its headers.
+ *
+ * Each entry holds its inode open.  That keeps the inode's generation
+ * meaningful between runs and keeps its sector from being reused by
+ * another file while the entry exists.  Entries for removed files are
+ * dropped by exec_cache_prune() so their blocks are not held for long.
+ */
+
+#include "userprog/exec-cache.h"
+#include <debug.h>
+#include <list.h>
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/*! Most executables cached at once. */
+#define EXEC_CACHE_SIZE 8
+
+/*! A cached executable. */
+struct exec_entry {
+    struct list_elem elem;      /*!< Element in exec_cache. */
+    struct inode *inode;        /*!< The file, held open. */
+    block_sector_t sector;      /*!< Its inode number. */
+    unsigned generation;        /*!< Its write generation when parsed. */
+    struct exec_image image;    /*!< What was parsed. */
+};
+
+/*! Cached executables, most recently used first. */
+static struct list exec_cache;
+static size_t exec_cache_cnt;
+static struct lock exec_cache_lock;
+
+static void exec_entry_drop(struct exec_entry *entry);
+
+/*! Initializes the exec cache. */
+void exec_cache_init(void) {
+    list_init(&exec_cache);
+    exec_cache_cnt = 0;
+    lock_init(&exec_cache_lock);
+}
+
+/*! Looks up the executable in INODE.  If it is cached and has not been
+    written since, copies its layout to IMAGE and returns true. */
+bool exec_cache_lookup(struct inode *inode, struct exec_image *image) {
+    block_sector_t sector = inode_get_inumber(inode);
+    struct list_elem *e;
+    bool found = false;
+
+    lock_acquire(&exec_cache_lock);
+    for (e = list_begin(&exec_cache); e != list_end(&exec_cache);
+         e = list_next(e)) {
+        struct exec_entry *entry = list_entry(e, struct exec_entry, elem);
+        if (entry->sector != sector) {
+            continue;
+        }
+
+        if (entry->generation == inode_generation(entry->inode) &&
+            !inode_is_removed(entry->inode)) {
+            *image = entry->image;
+            list_remove(&entry->elem);
+            list_push_front(&exec_cache, &entry->elem);
+            found = true;
+        }
+        else {
+            exec_entry_drop(entry);
+        }
+        break;
+    }
+    lock_release(&exec_cache_lock);
+
+    return found;
+}
+
+/*! Caches IMAGE as the layout of the executable in INODE, evicting the
+    least recently used entry if the cache is full.  Does nothing if memory
+    is short. */
+void exec_cache_insert(struct inode *inode, const struct exec_image *image) {
+    block_sector_t sector = inode_get_inumber(inode);
+    struct exec_entry *entry;
+    struct list_elem *e;
+
+    lock_acquire(&exec_cache_lock);
+    for (e = list_begin(&exec_cache); e != list_end(&exec_cache);
+         e = list_next(e)) {
+        entry = list_entry(e, struct exec_entry, elem);
+        if (entry->sector == sector) {
+            exec_entry_drop(entry);
+            break;
+        }
+    }
+
+    entry = malloc(sizeof *entry);
+    if (entry != NULL) {
+        entry->inode = inode_reopen(inode);
+        entry->sector = sector;
+        entry->generation = inode_generation(inode);
+        entry->image = *image;
+        list_push_front(&exec_cache, &entry->elem);
+        exec_cache_cnt++;
+
+        if (exec_cache_cnt > EXEC_CACHE_SIZE) {
+            exec_entry_drop(list_entry(list_back(&exec_cache),
+                                       struct exec_entry, elem));
+        }
+    }
+    lock_release(&exec_cache_lock);
+}
+
+/*! Drops the entries of executables that have been removed, releasing
+    their inodes so that their blocks can be freed. */
+void exec_cache_prune(void) {
+    struct list_elem *e;
+
+    lock_acquire(&exec_cache_lock);
+    e = list_begin(&exec_cache);
+    while (e != list_end(&exec_cache)) {
+        struct exec_entry *entry = list_entry(e, struct exec_entry, elem);
+        e = list_next(e);
+        if (inode_is_removed(entry->inode)) {
+            exec_entry_drop(entry);
+        }
+    }
+    lock_release(&exec_cache_lock);
+}
+
+/*! Removes ENTRY from the cache and frees it.  The cache's lock must be
+    held. */
+static void exec_entry_drop(struct exec_entry *entry) {
+    ASSERT(lock_held_by_current_thread(&exec_cache_lock));
+
+    list_remove(&entry->elem);
+    exec_cache_cnt--;
+    inode_close(entry->inode);
+    free(entry);
+}
@@ -0,0 +1,39 @@
+/*! \file exec-cache.h
+ *
+ * Declarations for the cache of parsed executables.
+ */
+
+#ifndef USERPROG_EXEC_CACHE_H
+#define USERPROG_EXEC_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*! Most loadable segments an executable may have and still be cached. */
+#define EXEC_SEGMENTS 8
+
+struct inode;
+
+/*! A loadable segment, already checked and rounded out to whole pages. */
+struct exec_segment {
+    uint32_t file_page;         /*!< Page-aligned offset in the file. */
+    uint32_t mem_page;          /*!< Page-aligned user virtual address. */
+    uint32_t read_bytes;        /*!< Bytes read from the file. */
+    uint32_t zero_bytes;        /*!< Bytes zeroed after READ_BYTES. */
+    bool writable;              /*!< Whether the pages are writable. */
+};
+
+/*! What load() needs from an executable's ELF headers. */
+struct exec_image {
+    uint32_t entry;                                 /*!< Entry point. */
+    size_t segment_cnt;                             /*!< Segments in use. */
+    struct exec_segment segments[EXEC_SEGMENTS];    /*!< Loadable segments. */
+};
+
+void exec_cache_init(void);
+bool exec_cache_lookup(struct inode *inode, struct exec_image *image);
+void exec_cache_insert(struct inode *inode, const struct exec_image *image);
+void exec_cache_prune(void);
+
+#endif /* userprog/exec-cache.h */
@@ -12,7 +12,9 @@
 #define SEL_CNT         6       /*!< Number of segments. */
 /*! @} */
 
+#ifndef __ASSEMBLER__
 void gdt_init(void);
+#endif
 
 #endif /* userprog/gdt.h */
 
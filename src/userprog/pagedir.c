@@ -8,20 +8,29 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <user/vdata.h>
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "userprog/vdata.h"
 
 static uint32_t *active_pd(void);
 static void invalidate_pagedir(uint32_t *);
 
 /*! Creates a new page directory that has mappings for kernel virtual
-    addresses, but none for user virtual addresses.  Returns the new page
-    directory, or a null pointer if memory allocation fails. */
+    addresses, and for user virtual addresses only the read-only kernel data
+    page at VDATA_ADDR.  Returns the new page directory, or a null pointer if
+    memory allocation fails. */
 uint32_t * pagedir_create(void) {
     uint32_t *pd = palloc_get_page(0);
-    if (pd != NULL)
+    if (pd != NULL) {
         memcpy(pd, init_page_dir, PGSIZE);
+        if (vdata_page() != NULL &&
+            !pagedir_set_page(pd, (void *) VDATA_ADDR, vdata_page(), false)) {
+            palloc_free_page(pd);
+            return NULL;
+        }
+    }
     return pd;
 }
 
@@ -33,6 +42,10 @@ void pagedir_destroy(uint32_t *pd) {
         return;
 
     ASSERT(pd != init_page_dir);
+
+    /* The kernel data page is shared, not owned. */
+    pagedir_clear_page(pd, (void *) VDATA_ADDR);
+
     for (pde = pd; pde < pd + pd_no(PHYS_BASE); pde++)
     if (*pde & PTE_P) {
         uint32_t *pt = pde_get_pt(*pde);
@@ -186,6 +199,21 @@ void pagedir_set_accessed(uint32_t *pd, const void *vpage, bool accessed) {
     }
 }
 
+/*! Sets the writable bit to WRITABLE in the PTE for virtual page VPAGE in
+    PD. */
+void pagedir_set_writable(uint32_t *pd, const void *vpage, bool writable) {
+    uint32_t *pte = lookup_page(pd, vpage, false);
+    if (pte != NULL) {
+        if (writable) {
+            *pte |= PTE_W;
+        }
+        else {
+            *pte &= ~(uint32_t) PTE_W;
+        }
+        invalidate_pagedir(pd);
+    }
+}
+
 /*! Loads page directory PD into the CPU's page directory base register. */
 void pagedir_activate(uint32_t *pd) {
     if (pd == NULL)
@@ -0,0 +1,249 @@
+/*! \file pipe.c
+ *
+ * Pipes.  The data in a pipe is a queue of whole pages.  A writer copies
+ * from user memory straight into the page at the tail of the queue and
+ * starts a new page once it is full.  A reader copies from the page at
+ * the head straight to user memory and frees the page once it has read
+ * it to the end.  Full pages are handed from writer to reader as they
+ * are, so there is no ring to wrap around and no bounce buffer.
+ *
+ * User memory is only touched with the pipe's lock released, since the
+ * copies may fault and the fault handler may need the file system.  One
+ * reader and one writer may copy at the same time; the writer only adds
+ * bytes past the end of the tail page and the reader only frees pages the
+ * writer has filled, so the two never touch the same bytes.
+ */
+
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+#include "userprog/uaccess.h"
+
+/*! A page of data in a pipe. */
+struct pipe_page {
+    struct list_elem elem;      /*!< Element in the pipe's page queue. */
+    uint8_t *data;              /*!< The page itself. */
+    size_t start;               /*!< Offset of the first unread byte. */
+    size_t end;                 /*!< Offset past the last written byte. */
+};
+
+/*! A pipe. */
+struct pipe {
+    struct lock lock;           /*!< Protects the members below. */
+    struct condition readable;  /*!< Signaled on new data or last writer. */
+    struct condition writable;  /*!< Signaled on freed room or last reader. */
+    struct list pages;          /*!< Queue of pipe_pages, oldest first. */
+    size_t page_cnt;            /*!< Number of pages in the queue. */
+    int readers;                /*!< Open read ends. */
+    int writers;                /*!< Open write ends. */
+
+    struct lock read_lock;      /*!< Serializes readers. */
+    struct lock write_lock;     /*!< Serializes writers. */
+};
+
+static bool pipe_empty(struct pipe *pipe);
+static struct pipe_page *pipe_page_alloc(void);
+static void pipe_page_free(struct pipe_page *page);
+
+/*! Creates a pipe with one read end and one write end open.  Returns a
+    null pointer if memory is short. */
+struct pipe *pipe_create(void) {
+    struct pipe *pipe = malloc(sizeof *pipe);
+    if (pipe == NULL) {
+        return NULL;
+    }
+
+    lock_init(&pipe->lock);
+    cond_init(&pipe->readable);
+    cond_init(&pipe->writable);
+    list_init(&pipe->pages);
+    pipe->page_cnt = 0;
+    pipe->readers = 1;
+    pipe->writers = 1;
+    lock_init(&pipe->read_lock);
+    lock_init(&pipe->write_lock);
+    return pipe;
+}
+
+/*! Records that another read end, or write end if WRITER, of PIPE is
+    open. */
+void pipe_dup(struct pipe *pipe, bool writer) {
+    lock_acquire(&pipe->lock);
+    if (writer) {
+        pipe->writers++;
+    }
+    else {
+        pipe->readers++;
+    }
+    lock_release(&pipe->lock);
+}
+
+/*! Closes a read end, or write end if WRITER, of PIPE.  Once every write
+    end is closed readers see end of file, and once every read end is
+    closed writes fail.  The pipe is freed along with its last end. */
+void pipe_close(struct pipe *pipe, bool writer) {
+    bool last;
+
+    lock_acquire(&pipe->lock);
+    if (writer) {
+        ASSERT(pipe->writers > 0);
+        pipe->writers--;
+        cond_broadcast(&pipe->readable, &pipe->lock);
+    }
+    else {
+        ASSERT(pipe->readers > 0);
+        pipe->readers--;
+        cond_broadcast(&pipe->writable, &pipe->lock);
+    }
+    last = pipe->readers == 0 && pipe->writers == 0;
+    lock_release(&pipe->lock);
+
+    if (last) {
+        while (!list_empty(&pipe->pages)) {
+            pipe_page_free(list_entry(list_pop_front(&pipe->pages),
+                                      struct pipe_page, elem));
+        }
+        free(pipe);
+    }
+}
+
+/*! Reads up to SIZE bytes from PIPE into user buffer UBUF, waiting until
+    at least one byte is available.  Returns the number of bytes read, 0 at
+    end of file, or -1 if UBUF is not writable user memory. */
+int pipe_read(struct pipe *pipe, void *ubuf, size_t size) {
+    uint8_t *dst = ubuf;
+    size_t bytes_read = 0;
+    bool ok = true;
+
+    lock_acquire(&pipe->read_lock);
+    lock_acquire(&pipe->lock);
+    while (size > 0 && pipe_empty(pipe) && pipe->writers > 0) {
+        cond_wait(&pipe->readable, &pipe->lock);
+    }
+
+    while (bytes_read < size && !pipe_empty(pipe)) {
+        struct pipe_page *page = list_entry(list_front(&pipe->pages),
+                                            struct pipe_page, elem);
+        size_t chunk = page->end - page->start;
+        if (chunk > size - bytes_read) {
+            chunk = size - bytes_read;
+        }
+
+        lock_release(&pipe->lock);
+        ok = copy_to_user(dst + bytes_read, page->data + page->start, chunk);
+        lock_acquire(&pipe->lock);
+        if (!ok) {
+            break;
+        }
+
+        page->start += chunk;
+        bytes_read += chunk;
+        if (page->start == PGSIZE) {
+            /* The writer has moved on to a later page. */
+            list_remove(&page->elem);
+            pipe->page_cnt--;
+            pipe_page_free(page);
+            cond_signal(&pipe->writable, &pipe->lock);
+        }
+    }
+    lock_release(&pipe->lock);
+    lock_release(&pipe->read_lock);
+
+    return ok ? (int) bytes_read : ERR;
+}
+
+/*! Writes SIZE bytes from user buffer UBUF into PIPE, waiting for room as
+    needed.  Returns the number of bytes written, which is less than SIZE
+    only if every read end is closed or memory runs out, or -1 if UBUF is
+    not readable user memory. */
+int pipe_write(struct pipe *pipe, const void *ubuf, size_t size) {
+    const uint8_t *src = ubuf;
+    size_t written = 0;
+    bool ok = true;
+
+    lock_acquire(&pipe->write_lock);
+    lock_acquire(&pipe->lock);
+    while (written < size && pipe->readers > 0) {
+        struct pipe_page *tail = NULL;
+        if (!list_empty(&pipe->pages)) {
+            tail = list_entry(list_back(&pipe->pages), struct pipe_page, elem);
+        }
+
+        /* Start a new page once the tail is full. */
+        if (tail == NULL || tail->end == PGSIZE) {
+            if (pipe->page_cnt == PIPE_PAGES) {
+                cond_wait(&pipe->writable, &pipe->lock);
+                continue;
+            }
+            lock_release(&pipe->lock);
+            tail = pipe_page_alloc();
+            lock_acquire(&pipe->lock);
+            if (tail == NULL) {
+                break;
+            }
+            list_push_back(&pipe->pages, &tail->elem);
+            pipe->page_cnt++;
+        }
+
+        size_t chunk = PGSIZE - tail->end;
+        if (chunk > size - written) {
+            chunk = size - written;
+        }
+
+        lock_release(&pipe->lock);
+        ok = copy_from_user(tail->data + tail->end, src + written, chunk);
+        lock_acquire(&pipe->lock);
+        if (!ok) {
+            break;
+        }
+
+        tail->end += chunk;
+        written += chunk;
+        cond_signal(&pipe->readable, &pipe->lock);
+    }
+    lock_release(&pipe->lock);
+    lock_release(&pipe->write_lock);
+
+    return ok ? (int) written : ERR;
+}
+
+/*! Returns true if PIPE holds no unread data.  Every page but the tail is
+    full, so only the head page needs to be checked.  The pipe's lock must
+    be held. */
+static bool pipe_empty(struct pipe *pipe) {
+    struct pipe_page *head;
+
+    if (list_empty(&pipe->pages)) {
+        return true;
+    }
+    head = list_entry(list_front(&pipe->pages), struct pipe_page, elem);
+    return head->start == head->end;
+}
+
+/*! Returns a new empty page for a pipe, or a null pointer if memory is
+    short. */
+static struct pipe_page *pipe_page_alloc(void) {
+    struct pipe_page *page = malloc(sizeof *page);
+    if (page == NULL) {
+        return NULL;
+    }
+    page->data = palloc_get_page(0);
+    if (page->data == NULL) {
+        free(page);
+        return NULL;
+    }
+    page->start = page->end = 0;
+    return page;
+}
+
+/*! Frees PAGE and its data. */
+static void pipe_page_free(struct pipe_page *page) {
+    palloc_free_page(page->data);
+    free(page);
+}
@@ -0,0 +1,23 @@
+/*! \file pipe.h
+ *
+ * Declarations for pipes between processes
+ */
+
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*! Most pages of unread data a pipe holds before writers block. */
+#define PIPE_PAGES 16
+
+struct pipe;
+
+struct pipe *pipe_create(void);
+void pipe_dup(struct pipe *pipe, bool writer);
+void pipe_close(struct pipe *pipe, bool writer);
+int pipe_read(struct pipe *pipe, void *ubuf, size_t size);
+int pipe_write(struct pipe *pipe, const void *ubuf, size_t size);
+
+#endif /* userprog/pipe.h */
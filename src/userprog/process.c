@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/exec-cache.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
@@ -22,12 +23,24 @@
 #ifdef VM
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/vma.h"
 #endif
 
 static int max_args = 1;
 static thread_func start_process NO_RETURN;
 static bool load(const char *cmdline, void (**eip)(void), void **esp);
 static bool setup_args(void **esp, char **argv, int *argc);
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool fork_process(struct thread *cur, struct thread *parent);
+static void fork_undo(struct thread *cur);
+
+/*! What a forking process hands to its child. */
+struct fork_info {
+    struct intr_frame if_;          /*!< Parent's registers at the call. */
+    struct thread *parent;          /*!< Process calling fork. */
+};
+#endif
 
 /*! Starts a new thread running a user program loaded from file_name
     (the first token of CMDLINE). The new
@@ -152,6 +165,119 @@ static void start_process(void *cmdline_) {
     NOT_REACHED();
 }
 
+#ifdef VM
+/*! Starts a new process that is a copy of the current one and resumes
+    from the system call whose interrupt frame is F, with 0 as the
+    result.  The two processes share their memory copy-on-write.  Returns
+    the new process's thread id, or TID_ERROR if it could not be made. */
+tid_t process_fork(const struct intr_frame *f) {
+    struct thread *cur = thread_current();
+    struct fork_info info;
+    tid_t tid;
+
+    info.if_ = *f;
+    info.if_.eax = 0;
+    info.parent = cur;
+    tid = thread_create(cur->name, PRI_DEFAULT, start_fork, &info);
+    if (tid == TID_ERROR) {
+        return TID_ERROR;
+    }
+
+    /* INFO lives on our stack, so wait until the child is done with it. */
+    struct thread *kid = get_child_thread(tid);
+    sema_down(&kid->wait_sema);
+    return cur->loaded ? tid : TID_ERROR;
+}
+
+/*! A thread function that copies the process in INFO_ and starts the
+    copy running. */
+static void start_fork(void *info_) {
+    struct fork_info *info = info_;
+    struct thread *cur = thread_current();
+    struct thread *parent = info->parent;
+    struct intr_frame if_ = info->if_;
+    bool success = fork_process(cur, parent);
+
+    /* Let process_fork know copying is done and if it was successful. */
+    parent->loaded = success;
+    sema_up(&cur->wait_sema);
+
+    if (!success) {
+        fork_undo(cur);
+        thread_exit();
+    }
+
+    /* Start the copy the same way start_process() does. */
+    asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+    NOT_REACHED();
+}
+
+/*! Copy the address space, open files and mappings of PARENT into CUR,
+    the running thread.  Returns false if memory runs out. */
+static bool fork_process(struct thread *cur, struct thread *parent) {
+    struct list_elem *e;
+
+    thread_sup_page_table_init(cur);
+    cur->pagedir = pagedir_create();
+    if (cur->pagedir == NULL) {
+        return false;
+    }
+    process_activate();
+
+    acquire_file_lock();
+    cur->executable = file_reopen(parent->executable);
+    if (cur->executable != NULL) {
+        file_deny_write(cur->executable);
+    }
+    release_file_lock();
+    if (cur->executable == NULL) {
+        return false;
+    }
+
+    if (!vma_tree_fork(cur, parent)
+        || !thread_sup_page_table_fork(cur, parent)) {
+        return false;
+    }
+
+    acquire_file_lock();
+    bool success = fd_table_fork(cur, parent);
+    release_file_lock();
+    if (!success) {
+        return false;
+    }
+
+    for (e = list_begin(&parent->mappings); e != list_end(&parent->mappings);
+         e = list_next(e)) {
+        struct mmap_file *m = list_entry(e, struct mmap_file, mmap_elem);
+        if (add_mmap(cur, m->addr, m->fd, m->mapping) == ERR) {
+            return false;
+        }
+    }
+    cur->num_mappings = parent->num_mappings;
+    cur->esp = parent->esp;
+    return true;
+}
+
+/*! Drop the files and mappings a failed fork_process() copied into CUR.
+    Its memory is freed by process_exit(). */
+static void fork_undo(struct thread *cur) {
+    int fd;
+
+    acquire_file_lock();
+    for (fd = CONSOLE_FD; cur->num_files > 0; fd++) {
+        if (is_existing_fd(cur, fd)) {
+            close_fd(cur, fd);
+        }
+    }
+    release_file_lock();
+    while (!list_empty(&cur->mappings)) {
+        struct mmap_file *m = list_entry(list_front(&cur->mappings),
+                                         struct mmap_file, mmap_elem);
+        remove_mmap(cur, m->mapping);
+    }
+}
+#endif
+
 /*! Waits for thread TID to die and returns its exit status.  If it was
     terminated by the kernel (i.e. killed due to an exception), returns -1.
     If TID is invalid or if it was not a child of the calling process, or if
@@ -305,6 +431,8 @@ struct Elf32_Phdr {
 /*! @} */
 
 static bool setup_stack(void **esp);
+static int read_image(const char *file_name, struct file *file,
+                      struct exec_image *image, bool map);
 static bool validate_segment(const struct Elf32_Phdr *, struct file *);
 static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
                          uint32_t read_bytes, uint32_t zero_bytes,
@@ -315,11 +443,10 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
     Returns true if successful, false otherwise. */
 bool load(const char *file_name, void (**eip) (void), void **esp) {
     struct thread *t = thread_current();
-    struct Elf32_Ehdr ehdr;
+    struct exec_image image;
     struct file *file = NULL;
-    off_t file_ofs;
     bool success = false;
-    int i;
+    size_t i;
 
     /* Allocate and activate page directory. */
     t->pagedir = pagedir_create();
@@ -339,14 +466,68 @@ bool load(const char *file_name, void (**eip) (void), void **esp) {
     /* Keep file open as long as process is running to deny writes. */
     thread_current()->executable = file;
 
+    /* Parse the ELF headers, unless they were parsed by an earlier exec
+       and the file has not changed since. */
+    if (!exec_cache_lookup(file_get_inode(file), &image)) {
+        int segment_cnt = read_image(file_name, file, &image, false);
+        if (segment_cnt < 0)
+            goto done;
+        if (segment_cnt <= EXEC_SEGMENTS) {
+            exec_cache_insert(file_get_inode(file), &image);
+        }
+        else {
+            /* Too many segments to cache.  Read the headers again and map
+               each segment as it is found. */
+            if (read_image(file_name, file, &image, true) < 0)
+                goto done;
+        }
+    }
+
+    /* Map the loadable segments. */
+    for (i = 0; i < image.segment_cnt; i++) {
+        const struct exec_segment *seg = &image.segments[i];
+        if (!load_segment(file, seg->file_page, (void *) seg->mem_page,
+                          seg->read_bytes, seg->zero_bytes, seg->writable))
+            goto done;
+    }
+
+    /* Set up stack. */
+    if (!setup_stack(esp))
+        goto done;
+
+    /* Start address. */
+    *eip = (void (*)(void)) image.entry;
+
+    success = true;
+
+done:
+    /* We arrive here whether the load is successful or not. */
+    return success;
+}
+
+/*! Reads and checks the ELF headers of FILE, named FILE_NAME, and stores
+    its entry point and up to EXEC_SEGMENTS of its loadable segments in
+    IMAGE.  If MAP, each loadable segment is instead mapped as soon as it
+    is read, and IMAGE holds none.  Returns the number of loadable
+    segments, or -1 if FILE is not an executable this loader can run or a
+    segment could not be mapped. */
+static int read_image(const char *file_name, struct file *file,
+                      struct exec_image *image, bool map) {
+    struct Elf32_Ehdr ehdr;
+    int load_cnt = 0;
+    off_t file_ofs;
+    int i;
+
     /* Read and verify executable header. */
-    if (file_read(file, &ehdr, sizeof ehdr) != sizeof ehdr ||
+    if (file_read_at(file, &ehdr, sizeof ehdr, 0) != sizeof ehdr ||
         memcmp(ehdr.e_ident, "\177ELF\1\1\1", 7) || ehdr.e_type != 2 ||
         ehdr.e_machine != 3 || ehdr.e_version != 1 ||
         ehdr.e_phentsize != sizeof(struct Elf32_Phdr) || ehdr.e_phnum > 1024) {
         printf("load: %s: error loading executable\n", file_name);
-        goto done;
+        return -1;
     }
+    image->entry = ehdr.e_entry;
+    image->segment_cnt = 0;
 
     /* Read program headers. */
     file_ofs = ehdr.e_phoff;
@@ -354,11 +535,11 @@ bool load(const char *file_name, void (**eip) (void), void **esp) {
         struct Elf32_Phdr phdr;
 
         if (file_ofs < 0 || file_ofs > file_length(file))
-            goto done;
+            return -1;
         file_seek(file, file_ofs);
 
         if (file_read(file, &phdr, sizeof phdr) != sizeof phdr)
-            goto done;
+            return -1;
 
         file_ofs += sizeof phdr;
 
@@ -374,51 +555,50 @@ bool load(const char *file_name, void (**eip) (void), void **esp) {
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-            goto done;
+            return -1;
 
         case PT_LOAD:
             if (validate_segment(&phdr, file)) {
-                bool writable = (phdr.p_flags & PF_W) != 0;
-                uint32_t file_page = phdr.p_offset & ~PGMASK;
-                uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+                struct exec_segment segment;
+                struct exec_segment *seg = &segment;
                 uint32_t page_offset = phdr.p_vaddr & PGMASK;
-                uint32_t read_bytes, zero_bytes;
+                seg->writable = (phdr.p_flags & PF_W) != 0;
+                seg->file_page = phdr.p_offset & ~PGMASK;
+                seg->mem_page = phdr.p_vaddr & ~PGMASK;
                 if (phdr.p_filesz > 0) {
                     /* Normal segment.
                        Read initial part from disk and zero the rest. */
-                    read_bytes = page_offset + phdr.p_filesz;
-                    zero_bytes = (ROUND_UP(page_offset + phdr.p_memsz, PGSIZE) -
-                                 read_bytes);
+                    seg->read_bytes = page_offset + phdr.p_filesz;
+                    seg->zero_bytes = (ROUND_UP(page_offset + phdr.p_memsz,
+                                                PGSIZE) - seg->read_bytes);
                 }
                 else {
                     /* Entirely zero.
                        Don't read anything from disk. */
-                    read_bytes = 0;
-                    zero_bytes = ROUND_UP(page_offset + phdr.p_memsz, PGSIZE);
+                    seg->read_bytes = 0;
+                    seg->zero_bytes = ROUND_UP(page_offset + phdr.p_memsz,
+                                               PGSIZE);
+                }
+
+                if (map) {
+                    if (!load_segment(file, seg->file_page,
+                                      (void *) seg->mem_page, seg->read_bytes,
+                                      seg->zero_bytes, seg->writable))
+                        return -1;
                 }
-                if (!load_segment(file, file_page, (void *) mem_page,
-                                  read_bytes, zero_bytes, writable))
-                    goto done;
+                else if (image->segment_cnt < EXEC_SEGMENTS) {
+                    image->segments[image->segment_cnt++] = segment;
+                }
+                load_cnt++;
             }
             else {
-                goto done;
+                return -1;
             }
             break;
         }
     }
 
-    /* Set up stack. */
-    if (!setup_stack(esp))
-        goto done;
-
-    /* Start address. */
-    *eip = (void (*)(void)) ehdr.e_entry;
-
-    success = true;
-
-done:
-    /* We arrive here whether the load is successful or not. */
-    return success;
+    return load_cnt;
 }
 
 /* load() helpers. */
@@ -485,8 +665,12 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
     ASSERT(pg_ofs(upage) == 0);
     ASSERT(ofs % PGSIZE == 0);
 
+#ifdef VM
+    /* Record the segment; its pages are read in when first touched. */
+    return vma_create(thread_current(), upage, read_bytes + zero_bytes,
+                      file, ofs, read_bytes, writable, false) != NULL;
+#else
     file_seek(file, ofs);
-    off_t offset = ofs;
     while (read_bytes > 0 || zero_bytes > 0) {
         /* Calculate how to fill this page.
            We will read PAGE_READ_BYTES bytes from FILE
@@ -495,13 +679,6 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
         size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
         /* Get a page of memory. */
-#ifdef VM
-        struct sup_page *page = sup_page_file_create(file, offset, upage,
-                page_read_bytes, page_zero_bytes, writable);
-        if (page == NULL) {
-            return false;
-        }
-#else
         uint8_t *kpage = palloc_get_page(PAL_ZERO);
         if (kpage == NULL) {
             return false;
@@ -519,15 +696,14 @@ static bool load_segment(struct file *file, off_t ofs, uint8_t *upage,
             palloc_free_page(kpage);
             return false;
         }
-#endif
 
         /* Advance. */
         read_bytes -= page_read_bytes;
         zero_bytes -= page_zero_bytes;
         upage += PGSIZE;
-        offset += PGSIZE;
     }
     return true;
+#endif
 }
 
 /*! Create a minimal stack by mapping a zeroed page at the top of
@@ -8,6 +8,10 @@
 
 bool install_page(void *upage, void *kpage, bool writable); 
 tid_t process_execute(const char *args);
+#ifdef VM
+struct intr_frame;
+tid_t process_fork(const struct intr_frame *f);
+#endif
 int process_wait(tid_t);
 void process_exit(void);
 void process_activate(void);
@@ -1,7 +1,10 @@
 #include "userprog/syscall.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <syscall-nr.h>
+#include <user/ring.h>
+#include <user/rusage.h>
 #include <user/syscall.h>
 #include "devices/input.h"
 #include "devices/shutdown.h"
@@ -10,14 +13,22 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/exec-cache.h"
+#include "userprog/pipe.h"
 #include "userprog/process.h"
+#include "userprog/tss.h"
+#include "userprog/uaccess.h"
 #ifdef VM
+#include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/vma.h"
 #endif
 
 /* Protect filesys calls. */
@@ -26,15 +37,27 @@ static struct lock filesys_lock;
 #endif
 
 static void syscall_handler(struct intr_frame *);
+static void syscall_dispatch(struct intr_frame *f, int syscall_no,
+                             const uint32_t *arg);
+static bool cpu_has_sysenter(void);
+
+/*! Entry point reached through SYSENTER, in sysenter.S. */
+void sysenter_entry(void);
+
+bool syscall_use_sysenter = true;
+
+bool syscall_print_rusage;
+
+/*! Set if SYSENTER has been set up. */
+static bool sysenter_active;
 
 /* Helper functions */
-void *get_arg(struct intr_frame *f, int num);
-void *get_first_arg(struct intr_frame *f);
-void *get_second_arg(struct intr_frame *f);
-void *get_third_arg(struct intr_frame *f);
+static char *copy_in_string(const char *ustr);
+static int ring_run(const struct ring_sqe *sqe);
 
 /* SYSTEM CALLS */
 void sys_halt(void);
+int sys_features(void);
 pid_t sys_exec(const char *cmd_line);
 int sys_wait(pid_t pid);
 /* File manipulation */
@@ -47,11 +70,19 @@ int sys_write(int fd, void *buffer, unsigned size);
 void sys_seek(int fd, unsigned position);
 unsigned sys_tell(int fd);
 void sys_close(int fd);
+int sys_copy_file_range(int in_fd, int in_off, int out_fd, int out_off,
+                        unsigned len);
+int sys_pipe(int *fds);
+int sys_ring_enter(struct ring *ring);
+int sys_getrusage(struct rusage *usage);
+int sys_lseek(int fd, int offset, int whence);
 
 #ifdef VM
 /* Memory mapping */
 mapid_t sys_mmap(int fd, void *addr);
 void sys_munmap(mapid_t mapping);
+/* Processes */
+pid_t sys_fork(struct intr_frame *f);
 #endif
 
 #ifdef CACHE
@@ -63,36 +94,88 @@ bool sys_isdir (int fd);
 int sys_inumber (int fd);
 #endif
 
-/* User memory access */
-static int get_user(const uint8_t *uaddr);
-static bool put_user (uint8_t *udst, uint8_t byteput);
-static bool valid_read_addr(const void *addr) UNUSED;
-static bool valid_write_addr(void *addr) UNUSED;
+/*! Number of argument words taken by each system call. */
+static const uint8_t syscall_argc[] = {
+    [SYS_HALT] = 0, [SYS_EXIT] = 1, [SYS_EXEC] = 1, [SYS_WAIT] = 1,
+    [SYS_CREATE] = 2, [SYS_REMOVE] = 1, [SYS_OPEN] = 1, [SYS_FILESIZE] = 1,
+    [SYS_READ] = 3, [SYS_WRITE] = 3, [SYS_SEEK] = 2, [SYS_TELL] = 1,
+    [SYS_CLOSE] = 1, [SYS_MMAP] = 2, [SYS_MUNMAP] = 1, [SYS_CHDIR] = 1,
+    [SYS_MKDIR] = 1, [SYS_READDIR] = 2, [SYS_ISDIR] = 1, [SYS_INUMBER] = 1,
+    [SYS_FEATURES] = 0, [SYS_FORK] = 0, [SYS_COPY_FILE_RANGE] = 5,
+    [SYS_PIPE] = 1, [SYS_RING_ENTER] = 1, [SYS_GETRUSAGE] = 1,
+    [SYS_LSEEK] = 3
+};
+
+/*! Most argument words any system call takes. */
+#define SYSCALL_MAX_ARGS 5
+
+/*! Argument words that fit in registers for SYSENTER. */
+#define SYSENTER_MAX_ARGS 3
 
 void syscall_init(void) {
     intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
+    if (syscall_use_sysenter && cpu_has_sysenter()) {
+        tss_enable_sysenter(sysenter_entry);
+        sysenter_active = true;
+    }
 #ifndef CACHE
     lock_init(&filesys_lock);
 #endif
 }
 
-static void syscall_handler(struct intr_frame *f UNUSED) {
-    int *fd, *status, *child_pid;
-    void **buffer;
-    unsigned int *size, *initial_size, *position;
-    char **cmd_line;
-    char **file;
-    char **dir, **name;
+/*! Returns true if the CPU implements SYSENTER and SYSEXIT. */
+static bool cpu_has_sysenter(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+
+    /* Early Pentium Pro steppings report the feature without having it. */
+    unsigned family = (eax >> 8) & 0xf, model = (eax >> 4) & 0xf;
+    if (family == 6 && model < 3 && (eax & 0xf) < 3) {
+        return false;
+    }
+    return (edx & (1 << 11)) != 0;
+}
+
+static void syscall_handler(struct intr_frame *f) {
+    int syscall_no;
+    uint32_t arg[SYSCALL_MAX_ARGS];
 
-    if (f == NULL || !valid_read_addr(f->esp)) {
+    /* Fetch the system call number and then all of its arguments in one
+       copy each. */
+    if (f == NULL || !copy_from_user(&syscall_no, f->esp, sizeof syscall_no)) {
+        sys_exit(ERR);
+    }
+    if (syscall_no < 0 ||
+        (size_t) syscall_no >= sizeof syscall_argc / sizeof *syscall_argc) {
+        printf("Unimplemented system call number\n");
         sys_exit(ERR);
     }
-    /* Get the system call number */
-    int syscall_no = *((int *) f->esp);
+    if (!copy_from_user(arg, f->esp + ARG_SIZE,
+                        syscall_argc[syscall_no] * ARG_SIZE)) {
+        sys_exit(ERR);
+    }
+    syscall_dispatch(f, syscall_no, arg);
+}
+
+/*! Handles a system call made through SYSENTER.  The number is in EAX and
+    the arguments in EBX, ESI and EDI, so nothing is read from the user
+    stack. */
+void syscall_sysenter(struct intr_frame *f) {
+    uint32_t arg[SYSCALL_MAX_ARGS] = { f->ebx, f->esi, f->edi };
 
+    /* Longer calls have to come through "int $0x30". */
+    if (f->eax < sizeof syscall_argc / sizeof *syscall_argc &&
+        syscall_argc[f->eax] > SYSENTER_MAX_ARGS) {
+        sys_exit(ERR);
+    }
+    syscall_dispatch(f, f->eax, arg);
+}
+
+/*! Runs system call SYSCALL_NO with arguments ARG, leaving any return
+    value in F's EAX. */
+static void syscall_dispatch(struct intr_frame *f, int syscall_no,
+                             const uint32_t *arg) {
 #ifdef VM
-    void **addr;
-    mapid_t *mapping;
     thread_current()->esp = f->esp;
 #endif
 
@@ -102,94 +185,88 @@ static void syscall_handler(struct intr_frame *f UNUSED) {
             sys_halt();
             break;
         case SYS_EXIT:
-            status = (int *) get_first_arg(f);
-            sys_exit(*status);
-            f->eax = *status;
+            sys_exit((int) arg[0]);
             break;
         case SYS_EXEC:
-            cmd_line = (char **) get_first_arg(f);
-            f->eax = sys_exec(*cmd_line);
+            f->eax = sys_exec((const char *) arg[0]);
             break;
         case SYS_WAIT:
-            child_pid = (pid_t *) get_first_arg(f);
-            f->eax = sys_wait(*child_pid);
+            f->eax = sys_wait((pid_t) arg[0]);
             break;
         case SYS_CREATE:
-            file = (char **) get_first_arg(f);
-            initial_size = (unsigned *) get_second_arg(f);
-            f->eax = sys_create(*file, *initial_size);
+            f->eax = sys_create((const char *) arg[0], arg[1]);
             break;
         case SYS_REMOVE:
-            file = (char **) get_first_arg(f);
-            f->eax = sys_remove(*file);
+            f->eax = sys_remove((const char *) arg[0]);
             break;
         case SYS_OPEN:
-            file = (char **) get_first_arg(f);
-            f->eax = sys_open(*file);
+            f->eax = sys_open((const char *) arg[0]);
             break;
         case SYS_FILESIZE:
-            fd = (int *) get_first_arg(f);
-            f->eax = sys_filesize(*fd);
+            f->eax = sys_filesize((int) arg[0]);
             break;
         case SYS_READ:
-            fd = (int *) get_first_arg(f);
-            buffer = get_second_arg(f);
-            size = (unsigned int *) get_third_arg(f);
-            f->eax = sys_read(*fd, *buffer, *size);
+            f->eax = sys_read((int) arg[0], (void *) arg[1], arg[2]);
             break;
         case SYS_WRITE:
-            fd = (int *) get_first_arg(f);
-            buffer = (void **) get_second_arg(f);
-            size = (unsigned int *) get_third_arg(f);
-            f->eax = sys_write(*fd, *buffer, *size);
+            f->eax = sys_write((int) arg[0], (void *) arg[1], arg[2]);
             break;
         case SYS_SEEK:
-            fd = (int *) get_first_arg(f);
-            position = (unsigned int *) get_second_arg(f);
-            sys_seek(*fd, *position);
+            sys_seek((int) arg[0], arg[1]);
             break;
         case SYS_TELL:
-            fd = (int *) get_first_arg(f);
-            f->eax = sys_tell(*fd);
+            f->eax = sys_tell((int) arg[0]);
             break;
         case SYS_CLOSE:
-            fd = (int *) get_first_arg(f);
-            sys_close(*fd);
+            sys_close((int) arg[0]);
+            break;
+        case SYS_COPY_FILE_RANGE:
+            f->eax = sys_copy_file_range((int) arg[0], (int) arg[1],
+                                         (int) arg[2], (int) arg[3], arg[4]);
+            break;
+        case SYS_PIPE:
+            f->eax = sys_pipe((int *) arg[0]);
+            break;
+        case SYS_RING_ENTER:
+            f->eax = sys_ring_enter((struct ring *) arg[0]);
+            break;
+        case SYS_GETRUSAGE:
+            f->eax = sys_getrusage((struct rusage *) arg[0]);
+            break;
+        case SYS_LSEEK:
+            f->eax = sys_lseek((int) arg[0], (int) arg[1], (int) arg[2]);
             break;
 #ifdef VM
         case SYS_MMAP:
-            fd = (int *) get_first_arg(f);
-            addr = (void **) get_second_arg(f);
-            f->eax = sys_mmap(*fd, *addr);
+            f->eax = sys_mmap((int) arg[0], (void *) arg[1]);
             break;
         case SYS_MUNMAP:
-            mapping = (mapid_t *) get_first_arg(f);
-            sys_munmap(*mapping);
+            sys_munmap((mapid_t) arg[0]);
+            break;
+        case SYS_FORK:
+            f->eax = sys_fork(f);
             break;
 #endif
 #ifdef CACHE
         case SYS_CHDIR:
-            dir = get_first_arg(f);
-            f->eax = sys_chdir(*dir);
+            f->eax = sys_chdir((const char *) arg[0]);
             break;
         case SYS_MKDIR:
-            dir = get_first_arg(f);
-            f->eax = sys_mkdir(*dir);
+            f->eax = sys_mkdir((const char *) arg[0]);
             break;
         case SYS_READDIR:
-            fd = (int *) get_first_arg(f);
-            name = get_second_arg(f);
-            f->eax = sys_readdir(*fd, *name);
+            f->eax = sys_readdir((int) arg[0], (char *) arg[1]);
             break;
         case SYS_ISDIR:
-            fd = (int *) get_first_arg(f);
-            f->eax = sys_isdir(*fd);
+            f->eax = sys_isdir((int) arg[0]);
             break;
         case SYS_INUMBER:
-            fd = (int *) get_first_arg(f);
-            f->eax = sys_inumber(*fd);
+            f->eax = sys_inumber((int) arg[0]);
             break;
 #endif
+        case SYS_FEATURES:
+            f->eax = sys_features();
+            break;
         default:
             printf("Unimplemented system call number\n");
             sys_exit(ERR);
@@ -197,25 +274,49 @@ static void syscall_handler(struct intr_frame *f UNUSED) {
     }
 }
 
-/*! Returns *num*th argument. Verifies before returning. */
-void *get_arg(struct intr_frame *f, int num) {
-    void *arg = f->esp + ARG_SIZE * num;
-    if (!valid_read_addr(arg)) {
-        sys_exit(ERR);
+/*! Copies the string at user address USTR into a newly allocated page,
+    which the caller must free.  Terminates the process if USTR is not
+    readable.  Returns NULL if the string does not fit in a page or memory
+    is short. */
+static char *copy_in_string(const char *ustr) {
+    char *kstr = palloc_get_page(0);
+    if (kstr == NULL) {
+        return NULL;
     }
-    return arg;
-}
 
-void *get_first_arg(struct intr_frame *f) {
-    return get_arg(f, 1);
-}
-
-void *get_second_arg(struct intr_frame *f) {
-    return get_arg(f, 2);
+    int length = strncpy_from_user(kstr, ustr, PGSIZE);
+    if (length < 0) {
+        palloc_free_page(kstr);
+        sys_exit(ERR);
+    }
+    if (length == PGSIZE) {
+        palloc_free_page(kstr);
+        return NULL;
+    }
+    return kstr;
 }
 
-void *get_third_arg(struct intr_frame *f) {
-    return get_arg(f, 3);
+/*! Runs the operation queued in SQE by calling the system call it names,
+    and returns its result.  Calls that return nothing complete with 0. */
+static int ring_run(const struct ring_sqe *sqe) {
+    switch (sqe->op) {
+        case RING_NOP:
+            return 0;
+        case RING_READ:
+            return sys_read(sqe->fd, sqe->buf, sqe->len);
+        case RING_WRITE:
+            return sys_write(sqe->fd, sqe->buf, sqe->len);
+        case RING_SEEK:
+            sys_seek(sqe->fd, sqe->len);
+            return 0;
+        case RING_OPEN:
+            return sys_open(sqe->buf);
+        case RING_CLOSE:
+            sys_close(sqe->fd);
+            return 0;
+        default:
+            return ERR;
+    }
 }
 
 /*! Acquire file locks. Need two because bochs might have files and their
@@ -239,10 +340,29 @@ void sys_halt(void) {
     shutdown_power_off();
 }
 
+/*! Returns the SYSCALL_FEATURE_* bits for optional kernel features. */
+int sys_features(void) {
+    return sysenter_active ? SYSCALL_FEATURE_SYSENTER : 0;
+}
+
 /*! Terminates current user program. */
 void sys_exit(int status) {
     struct thread *cur = thread_current();
     printf("%s: exit(%d)\n", cur->name, status);
+    if (syscall_print_rusage) {
+        const struct rusage *u = &cur->usage;
+        printf("%s: rusage: %"PRId64" user + %"PRId64" kernel ticks, "
+               "%"PRIu32"+%"PRIu32" switches, "
+               "%"PRIu32" minor + %"PRIu32" major faults, "
+               "%"PRIu32" swap-ins, %"PRIu32" swap-outs, "
+               "%"PRIu64" bytes read, %"PRIu64" written, "
+               "%"PRIu32" cache hits, %"PRIu32" misses\n",
+               cur->name, u->user_ticks, u->kernel_ticks,
+               u->voluntary_switches, u->involuntary_switches,
+               u->minor_faults, u->major_faults, u->swap_ins, u->swap_outs,
+               u->bytes_read, u->bytes_written,
+               u->cache_hits, u->cache_misses);
+    }
     cur->exit_status = status;
 
 #ifdef VM
@@ -257,12 +377,11 @@ void sys_exit(int status) {
 #endif
 
     /* Free all file buffers. */
-    struct list_elem *e;
-    while (!list_empty(&cur->open_files)) {
-        e = list_begin(&cur->open_files);
-        struct sys_file *open_file =
-            list_entry(e, struct sys_file, file_elem);
-        sys_close(open_file->fd);
+    int fd;
+    for (fd = CONSOLE_FD; cur->num_files > 0; fd++) {
+        if (is_existing_fd(cur, fd)) {
+            sys_close(fd);
+        }
     }
     thread_exit();
 }
@@ -270,17 +389,19 @@ void sys_exit(int status) {
 /*! Run executable and return new pid. Return ERR if program cannot
     load or run for any reason. */
 pid_t sys_exec(const char *cmd_line) {
-    if (!valid_read_addr(cmd_line)) {
+    char *kcmd_line = copy_in_string(cmd_line);
+    if (kcmd_line == NULL) {
         return ERR;
     }
     struct thread *cur = thread_current();
 
     /* File system call */
     acquire_file_lock();
-    pid_t new_process_pid = process_execute(cmd_line);
+    pid_t new_process_pid = process_execute(kcmd_line);
 
     /* Wait for executable to load. */
     release_file_lock();
+    palloc_free_page(kcmd_line);
 
     if (!cur->loaded) {
         /* Executable failed to load. */
@@ -298,42 +419,53 @@ int sys_wait(pid_t pid) {
 /*! Create new file called *file* initially *initial_size* bytes in size.
     Returns true if successful. */
 bool sys_create(const char *file, unsigned initial_size) {
-    if (!valid_read_addr((void *) file)) {
-        sys_exit(ERR);
+    char *kfile = copy_in_string(file);
+    if (kfile == NULL) {
+        return false;
     }
 
     /* File system call */
     acquire_file_lock();
-    bool success = filesys_create(file, initial_size);
+    bool success = filesys_create(kfile, initial_size);
     release_file_lock();
+    palloc_free_page(kfile);
 
     return success;
 }
 
 /*! Delete file called *file*. Return true if successful. */
 bool sys_remove(const char *file) {
-    if (!valid_read_addr((void *) file)) {
-        sys_exit(ERR);
+    char *kfile = copy_in_string(file);
+    if (kfile == NULL) {
+        return false;
     }
 
     /* File system call */
     acquire_file_lock();
-    bool success = filesys_remove(file);
+    bool success = filesys_remove(kfile);
     release_file_lock();
+    palloc_free_page(kfile);
+
+    /* Let go of the file if it was a cached executable. */
+    if (success) {
+        exec_cache_prune();
+    }
 
     return success;
 }
 
 /*! Open the file called *file*. Returns ERR if file could not be opened. */
 int sys_open(const char *file) {
-    if (!valid_read_addr((void *) file)) {
-        sys_exit(ERR);
+    char *kfile = copy_in_string(file);
+    if (kfile == NULL) {
+        return ERR;
     }
     struct thread *cur = thread_current();
 
     /* File system call */
     acquire_file_lock();
-    struct file *open_file = filesys_open(file);
+    struct file *open_file = filesys_open(kfile);
+    palloc_free_page(kfile);
     if (open_file == NULL) {
         release_file_lock();
         return ERR;
@@ -350,6 +482,9 @@ int sys_open(const char *file) {
 int sys_filesize(int fd) {
     struct thread *cur = thread_current();
     struct file *open_file = get_fd(cur, fd);
+    if (open_file == NULL) {
+        return ERR;
+    }
 
     /* File system call */
     acquire_file_lock();
@@ -360,94 +495,74 @@ int sys_filesize(int fd) {
 }
 
 /*! Read *size* bytes from file open as fd into buffer. Return the number of
-    bytes actually read, 0 at end of file, or -1 if file could not be read. */
+    bytes actually read, 0 at end of file, or -1 if file could not be read.
+    Data is staged a page at a time in a kernel buffer, so no locks are held
+    while the user buffer is faulted in.  Pipes copy straight into the user
+    buffer instead. */
 int sys_read(int fd, void *buffer, unsigned size) {
-    if (!valid_write_addr(buffer) || !valid_write_addr(buffer + size)) {
-        sys_exit(ERR);
-    }
-    size_t bytes_read = 0;
-    /* Pointer to current position in buffer */
-    char *buff = (char *) buffer;
     struct thread *cur = thread_current();
+    struct file *open_file = NULL;
 
-    if (fd == STDIN_FILENO) {
-        /* Read from keyboard input */
-        while ((unsigned) bytes_read < size) {
-            *buff = input_getc();
-            buff++;
-            bytes_read++;
+    if (fd != STDIN_FILENO) {
+        if (!is_existing_fd(cur, fd)) {
+            sys_exit(ERR);
         }
-    } else if (is_existing_fd(cur, fd)) {
-#ifdef VM
-        size_t bytes_left = size;
-        void *temp_buff = buff;
-        while (bytes_left > 0) {
-            size_t offset = temp_buff - pg_round_down(temp_buff);
-            bool success = false;
-            struct sup_page *page = thread_sup_page_get(&cur->sup_page,
-                    temp_buff - offset);
-
-            if (page == NULL) {
-                /* Handle stack access. */
-                if (is_stack_access(temp_buff, cur->esp)) {
-                    page = sup_page_zero_create(temp_buff - offset, true);
-                    success = fetch_data_to_frame(page);
-                    page->status = SWAP_PAGE;
-                }
+        bool writer;
+        struct pipe *pipe = get_fd_pipe(cur, fd, &writer);
+        if (pipe != NULL) {
+            if (writer) {
+                return ERR;
             }
-            else {
-                if (page->loaded) {
-                    pin(page->fte);
-                }
-                else {
-                    success = fetch_data_to_frame(page);
-                }
+            int bytes_read = pipe_read(pipe, buffer, size);
+            if (bytes_read == ERR) {
+                sys_exit(ERR);
             }
-            ASSERT(success || (page != NULL && page->loaded));
+            cur->usage.bytes_read += bytes_read;
+            return bytes_read;
+        }
+        open_file = get_fd(cur, fd);
+    }
 
-            /* Calculate how many bytes we can write for this page. */
-            size_t read_bytes = offset + bytes_left;
-            if (read_bytes > PGSIZE) {
-                read_bytes = PGSIZE - offset;
-            }
-            else {
-                read_bytes = bytes_left;
-            }
+    uint8_t *bounce = palloc_get_page(0);
+    if (bounce == NULL) {
+        return ERR;
+    }
 
-            struct file *open_file = get_fd(cur, fd);
-            if (open_file == NULL) {
-                return ERR;
-            }
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+        size_t chunk = size - bytes_read;
+        if (chunk > PGSIZE) {
+            chunk = PGSIZE;
+        }
 
-            ASSERT(page->loaded);
+        size_t got;
+        if (fd == STDIN_FILENO) {
+            /* Read from keyboard input */
+            for (got = 0; got < chunk; got++) {
+                bounce[got] = input_getc();
+            }
+        }
+        else {
             /* File system call */
             acquire_file_lock();
-            bytes_read += file_read(open_file, temp_buff, read_bytes);
+            got = file_read(open_file, bounce, chunk);
             release_file_lock();
-
-            /* Update remaining bytes. */
-            bytes_left -= read_bytes;
-            temp_buff += read_bytes;
-
-            /* Done with frame. */
-            unpin(page->fte);
         }
-#else
-        /* File system call */
-        acquire_file_lock();
-        struct file *open_file = get_fd(cur, fd);
-        if (open_file == NULL) {
-            release_file_lock();
-            return ERR;
+
+        if (!copy_to_user((uint8_t *) buffer + bytes_read, bounce, got)) {
+            palloc_free_page(bounce);
+            sys_exit(ERR);
         }
+        bytes_read += got;
 
-        bytes_read = file_read(open_file, buffer, size);
-        release_file_lock();
-#endif
-    } else {
-        sys_exit(ERR);
+        /* End of file. */
+        if (got < chunk) {
+            break;
+        }
     }
 
+    palloc_free_page(bounce);
+    cur->usage.bytes_read += bytes_read;
     return bytes_read;
 }
 
@@ -457,100 +572,82 @@ int sys_read(int fd, void *buffer, unsigned size) {
     is not implemented by the basic file system. The expected behavior is to
     write as many bytes as possible up to end-of-file and return the actual
     number written, or 0 if no bytes could be written at all.
-    Fd 1 writes to the console. */
+    Fd 1 writes to the console.  Writes to a pipe wait for room and fail
+    with -1 once nobody can read it. */
 int sys_write(int fd, void *buffer, unsigned size) {
-    if (!valid_read_addr(buffer) || !valid_read_addr(buffer + size)) {
-        sys_exit(ERR);
-    }
-    int bytes_written = 0;
-
     struct thread *cur = thread_current();
+    struct file *open_file = NULL;
 
-    if (fd == STDOUT_FILENO) {
-        /* Write to console */
-        size_t block_size = MAX_BUF_WRI;
-
-        /* If size greater than several hundred bytes, break up */
-        while (size > bytes_written + block_size) {
-            putbuf((char *)(buffer + bytes_written), block_size);
-            bytes_written += block_size;
+    if (fd != STDOUT_FILENO) {
+        if (!is_existing_fd(cur, fd)) {
+            sys_exit(ERR);
         }
-
-        /* Write remaining bytes */
-        putbuf(buffer + bytes_written, size - bytes_written);
-        bytes_written = size;
-    } else if (is_existing_fd(cur, fd)) {
-#ifdef VM
-        size_t bytes_left = size;
-        void *temp_buff = buffer;
-        while (bytes_left > 0) {
-            size_t offset = temp_buff - pg_round_down(temp_buff);
-            bool success = false;
-            struct sup_page *page = thread_sup_page_get(&cur->sup_page,
-                    temp_buff - offset);
-
-            if (page == NULL) {
-                /* Handle stack access. */
-                if (is_stack_access(temp_buff, cur->esp)) {
-                    page = sup_page_zero_create(temp_buff - offset, true);
-                    success = fetch_data_to_frame(page);
-                    page->status = SWAP_PAGE;
-                }
-            }
-            else {
-                if (page->loaded) {
-                    pin(page->fte);
-                }
-                else {
-                    success = fetch_data_to_frame(page);
-                    ASSERT(success);
-                }
+        bool writer;
+        struct pipe *pipe = get_fd_pipe(cur, fd, &writer);
+        if (pipe != NULL) {
+            if (!writer) {
+                return ERR;
             }
-            ASSERT(success || (page != NULL && page->loaded));
-
-            struct file *open_file = get_fd(cur, fd);
-            if (open_file == NULL || file_is_dir(open_file)) {
+            int bytes_written = pipe_write(pipe, buffer, size);
+            if (bytes_written == ERR) {
                 sys_exit(ERR);
             }
+            cur->usage.bytes_written += bytes_written;
+            /* Nobody left to read. */
+            return bytes_written == 0 && size > 0 ? ERR : bytes_written;
+        }
+        open_file = get_fd(cur, fd);
+        if (open_file == NULL || file_is_dir(open_file)) {
+            sys_exit(ERR);
+        }
+    }
 
-            /* Calculate how many bytes we can write for this page. */
-            size_t write_bytes = offset + bytes_left;
-            if (write_bytes > PGSIZE) {
-                write_bytes = PGSIZE - offset;
-            }
-            else {
-                write_bytes = bytes_left;
-            }
+    uint8_t *bounce = palloc_get_page(0);
+    if (bounce == NULL) {
+        return ERR;
+    }
 
-            ASSERT(page->loaded);
-            /* File system call */
-            acquire_file_lock();
-            bytes_written += file_write(open_file, temp_buff, write_bytes);
-            release_file_lock();
+    size_t bytes_written = 0;
+    while (bytes_written < size) {
+        size_t chunk = size - bytes_written;
+        if (chunk > PGSIZE) {
+            chunk = PGSIZE;
+        }
 
-            /* Update remaining bytes. */
-            bytes_left -= write_bytes;
-            temp_buff += write_bytes;
+        if (!copy_from_user(bounce, (uint8_t *) buffer + bytes_written,
+                            chunk)) {
+            palloc_free_page(bounce);
+            sys_exit(ERR);
+        }
 
-            /* Done with frame. */
-            unpin(page->fte);
+        size_t put;
+        if (fd == STDOUT_FILENO) {
+            /* Write to console, breaking up large writes. */
+            for (put = 0; put < chunk; put += MAX_BUF_WRI) {
+                size_t block_size = chunk - put;
+                if (block_size > MAX_BUF_WRI) {
+                    block_size = MAX_BUF_WRI;
+                }
+                putbuf((char *) bounce + put, block_size);
+            }
+            put = chunk;
         }
-#else
-        acquire_file_lock();
-        struct file *open_file = get_fd(cur, fd);
-        if (open_file == NULL || file_is_dir(open_file)) {
+        else {
+            /* File system call */
+            acquire_file_lock();
+            put = file_write(open_file, bounce, chunk);
             release_file_lock();
-            sys_exit(ERR);
         }
+        bytes_written += put;
 
-        /* File system call */
-        bytes_written = file_write(open_file, buffer, size);
-        release_file_lock();
-#endif
-    } else {
-        sys_exit(ERR);
+        /* Could not extend the file. */
+        if (put < chunk) {
+            break;
+        }
     }
 
+    palloc_free_page(bounce);
+    cur->usage.bytes_written += bytes_written;
     return bytes_written;
 }
 
@@ -589,15 +686,63 @@ unsigned sys_tell(int fd) {
     return position;
 }
 
-/*! Close file descriptor fd. */
-void sys_close(int fd) {
+/*! Moves the position of open file FD to OFFSET bytes from WHENCE, one of
+    the SEEK_* origins.  SEEK_DATA and SEEK_HOLE move to the first byte at
+    or after OFFSET that holds data or lies in a hole; the end of file
+    counts as a hole.  Returns the new position, or -1 if it would be
+    negative, WHENCE is unknown, or SEEK_DATA finds no data. */
+int sys_lseek(int fd, int offset, int whence) {
     struct thread *cur = thread_current();
+    int position = ERR;
 
     struct file *open_file = get_fd(cur, fd);
     if (open_file == NULL) {
         sys_exit(ERR);
     }
 
+    /* File system call */
+    acquire_file_lock();
+    struct inode *inode = file_get_inode(open_file);
+    off_t length = inode_length(inode);
+    switch (whence) {
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = file_tell(open_file) + offset;
+            break;
+        case SEEK_END:
+            position = length + offset;
+            break;
+        case SEEK_DATA:
+            if (offset >= 0 && offset < length) {
+                position = inode_next_data(inode, offset);
+                if (position == length)
+                    position = ERR;
+            }
+            break;
+        case SEEK_HOLE:
+            if (offset >= 0 && offset < length)
+                position = inode_next_hole(inode, offset);
+            break;
+    }
+    if (position < 0)
+        position = ERR;
+    else
+        file_seek(open_file, position);
+    release_file_lock();
+
+    return position;
+}
+
+/*! Close file descriptor fd. */
+void sys_close(int fd) {
+    struct thread *cur = thread_current();
+
+    if (!is_existing_fd(cur, fd)) {
+        sys_exit(ERR);
+    }
+
     /* File system call */
     acquire_file_lock();
     /* Delete file from thread */
@@ -605,65 +750,198 @@ void sys_close(int fd) {
     release_file_lock();
 }
 
+/*! Copies up to LEN bytes from the file open as IN_FD to the file open as
+    OUT_FD without passing them through user memory.  Data is read at
+    IN_OFF and written at OUT_OFF; an offset of -1 means the file's current
+    position, which is then advanced past the data copied.  Returns the
+    number of bytes copied, which is less than LEN if IN_FD ends first, or
+    -1 on failure. */
+int sys_copy_file_range(int in_fd, int in_off, int out_fd, int out_off,
+                        unsigned len) {
+    struct thread *cur = thread_current();
+    struct file *in_file = get_fd(cur, in_fd);
+    struct file *out_file = get_fd(cur, out_fd);
+
+    if (!is_existing_fd(cur, in_fd) || !is_existing_fd(cur, out_fd)) {
+        sys_exit(ERR);
+    }
+    if (in_file == NULL || out_file == NULL) {
+        /* Pipes have no offsets to copy at. */
+        return ERR;
+    }
+#ifdef CACHE
+    if (file_is_dir(in_file) || file_is_dir(out_file)) {
+        return ERR;
+    }
+#endif
+    if (in_off < -1 || out_off < -1 || (int) len < 0) {
+        return ERR;
+    }
+
+    acquire_file_lock();
+    off_t src = in_off == -1 ? file_tell(in_file) : in_off;
+    off_t dst = out_off == -1 ? file_tell(out_file) : out_off;
+    off_t size = len;
+
+    /* Nothing past the end of IN_FD is copied. */
+    if (src < file_length(in_file) && size > file_length(in_file) - src) {
+        size = file_length(in_file) - src;
+    }
+
+    /* Overlapping ranges of one file would read back data already
+       overwritten.  The ends are computed wide, since they may pass
+       the largest off_t. */
+    if (file_get_inode(in_file) == file_get_inode(out_file) &&
+        src < (int64_t) dst + size && dst < (int64_t) src + size) {
+        release_file_lock();
+        return ERR;
+    }
+
+    off_t copied = file_copy_at(out_file, dst, in_file, src, size);
+    if (copied == 0 && size > 0 && src < file_length(in_file)) {
+        /* OUT_FD could not grow. */
+        release_file_lock();
+        return ERR;
+    }
+    if (in_off == -1) {
+        file_seek(in_file, src + copied);
+    }
+    if (out_off == -1) {
+        file_seek(out_file, dst + copied);
+    }
+    release_file_lock();
+    return copied;
+}
+
+/*! Creates a pipe and stores a descriptor for its read end in FDS[0] and
+    for its write end in FDS[1].  Returns 0 if successful or -1 if the
+    process is out of descriptors or memory. */
+int sys_pipe(int *fds) {
+    struct thread *cur = thread_current();
+    int kfds[2];
+
+    struct pipe *pipe = pipe_create();
+    if (pipe == NULL) {
+        return ERR;
+    }
+
+    /* A failed add closes its end, so the pipe goes away with the last. */
+    kfds[0] = add_open_pipe(cur, pipe, false, next_fd(cur));
+    kfds[1] = add_open_pipe(cur, pipe, true, next_fd(cur));
+    if (kfds[0] == ERR || kfds[1] == ERR) {
+        if (kfds[0] != ERR) {
+            close_fd(cur, kfds[0]);
+        }
+        if (kfds[1] != ERR) {
+            close_fd(cur, kfds[1]);
+        }
+        return ERR;
+    }
+
+    if (!copy_to_user(fds, kfds, sizeof kfds)) {
+        sys_exit(ERR);
+    }
+    return 0;
+}
+
+/*! Stores the resources used so far by the process in USAGE.  Returns
+    0. */
+int sys_getrusage(struct rusage *usage) {
+    if (!copy_to_user(usage, &thread_current()->usage, sizeof *usage)) {
+        sys_exit(ERR);
+    }
+    return 0;
+}
+
+/*! Runs the operations queued in the submission queue of RING, in order,
+    and posts the result of each to its completion queue.  Stops early if
+    the completion queue fills up.  Returns the number of operations run,
+    or -1 if the queue indexes are inconsistent. */
+int sys_ring_enter(struct ring *ring) {
+    uint32_t idx[4];
+    int done = 0;
+
+    /* sq_head, sq_tail, cq_head and cq_tail, in that order. */
+    if (!copy_from_user(idx, ring, sizeof idx)) {
+        sys_exit(ERR);
+    }
+    uint32_t sq_head = idx[0], sq_tail = idx[1];
+    uint32_t cq_head = idx[2], cq_tail = idx[3];
+    if (sq_tail - sq_head > RING_ENTRIES || cq_tail - cq_head > RING_ENTRIES) {
+        return ERR;
+    }
+
+    while (sq_head != sq_tail && cq_tail - cq_head < RING_ENTRIES) {
+        struct ring_sqe sqe;
+        struct ring_cqe cqe;
+
+        if (!copy_from_user(&sqe, &ring->sq[sq_head % RING_ENTRIES],
+                            sizeof sqe)) {
+            sys_exit(ERR);
+        }
+        cqe.user_data = sqe.user_data;
+        cqe.result = ring_run(&sqe);
+        if (!copy_to_user(&ring->cq[cq_tail % RING_ENTRIES], &cqe,
+                          sizeof cqe)) {
+            sys_exit(ERR);
+        }
+        sq_head++;
+        cq_tail++;
+        done++;
+    }
+
+    if (!copy_to_user(&ring->sq_head, &sq_head, sizeof sq_head) ||
+        !copy_to_user(&ring->cq_tail, &cq_tail, sizeof cq_tail)) {
+        sys_exit(ERR);
+    }
+    return done;
+}
+
 #ifdef VM
 /*! Maps the file open as FD into the process's virtual address space.
     The entire file is mapped as consecutive pages starting at ADDR.
     Returns mapping id that is unique within the process, or -1 on failure. */
 mapid_t sys_mmap (int fd, void *addr) {
     struct thread *cur = thread_current();
-    struct file *open_file = file_reopen(get_fd(cur, fd));
 
     /* Cannot map FD 0 or FD 1 */
     if (fd == 0 || fd == 1) {
         return ERR;
     }
-    /* File must be not NULL and file must have length > 0 */
-    if (open_file == NULL || file_length(open_file) == 0) {
-        return ERR;
-    }
     /* ADDR must not be 0 and ADDR must be page aligned */
     if (addr == 0 || pg_ofs(addr) != 0) {
         return ERR;
     }
 
-    /* Page range cannot overlap with other pages in use */
-    void *upage = addr;
-    while (upage < addr + file_length(open_file)) {
-        if (thread_sup_page_get(&cur->sup_page, upage) != NULL) {
-            return ERR;
-        }
-        upage += PGSIZE;
+    struct file *fd_file = get_fd(cur, fd);
+    if (fd_file == NULL) {
+        return ERR;
     }
+    struct file *open_file = file_reopen(fd_file);
 
-    /* Load file to virtual address */
-    upage = addr;
-    uint32_t read_bytes = file_length(open_file);
-    off_t offset = 0;
-    bool writable = true;
-    while (read_bytes > 0) {
-        size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-        size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-        ASSERT(thread_sup_page_get(&cur->sup_page, upage) == NULL);
-        struct sup_page *page = sup_page_file_create(open_file, offset, upage,
-                page_read_bytes, page_zero_bytes, writable);
-
-        if (page == NULL) {
-            return ERR;
-        }
-
-        /* Flag indicates that when evicted, write back to file */
-        page->is_mmap = true;
-        page->status = FILE_PAGE;
+    /* File must be not NULL and file must have length > 0 */
+    if (open_file == NULL || file_length(open_file) == 0) {
+        file_close(open_file);
+        return ERR;
+    }
 
-        read_bytes -= page_read_bytes;
-        upage += PGSIZE;
-        offset += PGSIZE;
+    /* Page range cannot overlap other areas or the stack.  The area
+       takes ownership of OPEN_FILE. */
+    off_t length = file_length(open_file);
+    if ((uint8_t *) addr + length > (uint8_t *) PHYS_BASE - MAX_STACK ||
+        vma_create(cur, addr, length, open_file, 0, length, true,
+                   true) == NULL) {
+        file_close(open_file);
+        return ERR;
     }
 
     /* Add mapping to thread's mappings list and return unique mapping id */
     int mapping = next_mapping(cur);
-    return add_mmap(cur, addr, fd, mapping);
+    mapping = add_mmap(cur, addr, fd, mapping);
+    if (mapping == ERR) {
+        vma_remove(cur, vma_find(&cur->vmas, addr));
+    }
+    return mapping;
 }
 
 /*! Unmaps mmapped file by writing file back to disk and evicting frame. */
@@ -675,63 +953,50 @@ void sys_munmap (mapid_t mapping) {
         printf("no mmap file found!\n");
         sys_exit(ERR);
     }
-    void *upage = mmap->addr;
-    struct sup_page *page;
-
-    off_t zero_bytes = 0;
 
-    while (zero_bytes == 0) {
-        /* Write dirty pages back to the file */
-        page = thread_sup_page_get(&cur->sup_page, upage);
-
-        if (page == NULL) {
-            break;
-        }
-        zero_bytes = page->file_stats->zero_bytes;
-
-        /* Delete page */
-        if (page->loaded) {
-            ASSERT(page->fte != NULL);
-            ASSERT(page->is_mmap);
-            ASSERT(page->fte->pin_count == 0);
-            evict_chosen_frame(page->fte, false);
-        }
-        sup_page_delete(&cur->sup_page, upage);
-        ASSERT(thread_sup_page_get(&cur->sup_page, upage) == NULL);
-
-        upage += PGSIZE;
-    }
+    /* Write dirty pages back to the file and drop the area. */
+    struct vm_area *vma = vma_find(&cur->vmas, mmap->addr);
+    ASSERT(vma != NULL && vma->is_mmap);
+    vma_remove(cur, vma);
 
     /* Remove entry from list of mmap files */
     remove_mmap(cur, mapping);
 
 }
+
+/*! Creates a copy of the current process that continues from this call.
+    Returns the child's pid in the parent, 0 in the child, or -1 if the
+    copy could not be made. */
+pid_t sys_fork(struct intr_frame *f) {
+    tid_t tid = process_fork(f);
+    return tid == TID_ERROR ? ERR : tid;
+}
 #endif
 
 #ifdef CACHE
 /*! Changes the current working directory of the process to DIR, which may be
     relative or absolute. Returns true if successful, false on failure. */
-bool sys_chdir (const char *dir) {
+bool sys_chdir (const char *udir) {
     bool success = false;
     char *name = NULL;
     struct dir *parent_dir = NULL;
     struct inode *inode = NULL;
     struct thread *cur = thread_current();
 
+    char *dir = copy_in_string(udir);
+    if (dir == NULL) {
+        return false;
+    }
+
     /* Special case: '/' is root, no need to call dir_lookup */
     if (!strcmp(dir, "/")) {
+        palloc_free_page(dir);
         inode = inode_open(ROOT_DIR_SECTOR);
         goto done;
     }
 
-    /* Copy path to be safe */
-    char *dir_copy = calloc(MAX_PATH_SIZE, 1);
-    if (dir_copy == NULL) {
-        return false;
-    }
-    strlcpy(dir_copy, dir, strlen(dir) + 1);
-
-    if (!(parse_path(dir_copy, &parent_dir, &name))) {
+    if (!(parse_path(dir, &parent_dir, &name))) {
+        palloc_free_page(dir);
         return false;
     }
 
@@ -739,13 +1004,12 @@ bool sys_chdir (const char *dir) {
         success = dir_lookup(parent_dir, name, &inode);
     }
     dir_close(parent_dir);
+    palloc_free_page(dir);
 
     if (!success || !is_dir(inode)) {
-        free(dir_copy);
         return false;
     }
 
-    free(dir_copy);
 done:
     /* Set new dir */
     if (cur->cur_dir_inode != NULL) {
@@ -759,23 +1023,23 @@ done:
 /*! Creates the directory named DIR, which may be relative or absolute.
     Returns true if successful, false on failure. Fails if DIR already exists
     or if any directory name in DIR, besides the last, doesn't already exist. */
-bool sys_mkdir (const char *dir) {
+bool sys_mkdir (const char *udir) {
     block_sector_t inode_sector = 0;
     bool success = false;
     char *name = NULL;
     struct dir *parent_dir = NULL;
 
-    /* Copy path to be safe */
-    char *dir_copy = calloc(MAX_PATH_SIZE, 1);
+    char *dir_copy = copy_in_string(udir);
     if (dir_copy == NULL) {
         return false;
     }
-    strlcpy(dir_copy, dir, strlen(dir) + 1);
     bool valid_path = parse_path(dir_copy, &parent_dir, &name);
 
     if (valid_path) {
-        success = (dir != NULL &&
-            free_map_allocate(1, &inode_sector) &&
+        journal_begin();
+        /* Spread directories over the disk. */
+        success = (free_map_allocate(1, free_map_spread_hint(),
+                                     &inode_sector) &&
             dir_create(inode_sector, NUM_ENTRIES) &&
             dir_add(parent_dir, name, inode_sector));
 
@@ -788,10 +1052,11 @@ bool sys_mkdir (const char *dir) {
         if (!success && inode_sector != 0)
             free_map_release(inode_sector, 1);
         dir_close(parent_dir);
-        free(dir_copy);
+        journal_end();
+        palloc_free_page(dir_copy);
         return success;
     }
-    free(dir_copy);
+    palloc_free_page(dir_copy);
     return false;
 }
 
@@ -813,14 +1078,23 @@ bool sys_readdir (int fd, char *name) {
     /* Open as directory */
     struct dir *dir = dir_open(inode);
 
-    return dir_readdir(dir, name);
-
+    char kname[READDIR_MAX_LEN + 1];
+    if (!dir_readdir(dir, kname)) {
+        return false;
+    }
+    if (!copy_to_user(name, kname, strlen(kname) + 1)) {
+        sys_exit(ERR);
+    }
+    return true;
 }
 
 /*! Returns true if fd represents a directory, false if it represents an
     ordinary file.*/
 bool sys_isdir (int fd) {
     struct file *file = get_fd(thread_current(), fd);
+    if (file == NULL) {
+        return false;
+    }
     struct inode *inode = file_get_inode(file);
     return is_dir(inode);
 }
@@ -829,56 +1103,10 @@ bool sys_isdir (int fd) {
     represent an ordinary file or a directory. */
 int sys_inumber (int fd) {
     struct file *file = get_fd(thread_current(), fd);
+    if (file == NULL) {
+        return ERR;
+    }
     struct inode *inode = file_get_inode(file);
     return inode_get_inumber(inode);
 }
 #endif
-
-/* Returns true if addr is valid for reading */
-static bool valid_read_addr(const void *addr) {
-    /* Check that address is below PHYS_BASE
-       and then attempt to read a byte at the address */
-    return addr != NULL && is_user_vaddr(addr) && (get_user(addr) != ERR);
-}
-
-/* Returns true if addr is valid for writing */
-static bool valid_write_addr(void *addr) {
-    /* Check that address is below PHYS_BASE
-       and then attempt to write a byte '1' to the address */
-    return addr != NULL && is_user_vaddr(addr) && put_user(addr, 1);
-}
-
-/*! Reads a byte at user virtual address UADDR.
-    UADDR must be below PHYS_BASE.
-    Returns the byte value if successful, -1 if a segfault occurred. */
-static int get_user(const uint8_t *uaddr) {
-    int result;
-    asm ("movl $1f, %0; movzbl %1, %0; 1:"
-         : "=&a" (result) : "m" (*uaddr));
-    return result;
-}
-
-/*! Writes BYTE to user address UDST.
-    UDST must be below PHYS_BASE.
-    Returns true if successful, false if a segfault occurred.
-    If written, we will write back to previous byte. */
-static bool put_user (uint8_t *udst, uint8_t byte) {
-    int prev_byte = get_user(udst);
-
-    if (prev_byte == -1) {
-        return false;
-    }
-
-    int error_code;
-    asm ("movl $1f, %0; movb %b2, %1; 1:"
-         : "=&a" (error_code), "=m" (*udst) : "q" (byte));
-
-    bool can_write = (error_code != ERR);
-    if (can_write) {
-        /* Assuming this can be written already */
-        asm ("movl $1f, %0; movb %b2, %1; 1:"
-         : "=&a" (error_code), "=m" (*udst) : "q" (prev_byte));
-    }
-
-    return can_write;
-}
@@ -5,7 +5,20 @@
 #define ARG_SIZE 4
 #define ERR -1
 
+#include <stdbool.h>
+
+struct intr_frame;
+
+/*! Whether system calls may enter through SYSENTER.  Cleared by kernel
+    command-line option "-nosysenter". */
+extern bool syscall_use_sysenter;
+
+/*! Whether processes print their resource usage when they exit.  Set by
+    kernel command-line option "-rusage". */
+extern bool syscall_print_rusage;
+
 void syscall_init(void);
+void syscall_sysenter(struct intr_frame *f);
 void sys_exit(int status);
 void acquire_file_lock(void);
 void release_file_lock(void);
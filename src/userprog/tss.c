@@ -1,5 +1,6 @@
 #include "userprog/tss.h"
 #include <debug.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
 #include "threads/thread.h"
@@ -68,6 +69,20 @@ struct tss {
 /*! Kernel TSS. */
 static struct tss *tss;
 
+/*! Model-specific registers read by SYSENTER.  SYSENTER_ESP plays the role
+    of esp0 for system calls that arrive that way. */
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/*! True once tss_enable_sysenter() has been called. */
+static bool sysenter_enabled;
+
+/*! Writes VALUE to model-specific register MSR. */
+static inline void wrmsr(uint32_t msr, uint32_t value) {
+    asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
 /*! Initializes the kernel TSS. */
 void tss_init(void) {
     /* Our TSS is never used in a call gate or task gate, so only a few fields
@@ -89,5 +104,17 @@ struct tss * tss_get(void) {
 void tss_update(void) {
     ASSERT(tss != NULL);
     tss->esp0 = (uint8_t *) thread_current() + PGSIZE;
+    if (sysenter_enabled) {
+        wrmsr(MSR_SYSENTER_ESP, (uint32_t) tss->esp0);
+    }
+}
+
+/*! Points SYSENTER at ENTRY, running on the same stack as interrupts from
+    user mode.  The CPU must support SYSENTER. */
+void tss_enable_sysenter(void (*entry) (void)) {
+    wrmsr(MSR_SYSENTER_CS, SEL_KCSEG);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t) entry);
+    sysenter_enabled = true;
+    tss_update();
 }
 
@@ -7,6 +7,7 @@ struct tss;
 void tss_init(void);
 struct tss *tss_get(void);
 void tss_update(void);
+void tss_enable_sysenter(void (*entry) (void));
 
 #endif /* userprog/tss.h */
 
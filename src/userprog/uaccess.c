@@ -0,0 +1,123 @@
+/*! \file uaccess.c
+ *
+ * Copies between kernel and user memory.
+ *
+ * User buffers are not checked page by page before they are touched.
+ * Instead the copy loops access them directly, so a not-present page is
+ * brought in by the page fault handler like any other demand-paged or
+ * stack access.  An access that cannot be satisfied would normally be a
+ * kernel bug, but every instruction below that touches user memory has
+ * an entry in the exception table pairing it with a fixup address.  The
+ * page fault handler resumes execution at the fixup, which makes the copy
+ * report failure.
+ */
+
+#include "userprog/uaccess.h"
+#include <stdint.h>
+#include "threads/vaddr.h"
+
+/*! Entry of the exception table.  A fault at INSN resumes at FIXUP. */
+struct exception_entry {
+    uintptr_t insn;             /*!< Instruction that may fault. */
+    uintptr_t fixup;            /*!< Where to continue if it does. */
+};
+
+/*! Bounds of the exception table, set by the linker script. */
+extern const struct exception_entry __start_ex_table[], __stop_ex_table[];
+
+/*! Returns true if SIZE bytes at UADDR lie entirely in user memory. */
+static bool user_range_ok(const void *uaddr, size_t size) {
+    uintptr_t start = (uintptr_t) uaddr;
+    return start + size >= start && start + size <= (uintptr_t) PHYS_BASE;
+}
+
+/*! Copies SIZE bytes from SRC to DST a word at a time, either of which may
+    be in user memory.  Returns the number of bytes left uncopied, which is
+    nonzero only if a user access faulted. */
+static size_t raw_copy(void *dst, const void *src, size_t size) {
+    size_t left;
+    int d0, d1;
+
+    asm volatile ("1: rep movsl\n"
+                  "   movl %3, %0\n"
+                  "2: rep movsb\n"
+                  "   jmp 3f\n"
+                  "4: leal (%3, %0, 4), %0\n"
+                  "3:\n"
+                  ".section __ex_table, \"a\"\n"
+                  "   .align 4\n"
+                  "   .long 1b, 4b\n"
+                  "   .long 2b, 3b\n"
+                  ".previous"
+                  : "=&c" (left), "=&D" (d0), "=&S" (d1)
+                  : "r" (size & 3), "0" (size / 4), "1" (dst), "2" (src)
+                  : "memory");
+    return left;
+}
+
+/*! Copies SIZE bytes from user address USRC to kernel buffer DST.
+    Returns false if any part of the source is not readable user memory. */
+bool copy_from_user(void *dst, const void *usrc, size_t size) {
+    return user_range_ok(usrc, size) && raw_copy(dst, usrc, size) == 0;
+}
+
+/*! Copies SIZE bytes from kernel buffer SRC to user address UDST.
+    Returns false if any part of the destination is not writable user
+    memory. */
+bool copy_to_user(void *udst, const void *src, size_t size) {
+    return user_range_ok(udst, size) && raw_copy(udst, src, size) == 0;
+}
+
+/*! Copies the null-terminated string at user address USRC into DST, which
+    has room for SIZE bytes.  Returns the length of the string, or SIZE if
+    no null terminator was found in the first SIZE bytes, in which case
+    DST is not terminated.  Returns -1 if the string is not readable user
+    memory. */
+int strncpy_from_user(char *dst, const char *usrc, size_t size) {
+    size_t limit = size;
+    int result;
+    int d0, d1, d2, d3;
+
+    if (!is_user_vaddr(usrc))
+        return -1;
+    if (limit > (size_t) ((const char *) PHYS_BASE - usrc))
+        limit = (const char *) PHYS_BASE - usrc;
+
+    asm volatile ("   testl %1, %1\n"
+                  "   jz 2f\n"
+                  "0: lodsb\n"
+                  "   stosb\n"
+                  "   testb %%al, %%al\n"
+                  "   jz 1f\n"
+                  "   decl %1\n"
+                  "   jnz 0b\n"
+                  "1: subl %1, %0\n"
+                  "   jmp 2f\n"
+                  "3: movl $-1, %0\n"
+                  "2:\n"
+                  ".section __ex_table, \"a\"\n"
+                  "   .align 4\n"
+                  "   .long 0b, 3b\n"
+                  ".previous"
+                  : "=r" (result), "=&c" (d0), "=&S" (d1), "=&D" (d2),
+                    "=&a" (d3)
+                  : "0" (limit), "1" (limit), "2" (usrc), "3" (dst)
+                  : "memory");
+
+    /* A string running into kernel memory is as bad as a fault. */
+    if (result == (int) limit && limit < size)
+        return -1;
+    return result;
+}
+
+/*! Returns the fixup address for a fault at kernel instruction EIP, or
+    NULL if EIP is not allowed to fault. */
+void *uaccess_fixup(const void *eip) {
+    const struct exception_entry *e;
+
+    for (e = __start_ex_table; e < __stop_ex_table; e++) {
+        if (e->insn == (uintptr_t) eip)
+            return (void *) e->fixup;
+    }
+    return NULL;
+}
@@ -0,0 +1,18 @@
+/*! \file uaccess.h
+ *
+ * Declarations for copying data between the kernel and user memory
+ */
+
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool copy_from_user(void *dst, const void *usrc, size_t size);
+bool copy_to_user(void *udst, const void *src, size_t size);
+int strncpy_from_user(char *dst, const char *usrc, size_t size);
+
+void *uaccess_fixup(const void *eip);
+
+#endif /* userprog/uaccess.h */
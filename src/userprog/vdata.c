@@ -0,0 +1,73 @@
+/*! \file vdata.c
+ *
+ * A page of kernel data mapped read-only into every process at VDATA_ADDR,
+ * so that programs can read the time and a few global counters without a
+ * system call.  The timer interrupt is the only writer.  It makes the
+ * sequence count odd while it updates the page and even again when done,
+ * and readers in lib/user/vdata.c retry around any update they overlap.
+ */
+
+#include "userprog/vdata.h"
+#include <debug.h>
+#include <user/vdata.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/exception.h"
+
+/*! How often, in ticks, the free frame count is refreshed.  Counting
+    takes a scan of the user pool's bitmap. */
+#define FREE_FRAMES_PERIOD (TIMER_FREQ / 10)
+
+/*! The page, or NULL before vdata_init(). */
+static struct vdata *vdata;
+
+/*! Allocates the page.  The timer must already be calibrated. */
+void vdata_init(void) {
+    struct vdata *vd = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+    uint64_t tsc_per_tick = timer_tsc_per_tick();
+
+    vd->ns_per_tick = 1000 * 1000 * 1000 / TIMER_FREQ;
+    if (tsc_per_tick != 0 && tsc_per_tick <= UINT32_MAX) {
+        /* Find the most precise TSC_MULT that fits in 32 bits. */
+        uint32_t shift = 32;
+        uint64_t mult = ((uint64_t) vd->ns_per_tick << shift) / tsc_per_tick;
+        while (mult > UINT32_MAX) {
+            shift--;
+            mult = ((uint64_t) vd->ns_per_tick << shift) / tsc_per_tick;
+        }
+        vd->tsc_per_tick = tsc_per_tick;
+        vd->tsc_mult = mult;
+        vd->tsc_shift = shift;
+    }
+    vd->ticks = timer_ticks();
+    vd->tick_tsc = timer_tsc();
+    vd->free_frames = palloc_user_free_cnt();
+
+    barrier();
+    vdata = vd;
+}
+
+/*! Updates the page for timer tick TICKS.  Called by the timer interrupt
+    handler. */
+void vdata_tick(int64_t ticks) {
+    if (vdata == NULL) {
+        return;
+    }
+
+    vdata->seq++;
+    barrier();
+    vdata->ticks = ticks;
+    vdata->tick_tsc = timer_tsc();
+    vdata->page_faults = exception_page_fault_cnt();
+    if (ticks % FREE_FRAMES_PERIOD == 0) {
+        vdata->free_frames = palloc_user_free_cnt();
+    }
+    barrier();
+    vdata->seq++;
+}
+
+/*! Returns the page, or NULL before vdata_init(). */
+void *vdata_page(void) {
+    return vdata;
+}
@@ -0,0 +1,15 @@
+/*! \file vdata.h
+ *
+ * Declarations for the kernel data page mapped into user processes.
+ */
+
+#ifndef USERPROG_VDATA_H
+#define USERPROG_VDATA_H
+
+#include <stdint.h>
+
+void vdata_init(void);
+void vdata_tick(int64_t ticks);
+void *vdata_page(void);
+
+#endif /* userprog/vdata.h */
@@ -1,4 +1,5 @@
 #include "vm/frame.h"
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/interrupt.h"
@@ -10,23 +11,39 @@
 #include "vm/page.h"
 #include "vm/swap.h"
 
-/* Frame table. */
-static struct list frame_table;
-/* Points to list_elem that is to be checked for eviction. */
-static struct list_elem *clock_hand;
+/* Frame table, indexed by frame number within the user pool. */
+static struct frame_table_entry *frame_table;
+static size_t frame_cnt;
+static uint8_t *user_base;
+/* Index of the next frame to be checked for eviction. */
+static size_t clock_hand;
 
 /* Lock for frame table. */
 static struct lock frame_lock;
 /* Lock for eviction. */
 static struct lock eviction_lock;
 
+/* Pool of user frames that were zeroed ahead of time. */
+static void *zero_pool[ZERO_POOL_SIZE];
+static size_t zero_pool_cnt;
+static struct lock zero_pool_lock;
+/* Signalled when the pool runs low. */
+static struct semaphore zero_pool_refill;
+/* True from signalling a refill until the refill is over. */
+static bool zero_pool_refilling;
+
+static void *zero_pool_take(void);
+static void frame_zeroer(void *aux);
+
 /* Eviction and helper methods. */
 static void evict_frame(struct frame_table_entry *fte);
-static void increment_clock_hand(void);
+static void evict_shared_frame(struct frame_table_entry *fte);
+static bool frame_accessed(struct frame_table_entry *fte);
 static struct frame_table_entry *choose_frame_to_evict(void);
 static void evict(void);
 
-static void *fte_create(void *frame, struct thread *owner);
+static struct frame_table_entry *fte_create(void *frame,
+                                            struct thread *owner);
 
 /*! Acquire frame lock. */
 void acquire_frame_lock(void) {
@@ -48,107 +65,223 @@ void release_eviction_lock(void) {
     lock_release(&eviction_lock);
 }
 
+/*! Allocate one entry for every frame in the user pool. */
 void frame_table_init(void) {
-    clock_hand = NULL;
-    list_init(&frame_table);
+    size_t i;
+
+    user_base = palloc_user_base();
+    frame_cnt = palloc_user_page_cnt();
+    frame_table = calloc(frame_cnt, sizeof *frame_table);
+    if (frame_table == NULL) {
+        PANIC("Not enough memory for the frame table!");
+    }
+    for (i = 0; i < frame_cnt; i++) {
+        frame_table[i].frame = user_base + i * PGSIZE;
+    }
+
+    clock_hand = 0;
     lock_init(&frame_lock);
     lock_init(&eviction_lock);
+    lock_init(&zero_pool_lock);
+    sema_init(&zero_pool_refill, 1);
+    zero_pool_refilling = true;
 }
 
-/*! Create a new frame table entry. */
-static void *fte_create(void *frame, struct thread *owner) {
-    struct frame_table_entry *fte;
+/*! Start the thread that keeps the pre-zeroed frame pool filled.  It runs
+    at the lowest priority, so zeroing happens when the CPU would
+    otherwise be idle. */
+void frame_zero_pool_init(void) {
+    thread_create("frame-zero", PRI_MIN, frame_zeroer, NULL);
+}
+
+/*! Take a frame from the pre-zeroed pool, or return NULL if it is
+    empty. */
+static void *zero_pool_take(void) {
+    void *frame = NULL;
 
-    fte = malloc(sizeof(struct frame_table_entry));
-    if (fte == NULL) {
-        PANIC("Not enough memory to create frame_table_entry!");
+    lock_acquire(&zero_pool_lock);
+    if (zero_pool_cnt > 0) {
+        frame = zero_pool[--zero_pool_cnt];
     }
-    fte->pin_count = 0;
-    pin(fte);
-    fte->frame = frame;
+    /* A refill cut short by a lack of free frames is asked for again. */
+    if (zero_pool_cnt <= ZERO_POOL_SIZE / 2 && !zero_pool_refilling) {
+        zero_pool_refilling = true;
+        sema_up(&zero_pool_refill);
+    }
+    lock_release(&zero_pool_lock);
+    return frame;
+}
+
+/*! Body of the pool refill thread.  It only uses frames that are free;
+    when user memory runs out it waits for the next refill request
+    rather than evicting anything. */
+static void frame_zeroer(void *aux UNUSED) {
+    if (thread_mlfqs) {
+        thread_set_nice(NICE_MAX);
+    }
+
+    for (;;) {
+        sema_down(&zero_pool_refill);
+        while (zero_pool_cnt < ZERO_POOL_SIZE) {
+            void *frame = palloc_get_page(PAL_USER);
+            if (frame == NULL) {
+                break;
+            }
+            memset(frame, 0, PGSIZE);
+
+            lock_acquire(&zero_pool_lock);
+            if (zero_pool_cnt < ZERO_POOL_SIZE) {
+                zero_pool[zero_pool_cnt++] = frame;
+                frame = NULL;
+            }
+            lock_release(&zero_pool_lock);
+            if (frame != NULL) {
+                palloc_free_page(frame);
+            }
+        }
+
+        lock_acquire(&zero_pool_lock);
+        zero_pool_refilling = false;
+        lock_release(&zero_pool_lock);
+    }
+}
+
+/*! Claim the frame table entry for FRAME. */
+static struct frame_table_entry *fte_create(void *frame,
+                                            struct thread *owner) {
+    size_t idx = ((uint8_t *) frame - user_base) / PGSIZE;
+    struct frame_table_entry *fte;
+
+    ASSERT(idx < frame_cnt);
+    fte = &frame_table[idx];
+    ASSERT(fte->frame == frame);
+
+    acquire_frame_lock();
+    ASSERT(!fte->in_use);
+    fte->in_use = true;
+    fte->pin_count = 1;
+    fte->share_cnt = 0;
     fte->owner = owner;
     fte->pagedir = NULL;
     fte->spte = NULL;
     fte->addr = NULL;
+    release_frame_lock();
     return fte;
 }
 
-/*! Create new frame and frame table entry. */
-struct frame_table_entry *get_frame(void) {
-    /* Allocate page frame*/
-    void *frame = palloc_get_page(PAL_USER | PAL_ZERO);
-    while (frame == NULL) {
+/*! Create new frame and frame table entry.  The frame is zeroed only
+    if ZERO is true; callers that overwrite the whole frame pass false. */
+struct frame_table_entry *get_frame(bool zero) {
+    struct frame_table_entry *fte = try_get_frame(zero);
+    while (fte == NULL) {
         evict();
-        frame = palloc_get_page(PAL_USER | PAL_ZERO);
-    }
-
-    /* Obtain unused frame */
-    struct thread *cur = thread_current();
-    struct frame_table_entry *fte = fte_create(frame, cur);
-
-    if (clock_hand == NULL) {
-        /* Push frame on back of list. */
-        acquire_frame_lock();
-        list_push_back(&frame_table, &fte->frame_table_elem);
-        release_frame_lock();
-    }
-    else {
-        /* Insert before the clock_hand. */
-        acquire_frame_lock();
-        list_insert(clock_hand, &fte->frame_table_elem);
-        release_frame_lock();
-
+        fte = try_get_frame(zero);
     }
     return fte;
 }
 
-/*! Move clock hand (next element to evict) to the next frame in the
-    list. If we reach the end of the list, wrap around to the beginning. */
-static void increment_clock_hand(void) {
-    acquire_frame_lock();
-    if (clock_hand == NULL || clock_hand == list_back(&frame_table)) {
-        clock_hand = list_begin(&frame_table);
+/*! Create new frame and frame table entry if a frame is free, without
+    evicting anything.  Returns NULL if user memory is exhausted. */
+struct frame_table_entry *try_get_frame(bool zero) {
+    /* Zero-fill requests are served from the pre-zeroed pool first. */
+    void *frame = zero ? zero_pool_take() : NULL;
+    if (frame == NULL) {
+        frame = palloc_get_page(PAL_USER | (zero ? PAL_ZERO : 0));
     }
-    else {
-        clock_hand = list_next(clock_hand);
+    /* When memory is short, the pool's frames are fine for anyone. */
+    if (frame == NULL) {
+        frame = zero_pool_take();
     }
-    if (list_size(&frame_table) == 1) {
-        clock_hand = NULL;
+    if (frame == NULL) {
+        return NULL;
     }
-    release_frame_lock();
+
+    /* Obtain unused frame */
+    return fte_create(frame, thread_current());
 }
 
-/*! Choose a frame entry to be evicted based on clock algorithm. */
+/*! Choose a frame entry to be evicted based on clock algorithm.  Eviction
+    is serialized by the eviction lock, and the frame lock is held for the
+    whole sweep so that entries cannot change state underneath it. */
 static struct frame_table_entry *choose_frame_to_evict(void) {
-    ASSERT(!list_empty(&frame_table));
-    if (clock_hand == NULL) {
-        increment_clock_hand();
+    ASSERT(lock_held_by_current_thread(&eviction_lock));
+
+    for (;;) {
+        size_t steps;
+
+        acquire_frame_lock();
+        /* Two sweeps: the first may only clear accessed bits. */
+        for (steps = 0; steps < 2 * frame_cnt; steps++) {
+            struct frame_table_entry *fte = &frame_table[clock_hand];
+            if (++clock_hand == frame_cnt) {
+                clock_hand = 0;
+            }
+
+            if (!fte->in_use || fte->pin_count > 0 || fte->spte == NULL) {
+                continue;
+            }
+            if (frame_accessed(fte)) {
+                continue;
+            }
+
+            release_frame_lock();
+            return fte;
+        }
+        release_frame_lock();
+
+        /* Everything is pinned; let the pinning threads make progress. */
+        thread_yield();
     }
-    acquire_frame_lock();
-    struct frame_table_entry *fte =
-        list_entry(clock_hand, struct frame_table_entry, frame_table_elem);
-    release_frame_lock();
-    struct sup_page *page = fte->spte;
+}
 
-    while (!is_user_vaddr(page->addr)
-            || pagedir_is_accessed(fte->pagedir, fte->addr)
-            || fte->pin_count > 0) {
+/*! Returns true if any page mapping FTE has been accessed since the last
+    call, clearing their accessed bits. */
+static bool frame_accessed(struct frame_table_entry *fte) {
+    struct sup_page *page;
+    bool accessed = false;
 
-        if (fte->pin_count == 0 && is_user_vaddr(page->addr)) {
-            pagedir_set_accessed(fte->pagedir, fte->addr, false);
+    for (page = fte->spte; page != NULL; page = page->share_next) {
+        if (pagedir_is_accessed(page->pagedir, page->addr)) {
+            pagedir_set_accessed(page->pagedir, page->addr, false);
+            accessed = true;
         }
+    }
+    return accessed;
+}
 
-        increment_clock_hand();
-        acquire_frame_lock();
-        fte = list_entry(clock_hand, struct frame_table_entry,
-                frame_table_elem);
-        release_frame_lock();
+/*! Map FTE, which holds a resident page, for PAGE as well.  Used by fork
+    to share frames copy-on-write.  The eviction lock must be held. */
+void frame_share(struct frame_table_entry *fte, struct sup_page *page) {
+    ASSERT(lock_held_by_current_thread(&eviction_lock));
+    ASSERT(fte->spte != NULL);
+
+    page->fte = fte;
+    page->loaded = true;
+    page->share_next = fte->spte->share_next;
+    fte->spte->share_next = page;
+    fte->share_cnt++;
+}
+
+/*! Stop PAGE from using FTE, which other pages still map.  PAGE is left
+    unmapped and not loaded.  The eviction lock must be held. */
+void frame_unshare(struct frame_table_entry *fte, struct sup_page *page) {
+    struct sup_page **p;
 
-        page = fte->spte;
+    ASSERT(lock_held_by_current_thread(&eviction_lock));
+    ASSERT(fte->share_cnt > 1);
+
+    for (p = &fte->spte; *p != page; p = &(*p)->share_next) {
+        ASSERT(*p != NULL);
     }
+    *p = page->share_next;
+    fte->share_cnt--;
+    fte->addr = fte->spte->addr;
+    fte->pagedir = fte->spte->pagedir;
 
-    increment_clock_hand();
-    return fte;
+    page->share_next = NULL;
+    page->fte = NULL;
+    page->loaded = false;
+    pagedir_clear_page(page->pagedir, page->addr);
 }
 
 /*! Wrapper to choose a frame and evict it. */
@@ -171,16 +304,6 @@ void evict_chosen_frame(struct frame_table_entry *fte, bool locked) {
         ASSERT(lock_held_by_current_thread(&eviction_lock));
     }
 
-    /* Make sure clock hand isn't pointing to evicted frame. */
-    if (&fte->frame_table_elem == clock_hand) {
-        if (list_size(&frame_table) > 1) {
-            increment_clock_hand();
-        }
-        else {
-            clock_hand = NULL;
-        }
-    }
-
     evict_frame(fte);
     free_frame(fte);
 
@@ -192,6 +315,11 @@ void evict_chosen_frame(struct frame_table_entry *fte, bool locked) {
 /*! Evict the specified frame. */
 static void evict_frame(struct frame_table_entry *fte) {
     ASSERT(fte->pin_count == 0);
+    if (fte->share_cnt > 1) {
+        evict_shared_frame(fte);
+        return;
+    }
+
     struct sup_page *page = fte->spte;
     ASSERT(page != NULL);
     ASSERT(is_user_vaddr(page->addr));
@@ -202,12 +330,12 @@ static void evict_frame(struct frame_table_entry *fte) {
         if (page->is_mmap) {
             pin(fte);
             /* If dirty, maybe write */
-            struct file *file = page->file_stats->file;
-            size_t bytes = page->file_stats->read_bytes;
+            struct file *file = page->file_stats.file;
+            size_t bytes = page->file_stats.read_bytes;
             ASSERT(file != NULL);
-            off_t offset = page->file_stats->offset;
+            off_t offset = page->file_stats.offset;
             acquire_file_lock();
-            file_write_at(file, page->addr, bytes, offset);
+            file_write_at(file, fte->frame, bytes, offset);
             release_file_lock();
 
             unpin(fte);
@@ -215,7 +343,7 @@ static void evict_frame(struct frame_table_entry *fte) {
         /* Otherwise, write to swap */
         else {
             /* Write to swap */
-            page->swap_position = swap_table_out(page);
+            swap_table_out(page);
         }
     }
     /* Page is no longer loaded */
@@ -229,24 +357,46 @@ static void evict_frame(struct frame_table_entry *fte) {
     page->fte = NULL;
 }
 
+/*! Evict a frame that several processes map after fork.  If its contents
+    cannot be read back from a file they go to one swap slot that all of
+    the pages refer to. */
+static void evict_shared_frame(struct frame_table_entry *fte) {
+    struct sup_page *page;
+    bool dirty = false;
+
+    for (page = fte->spte; page != NULL; page = page->share_next) {
+        dirty = dirty || page->status == SWAP_PAGE
+                || pagedir_is_dirty(page->pagedir, page->addr);
+    }
+    if (dirty) {
+        swap_table_out_shared(fte);
+    }
+
+    page = fte->spte;
+    while (page != NULL) {
+        struct sup_page *next = page->share_next;
+        page->share_next = NULL;
+        page->fte = NULL;
+        page->loaded = false;
+        pagedir_clear_page(page->pagedir, page->addr);
+        page = next;
+    }
+    fte->spte = NULL;
+    fte->share_cnt = 0;
+}
+
 /*! Free memory after safety checks. */
 void free_frame(struct frame_table_entry *fte) {
-    fte->spte = NULL;
-    /* Remove from frame table */
-    acquire_frame_lock();
-    try_remove(&fte->frame_table_elem);
-    release_frame_lock();
+    ASSERT(fte->pin_count == 0); /* Should be unpinned. */
 
-    /* Safety checks. */
-    /* Check if list_elem was removed. */
+    /* Remove from frame table */
     acquire_frame_lock();
-    ASSERT(try_remove(&fte->frame_table_elem) == NULL);
+    ASSERT(fte->in_use);
+    fte->spte = NULL;
+    fte->in_use = false;
     release_frame_lock();
-    ASSERT(fte->pin_count == 0); /* Should be unpinned. */
 
     palloc_free_page(fte->frame);
-    free(fte);
-    fte = NULL;
 }
 
 /*! Pin frame so it isn't swapped before use. */
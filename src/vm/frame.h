@@ -6,17 +6,24 @@
 #ifndef VM_FRAME_H
 #define VM_FRAME_H
 
-#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-/*! Entry for frame table. */
+/*! Number of pre-zeroed frames kept ready for zero-fill faults. */
+#define ZERO_POOL_SIZE 16
+
+/*! Entry for frame table.  There is one per frame of the user pool,
+    and the fields the clock looks at come first. */
 struct frame_table_entry {
-    void *frame;                /*!< Address of frame (kernel virtual address). */
-    void *addr;                 /*!< Address of page (user virtual address). */
-    uint32_t *pagedir;          /*!< Page directory. */
+    bool in_use;                /*!< Frame is allocated. */
+    uint16_t pin_count;         /*!< Should not evict pinned pages. */
+    uint16_t share_cnt;         /*!< Pages mapping the frame, >1 after fork. */
     struct sup_page *spte;      /*!< Supplementary Page Table */
+    uint32_t *pagedir;          /*!< Page directory. */
+    void *addr;                 /*!< Address of page (user virtual address). */
+    void *frame;                /*!< Address of frame (kernel virtual address). */
     struct thread *owner;       /*!< Process that is using the frame. */
-    int pin_count;              /*!< Should not evict pinned pages. */
-    struct list_elem frame_table_elem; /*!< Use list for Clock. */
 };
 
 /* Handle locks. */
@@ -26,7 +33,12 @@ void acquire_eviction_lock(void);
 void release_eviction_lock(void);
 
 void frame_table_init(void);
-struct frame_table_entry *get_frame(void);
+void frame_zero_pool_init(void);
+struct frame_table_entry *get_frame(bool zero);
+struct frame_table_entry *try_get_frame(bool zero);
+
+void frame_share(struct frame_table_entry *fte, struct sup_page *page);
+void frame_unshare(struct frame_table_entry *fte, struct sup_page *page);
 
 void evict_chosen_frame(struct frame_table_entry *fte, bool locked);
 void free_frame(struct frame_table_entry *fte);
@@ -12,8 +12,13 @@
 #include "userprog/syscall.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/vma.h"
+
+/*! Window used by fetch_data_around(), in pages. */
+size_t fault_around_pages = FAULT_AROUND_DEFAULT;
 
 static bool install_page(void *upage, void *kpage, bool writable);
+static bool load_page(struct sup_page *page, struct frame_table_entry *fte);
 static bool get_swap_page(struct sup_page *page,
         struct frame_table_entry *fte);
 static bool get_file_page(struct sup_page *page,
@@ -21,11 +26,13 @@ static bool get_file_page(struct sup_page *page,
 static bool get_zero_page(struct sup_page *page,
         struct frame_table_entry *fte);
 static void sup_page_free(struct hash_elem *e, void *aux);
+static bool sup_page_fork(struct thread *child, struct sup_page *page);
 
 /*! Initialize supplemental page table. */
 void thread_sup_page_table_init(struct thread *t) {
     /* For this simple hash table, no auxiliary data should be necessary */
     hash_init(&t->sup_page, sup_page_hash, sup_page_less, NULL);
+    vma_tree_init(&t->vmas);
 }
 
 /*! Frees a sup_page element. */
@@ -37,20 +44,115 @@ static void sup_page_free(struct hash_elem *e, void *aux UNUSED) {
     struct frame_table_entry *fte = page_to_delete->fte;
     ASSERT(fte == NULL || fte->pin_count == 0);
     if (page_to_delete->loaded && fte != NULL) {
-        evict_chosen_frame(fte, true);
+        if (fte->share_cnt > 1) {
+            /* A forked process still uses the frame. */
+            frame_unshare(fte, page_to_delete);
+        }
+        else if (page_to_delete->is_mmap) {
+            evict_chosen_frame(fte, true);
+        }
+        else {
+            /* Nothing will read the contents back, so skip swap. */
+            page_to_delete->loaded = false;
+            page_to_delete->fte = NULL;
+            pagedir_clear_page(page_to_delete->pagedir, page_to_delete->addr);
+            free_frame(fte);
+        }
+    }
+    if (!page_to_delete->loaded && page_to_delete->status == SWAP_PAGE) {
+        /* Give back the swap space holding the page's contents. */
+        swap_table_discard(page_to_delete);
+    }
+    if (page_to_delete->vma != NULL) {
+        list_remove(&page_to_delete->vma_elem);
     }
-    /* First, free the file stats */
-    free(page_to_delete->file_stats);
-    /* Then free page_to_delete */
     free(page_to_delete);
     page_to_delete = NULL;
 }
 
-/*! Frees a hash table */
+/*! Frees a hash table and the areas its pages came from. */
 void thread_sup_page_table_delete(struct thread *t) {
     acquire_eviction_lock();
     hash_destroy(&t->sup_page, sup_page_free);
     release_eviction_lock();
+    vma_tree_destroy(&t->vmas);
+}
+
+/*! Give CHILD, the running thread, a copy of every page of PARENT.  The
+    areas must already have been copied with vma_tree_fork().  Resident
+    pages share their frame, mapped read-only in both processes until
+    one of them writes it; swapped out pages share their swap slot.
+    Returns false if memory runs out. */
+bool thread_sup_page_table_fork(struct thread *child, struct thread *parent) {
+    struct hash_iterator i;
+    bool success = true;
+
+    acquire_eviction_lock();
+    hash_first(&i, &parent->sup_page);
+    while (success && hash_next(&i)) {
+        success = sup_page_fork(child, hash_entry(hash_cur(&i),
+                                struct sup_page, sup_page_table_elem));
+    }
+    release_eviction_lock();
+    return success;
+}
+
+/*! Add a copy of PAGE to CHILD.  The eviction lock must be held. */
+static bool sup_page_fork(struct thread *child, struct sup_page *page) {
+    struct sup_page *copy;
+
+    /* Mapped pages are brought up to date in the file, which the child
+       reads again through its own mapping. */
+    if (page->is_mmap) {
+        if (page->loaded && pagedir_is_dirty(page->pagedir, page->addr)) {
+            acquire_file_lock();
+            file_write_at(page->file_stats.file, page->fte->frame,
+                          page->file_stats.read_bytes,
+                          page->file_stats.offset);
+            release_file_lock();
+            pagedir_set_dirty(page->pagedir, page->addr, false);
+        }
+        return true;
+    }
+
+    /* Written pages can no longer be read back from the file. */
+    if (page->loaded && pagedir_is_dirty(page->pagedir, page->addr)) {
+        page->status = SWAP_PAGE;
+    }
+
+    copy = malloc(sizeof *copy);
+    if (copy == NULL) {
+        return false;
+    }
+    *copy = *page;
+    copy->fte = NULL;
+    copy->loaded = false;
+    copy->share_next = NULL;
+    copy->zswap = NULL;
+    copy->swap_position = NOT_SWAP;
+    copy->pagedir = child->pagedir;
+
+    if (page->loaded) {
+        if (!pagedir_set_page(child->pagedir, page->addr, page->fte->frame,
+                              false)) {
+            free(copy);
+            return false;
+        }
+        pagedir_set_writable(page->pagedir, page->addr, false);
+        frame_share(page->fte, copy);
+    }
+    else if (page->status == SWAP_PAGE) {
+        copy->swap_position = swap_table_share(page);
+    }
+
+    if (page->vma != NULL) {
+        copy->vma = vma_find(&child->vmas, page->addr);
+        ASSERT(copy->vma != NULL);
+        copy->file_stats.file = copy->vma->file;
+        list_push_back(&copy->vma->pages, &copy->vma_elem);
+    }
+    sup_page_insert(&child->sup_page, copy);
+    return true;
 }
 
 /*! Create a suplemental page. */
@@ -66,13 +168,6 @@ struct sup_page *sup_page_file_create(struct file *file, off_t ofs,
         printf("Not enough space!\n");
         sys_exit(-1);
     }
-    struct file_info *file_stats = malloc(sizeof(struct file_info));
-    if (file_stats == NULL) {
-        printf("Not enough space!\n");
-
-        free(page);
-        sys_exit(-1);
-    }
 
     page->addr = upage;
     ASSERT(pg_ofs(upage) == 0);
@@ -86,18 +181,20 @@ struct sup_page *sup_page_file_create(struct file *file, off_t ofs,
     page->writable = writable;
     page->fte = NULL;
     page->swap_position = NOT_SWAP; /* Not in swap yet */
+    page->zswap = NULL;
     page->loaded = false;
+    page->share_next = NULL;
 
     /* Copy over file data. */
-    page->file_stats = file_stats;
-    page->file_stats->file = file;
-    page->file_stats->offset = ofs;
-    page->file_stats->read_bytes = read_bytes;
-    page->file_stats->zero_bytes = zero_bytes;
+    page->file_stats.file = file;
+    page->file_stats.offset = ofs;
+    page->file_stats.read_bytes = read_bytes;
+    page->file_stats.zero_bytes = zero_bytes;
     page->pagedir = cur->pagedir;
 
-    /* Default is_mmap to false; set this flag in sys_mmap(). */
+    /* Default is_mmap to false; vma_get_page() sets it for mappings. */
     page->is_mmap = false;
+    page->vma = NULL;
 
     /* Insert into table. */
     sup_page_insert(&cur->sup_page, page);
@@ -112,13 +209,6 @@ struct sup_page *sup_page_zero_create(uint8_t *upage, bool writable) {
     if (page == NULL) {
         sys_exit(-1);
     }
-    struct file_info *file_stats = malloc(sizeof(struct file_info));
-    if (file_stats == NULL) {
-        printf("Not enough space!\n");
-
-        free(page);
-        sys_exit(-1);
-    }
     page->addr = upage;
     ASSERT(pg_ofs(upage) == 0);
     page->status = ZERO_PAGE;
@@ -126,18 +216,20 @@ struct sup_page *sup_page_zero_create(uint8_t *upage, bool writable) {
     page->writable = writable;
     page->fte = NULL;
     page->swap_position = NOT_SWAP; /* Not in swap yet */
+    page->zswap = NULL;
     page->loaded = false;
+    page->share_next = NULL;
 
     /* Copy over file data. */
-    page->file_stats = file_stats;
-    page->file_stats->file = NULL;
-    page->file_stats->offset = 0;
-    page->file_stats->read_bytes = 0;
-    page->file_stats->zero_bytes = PGSIZE;
+    page->file_stats.file = NULL;
+    page->file_stats.offset = 0;
+    page->file_stats.read_bytes = 0;
+    page->file_stats.zero_bytes = PGSIZE;
     page->pagedir = cur->pagedir;
 
-    /* Default is_mmap to false; set this flag in sys_mmap(). */
+    /* Default is_mmap to false; vma_get_page() sets it for mappings. */
     page->is_mmap = false;
+    page->vma = NULL;
 
     /* Insert into table. */
     sup_page_insert(&cur->sup_page, page);
@@ -224,8 +316,117 @@ void sup_page_insert(struct hash *hash_table, struct sup_page *page) {
 /*! Copy data to the frame table. */
 bool fetch_data_to_frame(struct sup_page *page) {
     ASSERT(!page->loaded);
-    struct frame_table_entry *fte = get_frame();
+    /* Only zero-fill pages need a zeroed frame; swap and file pages
+       overwrite it, and file pages zero their own tail. */
+    return load_page(page, get_frame(page->status == ZERO_PAGE));
+}
+
+/*! After a fault on file-backed PAGE, also map the pages that follow it
+    in the same area, up to the fault-around window.  Only pages holding
+    file data are mapped, and only into frames that are already free, so
+    fault-around never causes evictions.  The extra pages are left marked
+    as not accessed, making them the first candidates for eviction if the
+    process never touches them. */
+void fetch_data_around(struct sup_page *page) {
+    struct thread *cur = thread_current();
+    struct vm_area *vma = page->vma;
+    uint8_t *upage = (uint8_t *) page->addr + PGSIZE;
+    size_t i;
+
+    if (vma == NULL || page->status != FILE_PAGE) {
+        return;
+    }
+
+    for (i = 1; i < fault_around_pages && upage < vma->end;
+         i++, upage += PGSIZE) {
+        /* Stop where the area's file data ends. */
+        if ((size_t) (upage - vma->start) >= vma->read_bytes) {
+            break;
+        }
+
+        struct sup_page *next = thread_sup_page_get(&cur->sup_page, upage);
+        if (next != NULL && (next->loaded || next->status != FILE_PAGE)) {
+            continue;
+        }
+
+        struct frame_table_entry *fte = try_get_frame(false);
+        if (fte == NULL) {
+            break;
+        }
+        next = vma_get_page(cur, upage);
+        if (load_page(next, fte)) {
+            pagedir_set_accessed(cur->pagedir, upage, false);
+            unpin(fte);
+        }
+        else {
+            /* Unpin only under the eviction lock, so that the evictor
+               cannot choose the frame before it is given back. */
+            acquire_eviction_lock();
+            unpin(fte);
+            evict_chosen_frame(fte, true);
+            release_eviction_lock();
+            break;
+        }
+    }
+}
 
+/*! Resolve a write fault on PAGE, which is resident but mapped read-only
+    because its frame is shared with a forked process.  The page gets a
+    private copy of the frame, or the frame itself once no other process
+    maps it.  Returns false if PAGE is not writable at all. */
+bool sup_page_unshare(struct sup_page *page) {
+    struct frame_table_entry *copy = NULL;
+    struct frame_table_entry *fte;
+
+    if (!page->writable) {
+        return false;
+    }
+
+    for (;;) {
+        acquire_eviction_lock();
+        fte = page->fte;
+        if (!page->loaded || fte == NULL) {
+            /* Evicted meanwhile; the retried write faults it back in. */
+            break;
+        }
+        if (fte->share_cnt == 1) {
+            pagedir_set_writable(page->pagedir, page->addr, true);
+            break;
+        }
+        if (copy != NULL) {
+            memcpy(copy->frame, fte->frame, PGSIZE);
+            frame_unshare(fte, page);
+            if (!pagedir_set_page(page->pagedir, page->addr, copy->frame,
+                                  true)) {
+                PANIC("lost page table for %p", page->addr);
+            }
+            page->fte = copy;
+            page->loaded = true;
+            copy->spte = page;
+            copy->share_cnt = 1;
+            copy->addr = page->addr;
+            copy->pagedir = page->pagedir;
+            release_eviction_lock();
+            unpin(copy);
+            return true;
+        }
+
+        /* Getting a frame may evict, which takes the eviction lock. */
+        release_eviction_lock();
+        copy = get_frame(false);
+    }
+    release_eviction_lock();
+
+    if (copy != NULL) {
+        unpin(copy);
+        free_frame(copy);
+    }
+    return true;
+}
+
+/*! Fill frame FTE with the contents of PAGE and map it.  The frame is
+    left pinned. */
+static bool load_page(struct sup_page *page, struct frame_table_entry *fte) {
     bool success = false;
     if (page->loaded) {
         return page->loaded;
@@ -251,6 +452,8 @@ bool fetch_data_to_frame(struct sup_page *page) {
     page->pagedir = pagedir;
     page->fte = fte;
     fte->spte = page;
+    fte->share_cnt = 1;
+    page->share_next = NULL;
     fte->addr = page->addr;
     fte->pagedir = page->pagedir;
 
@@ -300,10 +503,10 @@ static bool get_file_page(struct sup_page *page,
     uint8_t *upage = (uint8_t *) page->addr;
 
     /* Get file variables set during load_segment. */
-    struct file *file = page->file_stats->file;
-    off_t ofs = page->file_stats->offset;
-    size_t page_read_bytes = page->file_stats->read_bytes;
-    size_t page_zero_bytes = page->file_stats->zero_bytes;
+    struct file *file = page->file_stats.file;
+    off_t ofs = page->file_stats.offset;
+    size_t page_read_bytes = page->file_stats.read_bytes;
+    size_t page_zero_bytes = page->file_stats.zero_bytes;
 
     ASSERT (page_read_bytes <= PGSIZE);
     ASSERT (page_read_bytes + page_zero_bytes == PGSIZE);
@@ -338,14 +541,13 @@ static bool get_zero_page(struct sup_page *page,
     uint8_t *upage = (uint8_t *) page->addr;
 
     /* Get file variables set during load_segment. */
-    size_t page_read_bytes = page->file_stats->read_bytes;
-    size_t page_zero_bytes = page->file_stats->zero_bytes;
+    size_t page_read_bytes = page->file_stats.read_bytes;
+    size_t page_zero_bytes = page->file_stats.zero_bytes;
 
     ASSERT (page_read_bytes == 0);
     ASSERT (page_zero_bytes == PGSIZE);
 
-    /* Zero out bytes. */
-    memset(kpage, 0, PGSIZE);
+    /* The frame was handed out already zeroed by get_frame(). */
 
     /* Add the page to the process's address space. */
     if (!install_page(upage, kpage, writable)) {
@@ -15,6 +15,15 @@
 #define MAX_STACK 8 * 1024 * 1024 /*!< Maximum stack size in bytes. */
 #define NOT_SWAP -1
 
+/*! Default number of pages mapped per file-backed fault, counting the
+    faulting page itself. */
+#define FAULT_AROUND_DEFAULT 8
+
+extern size_t fault_around_pages;
+
+struct zswap_entry;
+struct vm_area;
+
 enum page_status {
     SWAP_PAGE,
     FILE_PAGE,
@@ -35,23 +44,30 @@ struct sup_page {
     struct frame_table_entry *fte;        /*!< Frame table entry. */
     enum page_status status;              /*!< Current status of page. */
     int swap_position;                    /*!< Swap position if in swap. -1 otherwise */
+    struct zswap_entry *zswap;            /*!< Compressed copy, if any. */
     uintptr_t page_no;                    /*!< Page number. */
     struct hash_elem sup_page_table_elem; /*!< Elem for supplemental page table. */
     bool writable;                        /*!< Whether page is writable. */
-    struct file_info *file_stats;         /*!< Keep track of file info. */
+    struct file_info file_stats;          /*!< Keep track of file info. */
     bool is_mmap;                         /*!< Page is part of mapped memory */
+    struct vm_area *vma;                  /*!< Area the page belongs to, if any. */
+    struct list_elem vma_elem;            /*!< Elem for the area's page list. */
     bool loaded;                          /*!< If file is already loaded... */
     uint32_t *pagedir;                    /*!< Page directory. */
+    struct sup_page *share_next;          /*!< Next page sharing the frame. */
 };
 
 /* Initializes supplemental page hash table */
 void thread_sup_page_table_init(struct thread *t);
 void thread_sup_page_table_delete(struct thread *t);
+bool thread_sup_page_table_fork(struct thread *child, struct thread *parent);
 struct sup_page *sup_page_file_create(struct file *file, off_t ofs,
     uint8_t *upage, size_t read_bytes, size_t zero_bytes, bool writable);
 struct sup_page *sup_page_zero_create(uint8_t *upage, bool writable);
 void sup_page_table_delete(struct hash *hash_table);
 bool fetch_data_to_frame(struct sup_page *page);
+void fetch_data_around(struct sup_page *page);
+bool sup_page_unshare(struct sup_page *page);
 
 struct sup_page *thread_sup_page_get(struct hash *hash_table, void *addr);
 unsigned sup_page_hash(const struct hash_elem *e, void *aux);
@@ -1,12 +1,25 @@
 #include <debug.h>
+#include <stdio.h>
+#include <stdint.h>
 
 #include "vm/swap.h"
 #include "vm/page.h"
+#include "vm/zswap.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "userprog/process.h"
 
 static struct swap_table global_swap;
 
+/* Number of pages referring to each swap slot.  Forked processes can
+   share a slot until one of them reads it back. */
+static uint16_t *slot_refs;
+
+/* Pages moved to and from the swap partition. */
+static long long swap_out_cnt;
+static long long swap_in_cnt;
+
 static struct lock swap_lock;
 
 /* Acquire's the swap lock so that there isn't concurrent writing to swap */
@@ -20,9 +33,11 @@ void release_swap_lock(void) {
 }
 
 /* Initialize the swap table. Populating the blocks and
-   the bitmap. */
-void swap_table_init(void) {
+   the bitmap.  ZSWAP_PAGES kernel pages are reserved for keeping
+   evicted pages compressed in memory before they reach the disk. */
+void swap_table_init(size_t zswap_pages) {
     lock_init(&swap_lock);
+    zswap_init(zswap_pages);
     /* Based on the number of slots, we want that number of bits */
     global_swap.swap_block = block_get_role(BLOCK_SWAP);
     int size = block_size(global_swap.swap_block);
@@ -33,9 +48,11 @@ void swap_table_init(void) {
        groups of 1 page slots we have (recall that size is in terms
        of block_sector_sizes) */
     global_swap.swap_bitmap = bitmap_create(size / SECTORS_PER_PAGE);
+    slot_refs = calloc(size / SECTORS_PER_PAGE, sizeof *slot_refs);
 
     /* Check if allocations worked. */
-    if (global_swap.swap_bitmap == NULL || global_swap.swap_block == NULL) {
+    if (global_swap.swap_bitmap == NULL || global_swap.swap_block == NULL
+        || slot_refs == NULL) {
         PANIC("Swap partition not allocated properly!");
     }
 
@@ -46,21 +63,25 @@ void swap_table_init(void) {
 /* Freeing the swap table... */
 void swap_table_free(void) {
     bitmap_destroy(global_swap.swap_bitmap);
+    free(slot_refs);
 }
 
-/* This will take in an entry of a page table,
-   and insert it into the swap table */
-size_t swap_table_out(struct sup_page *evicted_page) {
-    acquire_swap_lock();
+/* Drop one reference to swap slot IDX, freeing the slot when no page
+   refers to it any more.  The swap lock must be held. */
+static void swap_slot_put(size_t idx) {
+    ASSERT(slot_refs[idx] > 0);
+    if (--slot_refs[idx] == 0) {
+        bitmap_reset(global_swap.swap_bitmap, idx);
+    }
+}
+
+/* Write the page at KPAGE to a free swap slot and return the slot's
+   index.  The swap lock must be held. */
+size_t swap_slot_write(const void *kpage) {
     size_t swap_idx;
     int cnt_sector;
-    evicted_page->status = SWAP_PAGE;
-    struct frame_table_entry *fte = evicted_page->fte;
-
-    /* Start using physical address */
-    uint8_t *kpage = (uint8_t *) fte->frame;
-
 
+    ASSERT(lock_held_by_current_thread(&swap_lock));
     swap_idx = bitmap_scan_and_flip(global_swap.swap_bitmap,
                                     SWAP_BITMAP_START,
                                     SINGLE_BIT,
@@ -77,22 +98,42 @@ size_t swap_table_out(struct sup_page *evicted_page) {
         int block_offset = swap_idx * SECTORS_PER_PAGE + cnt_sector;
         block_write(global_swap.swap_block,
                     block_offset,
-                    kpage + cnt_sector * BLOCK_SECTOR_SIZE);
+                    (const uint8_t *) kpage + cnt_sector * BLOCK_SECTOR_SIZE);
     }
-    release_swap_lock();
-
+    slot_refs[swap_idx] = 1;
+    swap_out_cnt++;
     return swap_idx;
 }
 
+/* This will take in an entry of a page table, and move its frame's
+   contents into the compressed tier or, failing that, into a slot
+   of the swap partition */
+void swap_table_out(struct sup_page *evicted_page) {
+    acquire_swap_lock();
+    evicted_page->status = SWAP_PAGE;
+    evicted_page->swap_position = NOT_SWAP;
+    struct frame_table_entry *fte = evicted_page->fte;
+
+    /* Start using physical address */
+    uint8_t *kpage = (uint8_t *) fte->frame;
+
+    if (!zswap_store(evicted_page, kpage)) {
+        evicted_page->swap_position = swap_slot_write(kpage);
+    }
+    thread_current()->usage.swap_outs++;
+    release_swap_lock();
+}
+
 /* This will take a swap index, and then write it into a frame.
    It will also free up a space in the swap table. */
 bool swap_table_in(struct sup_page *dest_page, struct frame_table_entry *fte) {
 
     acquire_swap_lock();
     int swap_idx = dest_page->swap_position;
-    ASSERT(swap_idx > -1);
+    ASSERT(swap_idx > -1 || dest_page->zswap != NULL);
 
-    if (bitmap_test(global_swap.swap_bitmap, swap_idx) != SWAP_OCCUPIED) {
+    if (dest_page->zswap == NULL &&
+        bitmap_test(global_swap.swap_bitmap, swap_idx) != SWAP_OCCUPIED) {
         release_swap_lock();
         return false;
     }
@@ -108,9 +149,17 @@ bool swap_table_in(struct sup_page *dest_page, struct frame_table_entry *fte) {
         return false;
     }
 
+    /* Pages still held in compressed form never touch the disk. */
+    if (dest_page->zswap != NULL) {
+        zswap_load(dest_page, kpage);
+        thread_current()->usage.swap_ins++;
+        release_swap_lock();
+        return true;
+    }
 
-    /* Free the slot */
-    bitmap_flip(global_swap.swap_bitmap, swap_idx);
+    /* Drop this page's claim on the slot */
+    swap_slot_put(swap_idx);
+    dest_page->swap_position = NOT_SWAP;
 
     /* Read into each frame buffer from a swap slot at idx */
     /* Recall that this writes in BLOCK_SECTOR_SIZE amounts at a time */
@@ -119,8 +168,66 @@ bool swap_table_in(struct sup_page *dest_page, struct frame_table_entry *fte) {
         block_read(global_swap.swap_block, block_offset,
                     kpage + cnt_sector * BLOCK_SECTOR_SIZE);
     }
+    swap_in_cnt++;
+    thread_current()->usage.swap_ins++;
 
     release_swap_lock();
     return true;
 }
 
+/* Release whatever swap space is holding the contents of PAGE, which
+   is being destroyed without being read back in. */
+void swap_table_discard(struct sup_page *page) {
+    acquire_swap_lock();
+    if (page->zswap != NULL) {
+        zswap_discard(page);
+    }
+    else if (page->swap_position != NOT_SWAP &&
+             bitmap_test(global_swap.swap_bitmap, page->swap_position)) {
+        swap_slot_put(page->swap_position);
+    }
+    page->swap_position = NOT_SWAP;
+    release_swap_lock();
+}
+
+/* Write out the frame of FTE, which several forked processes map, to a
+   single swap slot that all of its pages then refer to.  The compressed
+   tier is skipped because its entries belong to one page each. */
+void swap_table_out_shared(struct frame_table_entry *fte) {
+    struct sup_page *page;
+    size_t swap_idx;
+
+    acquire_swap_lock();
+    swap_idx = swap_slot_write(fte->frame);
+    slot_refs[swap_idx] = fte->share_cnt;
+    for (page = fte->spte; page != NULL; page = page->share_next) {
+        page->status = SWAP_PAGE;
+        page->swap_position = swap_idx;
+    }
+    thread_current()->usage.swap_outs++;
+    release_swap_lock();
+}
+
+/* Take another reference to the swap slot holding PAGE, which is not
+   resident, for a forked copy of it.  A compressed copy is first moved
+   to disk.  Returns the slot. */
+size_t swap_table_share(struct sup_page *page) {
+    size_t swap_idx;
+
+    acquire_swap_lock();
+    if (page->zswap != NULL) {
+        zswap_flush(page);
+    }
+    ASSERT(page->swap_position != NOT_SWAP);
+    swap_idx = page->swap_position;
+    slot_refs[swap_idx]++;
+    release_swap_lock();
+    return swap_idx;
+}
+
+/* Prints swap statistics. */
+void swap_print_stats(void) {
+    printf("Swap: %lld pages written, %lld pages read\n",
+           swap_out_cnt, swap_in_cnt);
+    zswap_print_stats();
+}
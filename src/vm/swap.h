@@ -29,10 +29,15 @@ struct swap_table {
 
 /* Function definitions */
 
-void swap_table_init(void);
+void swap_table_init(size_t zswap_pages);
 void swap_table_free(void);
-size_t swap_table_out(struct sup_page *evicted_page);
+void swap_table_out(struct sup_page *evicted_page);
 bool swap_table_in(struct sup_page *dest_page, struct frame_table_entry *fte);
+void swap_table_discard(struct sup_page *page);
+void swap_table_out_shared(struct frame_table_entry *fte);
+size_t swap_table_share(struct sup_page *page);
+size_t swap_slot_write(const void *kpage);
+void swap_print_stats(void);
 void acquire_swap_lock(void);
 void release_swap_lock(void);
 
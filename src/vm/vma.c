@@ -0,0 +1,267 @@
+/*! \file vma.c
+ *
+ * Virtual memory areas.  Executable segments and memory mapped files are
+ * recorded as one area per range instead of one supplemental page per
+ * page.  The areas of a process are kept in a treap keyed by start
+ * address, so lookups, inserts and removals take O(log n) expected time
+ * in the number of areas regardless of how large they are.
+ */
+
+#include "vm/vma.h"
+#include <debug.h>
+#include <random.h>
+#include <round.h>
+#include <user/vdata.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+static struct vm_area *treap_insert(struct vm_area *root,
+                                    struct vm_area *vma);
+static struct vm_area *treap_remove(struct vm_area *root,
+                                    struct vm_area *vma);
+static struct vm_area *treap_merge(struct vm_area *low,
+                                   struct vm_area *high);
+static void treap_destroy(struct vm_area *root);
+static bool treap_fork(struct thread *child, struct thread *parent,
+                       struct vm_area *root);
+
+/*! Initialize an empty set of areas. */
+void vma_tree_init(struct vma_tree *tree) {
+    tree->root = NULL;
+    tree->count = 0;
+}
+
+/*! Free every area in TREE.  Their supplemental pages must already
+    have been freed. */
+void vma_tree_destroy(struct vma_tree *tree) {
+    treap_destroy(tree->root);
+    vma_tree_init(tree);
+}
+
+/*! Give CHILD a copy of every area of PARENT.  Mapped files are reopened
+    for the child, and executable segments refer to the child's own copy
+    of the executable.  Returns false if memory runs out, leaving the
+    areas copied so far in CHILD. */
+bool vma_tree_fork(struct thread *child, struct thread *parent) {
+    return treap_fork(child, parent, parent->vmas.root);
+}
+
+/*! Record that LENGTH bytes starting at page-aligned START are backed by
+    FILE from OFFSET.  The first READ_BYTES bytes come from the file and
+    the rest of the last page is zero-filled.  If IS_MMAP is set the area
+    owns FILE, writes dirty pages back to it, and closes it when removed.
+    Returns the new area, or NULL if the range is invalid, overlaps an
+    existing area or the kernel data page, or memory is short. */
+struct vm_area *vma_create(struct thread *t, void *start, size_t length,
+    struct file *file, off_t offset, size_t read_bytes, bool writable,
+    bool is_mmap) {
+    uint8_t *end = (uint8_t *) start + ROUND_UP(length, PGSIZE);
+    struct vm_area *vma;
+
+    ASSERT(pg_ofs(start) == 0);
+    if (length == 0 || end <= (uint8_t *) start || !is_user_vaddr(end - 1)
+        || vma_overlaps(&t->vmas, start, end)
+        || ((uint8_t *) start <= (uint8_t *) VDATA_ADDR
+            && (uint8_t *) VDATA_ADDR < end)) {
+        return NULL;
+    }
+
+    vma = malloc(sizeof *vma);
+    if (vma == NULL)
+        return NULL;
+    vma->start = start;
+    vma->end = end;
+    vma->file = file;
+    vma->offset = offset;
+    vma->read_bytes = read_bytes;
+    vma->writable = writable;
+    vma->is_mmap = is_mmap;
+    list_init(&vma->pages);
+    vma->left = vma->right = NULL;
+    vma->priority = random_ulong();
+
+    t->vmas.root = treap_insert(t->vmas.root, vma);
+    t->vmas.count++;
+    return vma;
+}
+
+/*! Unmap VMA from T's address space.  Resident pages are evicted, which
+    writes dirty mapped pages back to their file. */
+void vma_remove(struct thread *t, struct vm_area *vma) {
+    while (!list_empty(&vma->pages)) {
+        struct sup_page *page = list_entry(list_front(&vma->pages),
+                                           struct sup_page, vma_elem);
+        sup_page_delete(&t->sup_page, page->addr);
+    }
+
+    t->vmas.root = treap_remove(t->vmas.root, vma);
+    t->vmas.count--;
+    if (vma->is_mmap)
+        file_close(vma->file);
+    free(vma);
+}
+
+/*! Returns the area containing ADDR, or NULL if there is none. */
+struct vm_area *vma_find(const struct vma_tree *tree, const void *addr) {
+    struct vm_area *vma = tree->root;
+    while (vma != NULL) {
+        if ((const uint8_t *) addr < vma->start)
+            vma = vma->left;
+        else if ((const uint8_t *) addr >= vma->end)
+            vma = vma->right;
+        else
+            return vma;
+    }
+    return NULL;
+}
+
+/*! Returns true if any area intersects [START, END).  Areas never
+    overlap, so ordering by start also orders them by end. */
+bool vma_overlaps(const struct vma_tree *tree, const void *start,
+                  const void *end) {
+    struct vm_area *vma = tree->root;
+    while (vma != NULL) {
+        if (vma->end <= (const uint8_t *) start)
+            vma = vma->right;
+        else if (vma->start >= (const uint8_t *) end)
+            vma = vma->left;
+        else
+            return true;
+    }
+    return false;
+}
+
+/*! Returns the supplemental page for ADDR in T, creating it from the
+    enclosing area on first use.  Returns NULL if ADDR is not mapped. */
+struct sup_page *vma_get_page(struct thread *t, void *addr) {
+    uint8_t *upage = pg_round_down(addr);
+    struct sup_page *page = thread_sup_page_get(&t->sup_page, upage);
+    struct vm_area *vma;
+    size_t ofs, read_bytes;
+
+    if (page != NULL)
+        return page;
+
+    vma = vma_find(&t->vmas, upage);
+    if (vma == NULL)
+        return NULL;
+
+    ofs = upage - vma->start;
+    read_bytes = ofs < vma->read_bytes ? vma->read_bytes - ofs : 0;
+    if (read_bytes > PGSIZE)
+        read_bytes = PGSIZE;
+
+    page = sup_page_file_create(vma->file, vma->offset + ofs, upage,
+                                read_bytes, PGSIZE - read_bytes,
+                                vma->writable);
+    page->is_mmap = vma->is_mmap;
+    page->vma = vma;
+    list_push_back(&vma->pages, &page->vma_elem);
+    return page;
+}
+
+/*! Inserts VMA into the treap rooted at ROOT and returns the new root. */
+static struct vm_area *treap_insert(struct vm_area *root,
+                                    struct vm_area *vma) {
+    if (root == NULL)
+        return vma;
+
+    if (vma->start < root->start) {
+        root->left = treap_insert(root->left, vma);
+        if (root->left->priority > root->priority) {
+            /* Rotate right. */
+            struct vm_area *l = root->left;
+            root->left = l->right;
+            l->right = root;
+            root = l;
+        }
+    }
+    else {
+        root->right = treap_insert(root->right, vma);
+        if (root->right->priority > root->priority) {
+            /* Rotate left. */
+            struct vm_area *r = root->right;
+            root->right = r->left;
+            r->left = root;
+            root = r;
+        }
+    }
+    return root;
+}
+
+/*! Removes VMA from the treap rooted at ROOT and returns the new root. */
+static struct vm_area *treap_remove(struct vm_area *root,
+                                    struct vm_area *vma) {
+    ASSERT(root != NULL);
+    if (root == vma)
+        return treap_merge(vma->left, vma->right);
+
+    if (vma->start < root->start)
+        root->left = treap_remove(root->left, vma);
+    else
+        root->right = treap_remove(root->right, vma);
+    return root;
+}
+
+/*! Joins two treaps where every area in LOW is below every area in
+    HIGH. */
+static struct vm_area *treap_merge(struct vm_area *low,
+                                   struct vm_area *high) {
+    if (low == NULL)
+        return high;
+    if (high == NULL)
+        return low;
+
+    if (low->priority > high->priority) {
+        low->right = treap_merge(low->right, high);
+        return low;
+    }
+    high->left = treap_merge(low, high->left);
+    return high;
+}
+
+/*! Frees every area below ROOT. */
+static void treap_destroy(struct vm_area *root) {
+    if (root == NULL)
+        return;
+    treap_destroy(root->left);
+    treap_destroy(root->right);
+    ASSERT(list_empty(&root->pages));
+    if (root->is_mmap)
+        file_close(root->file);
+    free(root);
+}
+
+/*! Copies every area below ROOT, which belongs to PARENT, into CHILD. */
+static bool treap_fork(struct thread *child, struct thread *parent,
+                       struct vm_area *root) {
+    struct file *file;
+
+    if (root == NULL)
+        return true;
+    if (!treap_fork(child, parent, root->left))
+        return false;
+
+    file = root->file;
+    if (root->is_mmap) {
+        file = file_reopen(file);
+        if (file == NULL)
+            return false;
+    }
+    else if (file != NULL) {
+        ASSERT(file == parent->executable);
+        file = child->executable;
+    }
+
+    if (vma_create(child, root->start, root->end - root->start, file,
+                   root->offset, root->read_bytes, root->writable,
+                   root->is_mmap) == NULL) {
+        if (root->is_mmap)
+            file_close(file);
+        return false;
+    }
+    return treap_fork(child, parent, root->right);
+}
@@ -0,0 +1,58 @@
+/*! \file vma.h
+ *
+ * Declarations for virtual memory areas
+ */
+
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct thread;
+struct file;
+struct sup_page;
+
+/*! A page-aligned range of user virtual memory that is backed the same
+    way throughout.  Supplemental pages for the range are only created
+    when a page is first touched. */
+struct vm_area {
+    uint8_t *start;                 /*!< First byte of the range. */
+    uint8_t *end;                   /*!< One past the last byte. */
+    struct file *file;              /*!< Backing file, if any. */
+    off_t offset;                   /*!< File offset of START. */
+    size_t read_bytes;              /*!< Bytes read from FILE, rest zeroed. */
+    bool writable;                  /*!< Whether the range is writable. */
+    bool is_mmap;                   /*!< Dirty pages go back to FILE. */
+    struct list pages;              /*!< Supplemental pages created so far. */
+
+    struct vm_area *left;           /*!< Treap child with lower addresses. */
+    struct vm_area *right;          /*!< Treap child with higher addresses. */
+    unsigned long priority;         /*!< Treap heap priority. */
+};
+
+/*! Areas of one address space, kept in a treap ordered by address. */
+struct vma_tree {
+    struct vm_area *root;           /*!< Root of the treap. */
+    size_t count;                   /*!< Number of areas. */
+};
+
+void vma_tree_init(struct vma_tree *tree);
+void vma_tree_destroy(struct vma_tree *tree);
+bool vma_tree_fork(struct thread *child, struct thread *parent);
+
+struct vm_area *vma_create(struct thread *t, void *start, size_t length,
+    struct file *file, off_t offset, size_t read_bytes, bool writable,
+    bool is_mmap);
+void vma_remove(struct thread *t, struct vm_area *vma);
+
+struct vm_area *vma_find(const struct vma_tree *tree, const void *addr);
+bool vma_overlaps(const struct vma_tree *tree, const void *start,
+                  const void *end);
+
+struct sup_page *vma_get_page(struct thread *t, void *addr);
+
+#endif /* vm/vma.h */
@@ -0,0 +1,333 @@
+/*! \file zswap.c
+ *
+ * Compressed in-memory tier that sits in front of the swap partition.
+ *
+ * Evicted anonymous pages are first offered to this tier.  Pages made of
+ * a single repeated 32-bit word (most commonly all zeros) are recorded as
+ * just that word.  Other pages are compressed with a small LZ77 coder and
+ * stored in a pool of kernel pages reserved at boot.  When the pool runs
+ * out of room, the coldest entries are decompressed and written to the
+ * swap partition to make space.  Pages that compress poorly go straight
+ * to disk.
+ */
+
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+
+/* Parameters of the LZ coder.  A match is coded in 16 bits: 6 bits of
+   length and 10 bits of offset. */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 63)
+#define LZ_MAX_OFFSET 1024
+#define LZ_HASH_SIZE 1024
+
+/*! Pool the compressed pages are stored in. */
+static uint8_t *zswap_pool;
+/*! Chunks of the pool in use. */
+static struct bitmap *zswap_chunk_map;
+/*! Compressed entries, coldest first. */
+static struct list zswap_lru;
+
+/*! Scratch space for the compressor and for writeback. */
+static uint8_t *zswap_buffer;
+static uint8_t *zswap_bounce;
+static uint16_t *lz_table;
+
+/* Statistics. */
+static long long zswap_stored_cnt;     /*!< Pages compressed into the pool. */
+static long long zswap_same_cnt;       /*!< Same-filled pages recorded. */
+static long long zswap_reject_cnt;     /*!< Pages that did not compress. */
+static long long zswap_load_cnt;       /*!< Pages brought back in. */
+static long long zswap_writeback_cnt;  /*!< Entries spilled to disk. */
+
+static bool page_same_filled(const void *kpage, uint32_t *fill);
+static size_t lz_compress(const uint8_t *src, size_t src_len,
+                          uint8_t *dst, size_t dst_len);
+static bool lz_decompress(const uint8_t *src, size_t src_len,
+                          uint8_t *dst, size_t dst_len);
+static void zswap_writeback(struct zswap_entry *e);
+static void zswap_release(struct zswap_entry *e);
+
+/*! Reserve POOL_PAGES kernel pages for the compressed tier.  A size of
+    zero leaves the tier disabled and every page goes to disk. */
+void zswap_init(size_t pool_pages) {
+    list_init(&zswap_lru);
+    if (pool_pages == 0)
+        return;
+
+    zswap_pool = palloc_get_multiple(0, pool_pages);
+    zswap_buffer = palloc_get_page(0);
+    zswap_bounce = palloc_get_page(0);
+    lz_table = malloc(LZ_HASH_SIZE * sizeof *lz_table);
+    zswap_chunk_map = bitmap_create(pool_pages * PGSIZE / ZSWAP_CHUNK_SIZE);
+    if (zswap_pool == NULL || zswap_buffer == NULL || zswap_bounce == NULL
+        || lz_table == NULL || zswap_chunk_map == NULL) {
+        printf("zswap: not enough memory, compressed swap disabled\n");
+        if (zswap_pool != NULL)
+            palloc_free_multiple(zswap_pool, pool_pages);
+        palloc_free_page(zswap_buffer);
+        palloc_free_page(zswap_bounce);
+        free(lz_table);
+        if (zswap_chunk_map != NULL)
+            bitmap_destroy(zswap_chunk_map);
+        zswap_pool = NULL;
+        return;
+    }
+}
+
+/*! Try to keep the contents of KPAGE, which belongs to PAGE, in memory.
+    Returns false if the tier is disabled or the page does not compress
+    well, in which case the caller writes it to disk. */
+bool zswap_store(struct sup_page *page, const void *kpage) {
+    struct zswap_entry *e;
+    size_t size, idx;
+
+    ASSERT(page->zswap == NULL);
+    if (zswap_pool == NULL)
+        return false;
+
+    e = malloc(sizeof *e);
+    if (e == NULL)
+        return false;
+    e->page = page;
+
+    /* Same-filled pages only need the fill word. */
+    if (page_same_filled(kpage, &e->fill)) {
+        e->chunk = 0;
+        e->chunk_cnt = 0;
+        e->length = 0;
+        page->zswap = e;
+        zswap_same_cnt++;
+        return true;
+    }
+
+    size = lz_compress(kpage, PGSIZE, zswap_buffer, ZSWAP_MAX_SIZE);
+    if (size == 0) {
+        free(e);
+        zswap_reject_cnt++;
+        return false;
+    }
+
+    /* Spill the coldest entries until a large enough run is free. */
+    e->chunk_cnt = DIV_ROUND_UP(size, ZSWAP_CHUNK_SIZE);
+    idx = bitmap_scan_and_flip(zswap_chunk_map, 0, e->chunk_cnt, false);
+    while (idx == BITMAP_ERROR) {
+        if (list_empty(&zswap_lru)) {
+            free(e);
+            return false;
+        }
+        zswap_writeback(list_entry(list_front(&zswap_lru),
+                                   struct zswap_entry, lru_elem));
+        idx = bitmap_scan_and_flip(zswap_chunk_map, 0, e->chunk_cnt, false);
+    }
+
+    e->chunk = idx;
+    e->length = size;
+    memcpy(zswap_pool + idx * ZSWAP_CHUNK_SIZE, zswap_buffer, size);
+    list_push_back(&zswap_lru, &e->lru_elem);
+    page->zswap = e;
+    zswap_stored_cnt++;
+    return true;
+}
+
+/*! Restore PAGE's contents into KPAGE and drop its compressed copy. */
+void zswap_load(struct sup_page *page, void *kpage) {
+    struct zswap_entry *e = page->zswap;
+    ASSERT(e != NULL);
+
+    if (e->chunk_cnt == 0) {
+        uint32_t *word = kpage;
+        size_t i;
+        for (i = 0; i < PGSIZE / sizeof *word; i++)
+            word[i] = e->fill;
+    }
+    else if (!lz_decompress(zswap_pool + e->chunk * ZSWAP_CHUNK_SIZE,
+                            e->length, kpage, PGSIZE)) {
+        PANIC("zswap: corrupt entry for page %p", page->addr);
+    }
+
+    zswap_load_cnt++;
+    zswap_release(e);
+}
+
+/*! Drop PAGE's compressed copy without reading it. */
+void zswap_discard(struct sup_page *page) {
+    if (page->zswap != NULL)
+        zswap_release(page->zswap);
+}
+
+/*! Move PAGE's compressed copy out to a swap slot on disk, so that the
+    slot can be shared with another page. */
+void zswap_flush(struct sup_page *page) {
+    struct zswap_entry *e = page->zswap;
+    ASSERT(e != NULL);
+
+    if (e->chunk_cnt > 0) {
+        zswap_writeback(e);
+        return;
+    }
+
+    uint32_t *word = (uint32_t *) zswap_bounce;
+    size_t i;
+    for (i = 0; i < PGSIZE / sizeof *word; i++)
+        word[i] = e->fill;
+    zswap_writeback_cnt++;
+    zswap_release(e);
+    page->swap_position = swap_slot_write(zswap_bounce);
+}
+
+/*! Prints compressed swap statistics. */
+void zswap_print_stats(void) {
+    printf("Zswap: %lld compressed, %lld same-filled, %lld rejected, "
+           "%lld loaded, %lld written back\n",
+           zswap_stored_cnt, zswap_same_cnt, zswap_reject_cnt,
+           zswap_load_cnt, zswap_writeback_cnt);
+}
+
+/*! Move entry E out to a swap slot on disk. */
+static void zswap_writeback(struct zswap_entry *e) {
+    struct sup_page *page = e->page;
+
+    if (!lz_decompress(zswap_pool + e->chunk * ZSWAP_CHUNK_SIZE,
+                       e->length, zswap_bounce, PGSIZE)) {
+        PANIC("zswap: corrupt entry for page %p", page->addr);
+    }
+    zswap_writeback_cnt++;
+    zswap_release(e);
+    page->swap_position = swap_slot_write(zswap_bounce);
+}
+
+/*! Free entry E and the pool space it occupies. */
+static void zswap_release(struct zswap_entry *e) {
+    if (e->chunk_cnt > 0) {
+        bitmap_set_multiple(zswap_chunk_map, e->chunk, e->chunk_cnt, false);
+        list_remove(&e->lru_elem);
+    }
+    e->page->zswap = NULL;
+    free(e);
+}
+
+/*! Returns true if KPAGE is one 32-bit word repeated, storing the word
+    in FILL. */
+static bool page_same_filled(const void *kpage, uint32_t *fill) {
+    const uint32_t *word = kpage;
+    size_t i;
+
+    for (i = 1; i < PGSIZE / sizeof *word; i++) {
+        if (word[i] != word[0])
+            return false;
+    }
+    *fill = word[0];
+    return true;
+}
+
+/*! Compress SRC_LEN bytes at SRC into DST.  Returns the compressed size,
+    or 0 if it would exceed DST_LEN.
+
+    The output is a sequence of groups: a control byte followed by eight
+    items.  Bit N of the control byte says whether item N is a literal
+    byte (0) or a two-byte back reference (1). */
+static size_t lz_compress(const uint8_t *src, size_t src_len,
+                          uint8_t *dst, size_t dst_len) {
+    uint8_t *ctrl = NULL;
+    size_t s = 0, d = 0;
+    int bit = 8;
+
+    memset(lz_table, 0, LZ_HASH_SIZE * sizeof *lz_table);
+    while (s < src_len) {
+        size_t len = 0, off = 0;
+
+        if (bit == 8) {
+            if (d >= dst_len)
+                return 0;
+            ctrl = &dst[d++];
+            *ctrl = 0;
+            bit = 0;
+        }
+
+        /* Look for an earlier occurrence of the next three bytes.  The
+           table stores positions plus one so that zero means empty. */
+        if (s + LZ_MIN_MATCH <= src_len) {
+            unsigned h = ((src[s] << 6) ^ (src[s + 1] << 3) ^ src[s + 2])
+                         & (LZ_HASH_SIZE - 1);
+            size_t cand = lz_table[h];
+            lz_table[h] = s + 1;
+            if (cand != 0 && s - (cand - 1) <= LZ_MAX_OFFSET) {
+                const uint8_t *m = src + cand - 1;
+                size_t max = src_len - s;
+                if (max > LZ_MAX_MATCH)
+                    max = LZ_MAX_MATCH;
+                while (len < max && m[len] == src[s + len])
+                    len++;
+                off = s - (cand - 1);
+            }
+        }
+
+        if (len >= LZ_MIN_MATCH) {
+            unsigned code = ((len - LZ_MIN_MATCH) << 10) | (off - 1);
+            if (d + 2 > dst_len)
+                return 0;
+            *ctrl |= 1 << bit;
+            dst[d++] = code >> 8;
+            dst[d++] = code & 0xff;
+            s += len;
+        }
+        else {
+            if (d >= dst_len)
+                return 0;
+            dst[d++] = src[s++];
+        }
+        bit++;
+    }
+    return d;
+}
+
+/*! Expand SRC_LEN bytes of compressed data at SRC into exactly DST_LEN
+    bytes at DST.  Returns false if the input is malformed. */
+static bool lz_decompress(const uint8_t *src, size_t src_len,
+                          uint8_t *dst, size_t dst_len) {
+    size_t s = 0, d = 0;
+    uint8_t ctrl = 0;
+    int bit = 8;
+
+    while (d < dst_len) {
+        if (bit == 8) {
+            if (s >= src_len)
+                return false;
+            ctrl = src[s++];
+            bit = 0;
+        }
+
+        if (ctrl & (1 << bit)) {
+            unsigned code;
+            size_t len, off;
+
+            if (s + 2 > src_len)
+                return false;
+            code = (src[s] << 8) | src[s + 1];
+            s += 2;
+            len = (code >> 10) + LZ_MIN_MATCH;
+            off = (code & 0x3ff) + 1;
+            if (off > d || d + len > dst_len)
+                return false;
+            for (; len > 0; len--, d++)
+                dst[d] = dst[d - off];
+        }
+        else {
+            if (s >= src_len)
+                return false;
+            dst[d++] = src[s++];
+        }
+        bit++;
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+/*! \file zswap.h
+ *
+ * Declarations for the compressed in-memory swap tier
+ */
+
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "vm/page.h"
+
+/*! Default number of kernel pages reserved for compressed swap. */
+#define ZSWAP_DEFAULT_PAGES 64
+
+/*! Granularity of allocations inside the compressed pool. */
+#define ZSWAP_CHUNK_SIZE 64
+
+/*! Pages that do not compress below this size go straight to disk. */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+/*! Compressed copy of an evicted page. */
+struct zswap_entry {
+    struct sup_page *page;        /*!< Page this entry holds data for. */
+    size_t chunk;                 /*!< First chunk in the pool. */
+    size_t chunk_cnt;             /*!< Chunks used; 0 for same-filled pages. */
+    size_t length;                /*!< Compressed length in bytes. */
+    uint32_t fill;                /*!< Fill word of a same-filled page. */
+    struct list_elem lru_elem;    /*!< Elem for the writeback LRU list. */
+};
+
+/* Functions below must be called with the swap lock held. */
+void zswap_init(size_t pool_pages);
+bool zswap_store(struct sup_page *page, const void *kpage);
+void zswap_load(struct sup_page *page, void *kpage);
+void zswap_discard(struct sup_page *page);
+void zswap_flush(struct sup_page *page);
+void zswap_print_stats(void);
+
+#endif /* vm/zswap.h */